@@ -0,0 +1,279 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "GpuTimer.h"
+
+//Texture units of the upsample in shaderPhong and shaderDeferred
+const GLint AmbientOcclusionTextureUnit = 7;
+const GLint AmbientOcclusionDepthTextureUnit = 8;
+
+//View space radius of the sample hemisphere
+const float AmbientOcclusionRadius = 0.5f;
+
+//Steps from best to cheapest, the budget moves between them
+struct AmbientOcclusionQuality
+{
+    int sampleCount;
+    bool blur;
+};
+
+const AmbientOcclusionQuality AmbientOcclusionQualities[] = { { 16, true }, { 8, true }, { 4, true }, { 4, false } };
+const int AmbientOcclusionQualityCount = sizeof(AmbientOcclusionQualities) / sizeof(AmbientOcclusionQualities[0]);
+
+//Fraction of the GPU frame time the passes may take
+const float AmbientOcclusionDefaultBudget = 0.1f;
+//Frames between quality changes, and between reports of the measured cost
+const int AmbientOcclusionSwitchFrames = 30;
+const int AmbientOcclusionReportFrames = 600;
+
+struct AmbientOcclusionSettings
+{
+    bool enabled = false;
+    float budget = AmbientOcclusionDefaultBudget;
+};
+
+//Depth is reduced to half resolution linear view depth, occlusion is computed from it with
+//a rotated hemisphere kernel, then blurred along each axis with weights that drop across
+//depth edges. The lighting shaders upsample the result with the same depth.
+struct AmbientOcclusion
+{
+    AmbientOcclusionSettings settings;
+
+    //Half the full size target
+    int width = 0;
+    int height = 0;
+    //Part written this frame, half of the scene viewport
+    glm::ivec4 viewport = glm::ivec4(0);
+
+    GLuint depthFramebuffer = 0;
+    GLuint depthTexture = 0;
+    GLuint occlusionFramebuffer = 0;
+    GLuint occlusionTexture = 0;
+    GLuint blurFramebuffer = 0;
+    GLuint blurTexture = 0;
+
+    GLuint depthProgram = 0;
+    GLint depthParametersLocation = -1;
+    GLint sourceSizeLocation = -1;
+
+    GLuint occlusionProgram = 0;
+    GLint projectionScaleLocation = -1;
+    GLint occlusionSizeLocation = -1;
+    GLint sampleCountLocation = -1;
+
+    GLuint blurProgram = 0;
+    GLint directionLocation = -1;
+    GLint blurSizeLocation = -1;
+
+    GLuint emptyVertexArray = 0;
+
+    int quality = 0;
+    GpuTimer timer;
+    int framesSinceSwitch = 0;
+    int framesSinceReport = 0;
+};
+
+//--ssao [--ssao-budget <percent of the frame>]
+bool ParseAmbientOcclusionArguments(int argc, char** argv, AmbientOcclusionSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--ssao") == 0)
+            settings.enabled = true;
+        else if (strcmp(argv[i], "--ssao-budget") == 0 && i + 1 < argc)
+        {
+            settings.budget = static_cast<float>(atof(argv[++i])) / 100.0f;
+            if (settings.budget <= 0.0f || settings.budget > 1.0f)
+            {
+                std::cout << "Invalid value for --ssao-budget, expected a percentage of the frame time" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void CreateAmbientOcclusionTarget(GLuint& framebuffer, GLuint& texture, GLint internalFormat, GLenum format, GLenum type, int width, int height)
+{
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "Ambient occlusion framebuffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//width and height of the full resolution target
+void CreateAmbientOcclusion(AmbientOcclusion& ao, int width, int height, const char* vertexShaderFileName,
+    const char* depthFragmentShaderFileName, const char* occlusionFragmentShaderFileName, const char* blurFragmentShaderFileName)
+{
+    ao.width = (width + 1) / 2;
+    ao.height = (height + 1) / 2;
+
+    CreateAmbientOcclusionTarget(ao.depthFramebuffer, ao.depthTexture, GL_R32F, GL_RED, GL_FLOAT, ao.width, ao.height);
+    CreateAmbientOcclusionTarget(ao.occlusionFramebuffer, ao.occlusionTexture, GL_R8, GL_RED, GL_UNSIGNED_BYTE, ao.width, ao.height);
+    CreateAmbientOcclusionTarget(ao.blurFramebuffer, ao.blurTexture, GL_R8, GL_RED, GL_UNSIGNED_BYTE, ao.width, ao.height);
+
+    ao.depthProgram = CompileShaders(vertexShaderFileName, depthFragmentShaderFileName);
+    glUseProgram(ao.depthProgram);
+    glUniform1i(glGetUniformLocation(ao.depthProgram, "depth"), 0);
+    ao.depthParametersLocation = glGetUniformLocation(ao.depthProgram, "depthParameters");
+    ao.sourceSizeLocation = glGetUniformLocation(ao.depthProgram, "sourceSize");
+
+    ao.occlusionProgram = CompileShaders(vertexShaderFileName, occlusionFragmentShaderFileName);
+    glUseProgram(ao.occlusionProgram);
+    glUniform1i(glGetUniformLocation(ao.occlusionProgram, "viewDepth"), 0);
+    glUniform1f(glGetUniformLocation(ao.occlusionProgram, "radius"), AmbientOcclusionRadius);
+    ao.projectionScaleLocation = glGetUniformLocation(ao.occlusionProgram, "projectionScale");
+    ao.occlusionSizeLocation = glGetUniformLocation(ao.occlusionProgram, "size");
+    ao.sampleCountLocation = glGetUniformLocation(ao.occlusionProgram, "sampleCount");
+
+    ao.blurProgram = CompileShaders(vertexShaderFileName, blurFragmentShaderFileName);
+    glUseProgram(ao.blurProgram);
+    glUniform1i(glGetUniformLocation(ao.blurProgram, "occlusion"), 0);
+    glUniform1i(glGetUniformLocation(ao.blurProgram, "viewDepth"), AmbientOcclusionDepthTextureUnit);
+    ao.directionLocation = glGetUniformLocation(ao.blurProgram, "direction");
+    ao.blurSizeLocation = glGetUniformLocation(ao.blurProgram, "size");
+
+    glGenVertexArrays(1, &ao.emptyVertexArray);
+    CreateGpuTimer(ao.timer);
+}
+
+//Points the upsample samplers of a lighting program at their units
+void SetAmbientOcclusionSamplers(GLuint program)
+{
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "occlusion"), AmbientOcclusionTextureUnit);
+    glUniform1i(glGetUniformLocation(program, "occlusionDepth"), AmbientOcclusionDepthTextureUnit);
+}
+
+void BeginAmbientOcclusionFrame(AmbientOcclusion& ao, glm::ivec4 sceneViewport)
+{
+    ao.viewport = glm::ivec4(0, 0, (sceneViewport.z + 1) / 2, (sceneViewport.w + 1) / 2);
+}
+
+//Half resolution size and whether it is enabled, for the Lighting block
+glm::vec4 GetAmbientOcclusionSize(const AmbientOcclusion& ao)
+{
+    return glm::vec4(ao.viewport.z, ao.viewport.w, ao.settings.enabled ? 1.0f : 0.0f, 0.0f);
+}
+
+void DrawAmbientOcclusionPass(GLuint framebuffer)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+//Computes the occlusion from depth, the full resolution depth texture of the camera
+//passes, and leaves the result on its units for the lighting shaders
+void RenderAmbientOcclusion(AmbientOcclusion& ao, GLuint depth, glm::ivec4 sceneViewport, const glm::mat4& projection)
+{
+    const AmbientOcclusionQuality& quality = AmbientOcclusionQualities[ao.quality];
+    glm::ivec2 size = glm::ivec2(ao.viewport.z, ao.viewport.w);
+
+    BeginGpuTimer(ao.timer);
+
+    glViewport(ao.viewport.x, ao.viewport.y, ao.viewport.z, ao.viewport.w);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glBindVertexArray(ao.emptyVertexArray);
+
+    //Linear view depth at half resolution
+    glUseProgram(ao.depthProgram);
+    glUniform2f(ao.depthParametersLocation, projection[2][2], projection[3][2]);
+    glUniform2i(ao.sourceSizeLocation, sceneViewport.z, sceneViewport.w);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depth);
+    DrawAmbientOcclusionPass(ao.depthFramebuffer);
+
+    glUseProgram(ao.occlusionProgram);
+    glUniform2f(ao.projectionScaleLocation, 1.0f / projection[0][0], 1.0f / projection[1][1]);
+    glUniform2i(ao.occlusionSizeLocation, size.x, size.y);
+    glUniform1i(ao.sampleCountLocation, quality.sampleCount);
+    glBindTexture(GL_TEXTURE_2D, ao.depthTexture);
+    DrawAmbientOcclusionPass(ao.occlusionFramebuffer);
+
+    //Horizontal into the blur target, vertical back. Depth goes on the unit the lighting
+    //shaders read it from, the others may hold textures of the passes still to come.
+    glActiveTexture(GL_TEXTURE0 + AmbientOcclusionDepthTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, ao.depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+    if (quality.blur)
+    {
+        glUseProgram(ao.blurProgram);
+        glUniform2i(ao.blurSizeLocation, size.x, size.y);
+
+        glUniform2i(ao.directionLocation, 1, 0);
+        glBindTexture(GL_TEXTURE_2D, ao.occlusionTexture);
+        DrawAmbientOcclusionPass(ao.blurFramebuffer);
+
+        glUniform2i(ao.directionLocation, 0, 1);
+        glBindTexture(GL_TEXTURE_2D, ao.blurTexture);
+        DrawAmbientOcclusionPass(ao.occlusionFramebuffer);
+    }
+
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+
+    EndGpuTimer(ao.timer);
+
+    glActiveTexture(GL_TEXTURE0 + AmbientOcclusionTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, ao.occlusionTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//Keeps the passes within their share of the frame: a step cheaper when over it, a step
+//better when the doubled cost of the next step up would still fit. Call with each new GPU
+//frame time measurement.
+void UpdateAmbientOcclusionBudget(AmbientOcclusion& ao, float frameMilliseconds)
+{
+    ao.framesSinceSwitch++;
+    ao.framesSinceReport++;
+    if (frameMilliseconds <= 0.0f || ao.timer.milliseconds <= 0.0f)
+        return;
+
+    float fraction = ao.timer.milliseconds / frameMilliseconds;
+    if (ao.framesSinceReport >= AmbientOcclusionReportFrames)
+    {
+        ao.framesSinceReport = 0;
+        std::cout << "Ambient occlusion " << ao.timer.milliseconds << " ms, " << fraction * 100.0f << "% of the frame, "
+            << AmbientOcclusionQualities[ao.quality].sampleCount << " samples" << std::endl;
+    }
+
+    if (ao.framesSinceSwitch < AmbientOcclusionSwitchFrames)
+        return;
+
+    int quality = ao.quality;
+    if (fraction > ao.settings.budget && quality + 1 < AmbientOcclusionQualityCount)
+        quality++;
+    else if (fraction * 2.0f < ao.settings.budget * 0.75f && quality > 0)
+        quality--;
+
+    if (quality == ao.quality)
+        return;
+
+    ao.quality = quality;
+    ao.framesSinceSwitch = 0;
+    std::cout << "Ambient occlusion at " << fraction * 100.0f << "% of the frame, now " << AmbientOcclusionQualities[quality].sampleCount
+        << " samples" << (AmbientOcclusionQualities[quality].blur ? "" : " without blur") << std::endl;
+}
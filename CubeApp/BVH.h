@@ -0,0 +1,871 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "Culling.h"
+#include "JobSystem.h"
+
+const int32_t BvhNull = -1;
+const int32_t BvhEmptySlot = INT32_MIN;
+
+const int BvhBinCount = 16;
+const size_t BvhMedianSplitThreshold = 8;
+
+//Ranges larger than this build their subtrees as separate jobs
+const size_t BvhParallelBuildThreshold = 4096;
+
+struct BvhBox
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+//Binary tree used for building, insertion, refitting and rotations
+struct BvhNode
+{
+    BvhBox box;
+    int32_t parent;
+    int32_t children[2];
+    //BvhNull for internal nodes
+    int32_t object;
+};
+
+//Four child boxes per node, stored per component for SIMD tests.
+//Children >= 0 are wide nodes, BvhEmptySlot is unused and anything else is ~object.
+struct BvhWideNode
+{
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    int32_t children[4];
+};
+
+struct Bvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<int32_t> freeNodes;
+    int32_t root = BvhNull;
+
+    //Leaf node per object, BvhNull when the object is not in the tree
+    std::vector<int32_t> objectLeaves;
+
+    //Leaf boxes are enlarged by this fraction of their extent so small motion needs no refit
+    float margin = 0.1f;
+
+    //Query layout, collapsed from the binary tree when its topology changes
+    std::vector<BvhWideNode> wideNodes;
+    //Wide slot (node * 4 + slot) holding each binary node, BvhNull if collapsed away
+    std::vector<int32_t> wideSlots;
+    bool wideDirty = true;
+
+    //Traversal stacks, kept between queries
+    std::vector<int32_t> queryStack;
+    std::vector<std::pair<int32_t, float>> rayStack;
+
+    //Statistics
+    uint32_t rotationCount = 0;
+};
+
+//Written per component, glm::min/max go through a function pointer that does not always inline
+BvhBox UnionBox(const BvhBox& a, const BvhBox& b)
+{
+    BvhBox box;
+    box.min.x = a.min.x < b.min.x ? a.min.x : b.min.x;
+    box.min.y = a.min.y < b.min.y ? a.min.y : b.min.y;
+    box.min.z = a.min.z < b.min.z ? a.min.z : b.min.z;
+    box.max.x = a.max.x > b.max.x ? a.max.x : b.max.x;
+    box.max.y = a.max.y > b.max.y ? a.max.y : b.max.y;
+    box.max.z = a.max.z > b.max.z ? a.max.z : b.max.z;
+    return box;
+}
+
+float SurfaceArea(const BvhBox& box)
+{
+    glm::vec3 size = box.max - box.min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+bool ContainsBox(const BvhBox& outer, const BvhBox& inner)
+{
+    return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::greaterThanEqual(outer.max, inner.max));
+}
+
+bool OverlapsBox(const BvhBox& a, const BvhBox& b)
+{
+    return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::greaterThanEqual(a.max, b.min));
+}
+
+BvhBox MakeFatBox(const Bvh& bvh, glm::vec3 center, glm::vec3 extent)
+{
+    glm::vec3 fatExtent = extent * (1.0f + bvh.margin);
+    return { center - fatExtent, center + fatExtent };
+}
+
+bool IsBvhLeaf(const Bvh& bvh, int32_t index)
+{
+    return bvh.nodes[index].object != BvhNull;
+}
+
+int32_t AllocateBvhNode(Bvh& bvh)
+{
+    int32_t index;
+    if (!bvh.freeNodes.empty())
+    {
+        index = bvh.freeNodes.back();
+        bvh.freeNodes.pop_back();
+    }
+    else
+    {
+        index = static_cast<int32_t>(bvh.nodes.size());
+        bvh.nodes.push_back({});
+    }
+
+    BvhNode& node = bvh.nodes[index];
+    node.parent = BvhNull;
+    node.children[0] = BvhNull;
+    node.children[1] = BvhNull;
+    node.object = BvhNull;
+    return index;
+}
+
+void FreeBvhNode(Bvh& bvh, int32_t index)
+{
+    bvh.nodes[index].object = BvhNull;
+    bvh.nodes[index].parent = BvhNull;
+    bvh.freeNodes.push_back(index);
+}
+
+//Build
+
+//Boxes travel with the objects while partitioning, so every pass reads memory in order
+struct BvhReference
+{
+    BvhBox box;
+    glm::vec3 centroid;
+    uint32_t object;
+};
+
+struct BvhBuildContext
+{
+    Bvh* bvh;
+    JobSystem* jobSystem;
+    std::vector<BvhReference> references;
+    std::atomic<int32_t> nextNode{ 0 };
+};
+
+struct BvhBin
+{
+    BvhBox box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    uint32_t count = 0;
+};
+
+int BvhBinIndex(float centroid, float minimum, float scale)
+{
+    int bin = static_cast<int>((centroid - minimum) * scale);
+    return bin < BvhBinCount - 1 ? bin : BvhBinCount - 1;
+}
+
+//Binned SAH split, returns the first object of the right half
+size_t SplitBvhRange(BvhBuildContext& context, size_t begin, size_t end)
+{
+    if (end - begin == 2)
+        return begin + 1;
+
+    BvhBox centroidBounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::vec3 centroid = context.references[i].centroid;
+        centroidBounds = UnionBox(centroidBounds, { centroid, centroid });
+    }
+    glm::vec3 centroidMin = centroidBounds.min;
+    glm::vec3 centroidExtent = centroidBounds.max - centroidBounds.min;
+
+    //Binning costs more than it saves near the leaves, split those at the median of the longest axis
+    if (end - begin <= BvhMedianSplitThreshold)
+    {
+        int axis = centroidExtent.x > centroidExtent.y ? (centroidExtent.x > centroidExtent.z ? 0 : 2) : (centroidExtent.y > centroidExtent.z ? 1 : 2);
+        size_t middle = (begin + end) / 2;
+        std::nth_element(context.references.begin() + begin, context.references.begin() + middle, context.references.begin() + end,
+            [axis](const BvhReference& a, const BvhReference& b) { return a.centroid[axis] < b.centroid[axis]; });
+        return middle;
+    }
+
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; axis++)
+        scale[axis] = centroidExtent[axis] > 0.0f ? BvhBinCount / centroidExtent[axis] : 0.0f;
+
+    //All three axes are binned in the same pass over the references
+    BvhBin bins[3][BvhBinCount];
+    for (size_t i = begin; i < end; i++)
+    {
+        const BvhReference& reference = context.references[i];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            BvhBin& bin = bins[axis][BvhBinIndex(reference.centroid[axis], centroidMin[axis], scale[axis])];
+            bin.box = UnionBox(bin.box, reference.box);
+            bin.count++;
+        }
+    }
+
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestBin = 0;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (centroidExtent[axis] <= 0.0f)
+            continue;
+
+        //Sweep from the right to get the cost of every right half, then from the left
+        float rightCost[BvhBinCount];
+        BvhBox rightBox = bins[axis][BvhBinCount - 1].box;
+        uint32_t rightCount = 0;
+        for (int bin = BvhBinCount - 1; bin > 0; bin--)
+        {
+            rightBox = UnionBox(rightBox, bins[axis][bin].box);
+            rightCount += bins[axis][bin].count;
+            rightCost[bin] = rightCount > 0 ? rightCount * SurfaceArea(rightBox) : 0.0f;
+        }
+
+        BvhBox leftBox = bins[axis][0].box;
+        uint32_t leftCount = 0;
+        for (int bin = 0; bin < BvhBinCount - 1; bin++)
+        {
+            leftBox = UnionBox(leftBox, bins[axis][bin].box);
+            leftCount += bins[axis][bin].count;
+            if (leftCount == 0 || leftCount == end - begin)
+                continue;
+
+            float cost = leftCount * SurfaceArea(leftBox) + rightCost[bin + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
+            }
+        }
+    }
+
+    //Coincident centroids, split the range in half
+    if (bestAxis < 0)
+        return (begin + end) / 2;
+
+    auto middle = std::partition(context.references.begin() + begin, context.references.begin() + end, [&](const BvhReference& reference)
+    {
+        return BvhBinIndex(reference.centroid[bestAxis], centroidMin[bestAxis], scale[bestAxis]) <= bestBin;
+    });
+
+    return middle - context.references.begin();
+}
+
+void BuildBvhRange(BvhBuildContext& context, int32_t index, int32_t parent, size_t begin, size_t end)
+{
+    BvhNode& node = context.bvh->nodes[index];
+    node.parent = parent;
+
+    if (end - begin == 1)
+    {
+        uint32_t object = context.references[begin].object;
+        node.box = context.references[begin].box;
+        node.children[0] = BvhNull;
+        node.children[1] = BvhNull;
+        node.object = static_cast<int32_t>(object);
+        context.bvh->objectLeaves[object] = index;
+        return;
+    }
+
+    size_t middle = SplitBvhRange(context, begin, end);
+
+    int32_t left = context.nextNode.fetch_add(2);
+    int32_t right = left + 1;
+    node.children[0] = left;
+    node.children[1] = right;
+    node.object = BvhNull;
+
+    if (context.jobSystem != nullptr && end - begin > BvhParallelBuildThreshold)
+    {
+        JobCounter counter;
+        PushJob(*context.jobSystem, [&context, left, index, begin, middle]() { BuildBvhRange(context, left, index, begin, middle); }, &counter);
+        BuildBvhRange(context, right, index, middle, end);
+        WaitForJobs(*context.jobSystem, counter);
+    }
+    else
+    {
+        BuildBvhRange(context, left, index, begin, middle);
+        BuildBvhRange(context, right, index, middle, end);
+    }
+
+    BvhNode& built = context.bvh->nodes[index];
+    built.box = UnionBox(context.bvh->nodes[left].box, context.bvh->nodes[right].box);
+}
+
+//Rebuilds the whole tree from the given boxes, subtrees are built in parallel when a job system is given
+void BuildBvh(Bvh& bvh, const BoundsSoA& bounds, JobSystem* jobSystem)
+{
+    size_t count = bounds.count;
+
+    bvh.nodes.clear();
+    bvh.freeNodes.clear();
+    bvh.objectLeaves.assign(count, BvhNull);
+    bvh.root = BvhNull;
+    bvh.wideDirty = true;
+
+    if (count == 0)
+        return;
+
+    BvhBuildContext context;
+    context.bvh = &bvh;
+    context.jobSystem = jobSystem;
+    context.references.resize(count);
+
+    ParallelFor(jobSystem, count, 16384, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+            glm::vec3 extent(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+            context.references[i] = { MakeFatBox(bvh, center, extent), center, static_cast<uint32_t>(i) };
+        }
+    });
+
+    bvh.nodes.resize(2 * count - 1);
+    context.nextNode = 1;
+    bvh.root = 0;
+    BuildBvhRange(context, 0, BvhNull, 0, count);
+}
+
+//Incremental updates
+
+void UpdateWideSlot(Bvh& bvh, int32_t index)
+{
+    if (bvh.wideDirty || index >= static_cast<int32_t>(bvh.wideSlots.size()) || bvh.wideSlots[index] == BvhNull)
+        return;
+
+    BvhWideNode& wide = bvh.wideNodes[bvh.wideSlots[index] / 4];
+    int slot = bvh.wideSlots[index] % 4;
+    const BvhBox& box = bvh.nodes[index].box;
+    wide.minX[slot] = box.min.x;
+    wide.minY[slot] = box.min.y;
+    wide.minZ[slot] = box.min.z;
+    wide.maxX[slot] = box.max.x;
+    wide.maxY[slot] = box.max.y;
+    wide.maxZ[slot] = box.max.z;
+}
+
+//Swaps a child of the node with a grandchild when that shrinks the tree (Kopta et al. 2012)
+void RotateBvhNode(Bvh& bvh, int32_t index)
+{
+    BvhNode& node = bvh.nodes[index];
+    if (node.object != BvhNull)
+        return;
+
+    float bestGain = 0.0f;
+    int bestChild = -1;
+    int bestGrandchild = -1;
+
+    for (int child = 0; child < 2; child++)
+    {
+        int32_t sibling = node.children[1 - child];
+        if (IsBvhLeaf(bvh, sibling))
+            continue;
+
+        const BvhNode& siblingNode = bvh.nodes[sibling];
+        float siblingArea = SurfaceArea(siblingNode.box);
+        for (int grandchild = 0; grandchild < 2; grandchild++)
+        {
+            //The grandchild moves up, the child takes its place next to the other grandchild
+            BvhBox rotated = UnionBox(bvh.nodes[node.children[child]].box, bvh.nodes[siblingNode.children[1 - grandchild]].box);
+            float gain = siblingArea - SurfaceArea(rotated);
+            if (gain > bestGain)
+            {
+                bestGain = gain;
+                bestChild = child;
+                bestGrandchild = grandchild;
+            }
+        }
+    }
+
+    //Ignore marginal gains so moving objects do not make the tree flip back and forth
+    if (bestChild < 0 || bestGain < 0.01f * SurfaceArea(node.box))
+        return;
+
+    int32_t child = node.children[bestChild];
+    int32_t sibling = node.children[1 - bestChild];
+    BvhNode& siblingNode = bvh.nodes[sibling];
+    int32_t grandchild = siblingNode.children[bestGrandchild];
+
+    node.children[bestChild] = grandchild;
+    bvh.nodes[grandchild].parent = index;
+    siblingNode.children[bestGrandchild] = child;
+    bvh.nodes[child].parent = sibling;
+    siblingNode.box = UnionBox(bvh.nodes[siblingNode.children[0]].box, bvh.nodes[siblingNode.children[1]].box);
+
+    bvh.wideDirty = true;
+    bvh.rotationCount++;
+}
+
+void RefitBvhUpwards(Bvh& bvh, int32_t index)
+{
+    while (index != BvhNull)
+    {
+        BvhNode& node = bvh.nodes[index];
+        node.box = UnionBox(bvh.nodes[node.children[0]].box, bvh.nodes[node.children[1]].box);
+        RotateBvhNode(bvh, index);
+
+        UpdateWideSlot(bvh, node.children[0]);
+        UpdateWideSlot(bvh, node.children[1]);
+        UpdateWideSlot(bvh, index);
+
+        index = bvh.nodes[index].parent;
+    }
+}
+
+void InsertBvhLeaf(Bvh& bvh, int32_t leaf)
+{
+    bvh.wideDirty = true;
+
+    if (bvh.root == BvhNull)
+    {
+        bvh.root = leaf;
+        bvh.nodes[leaf].parent = BvhNull;
+        return;
+    }
+
+    //Walk down towards the cheapest sibling, counting the growth of every ancestor
+    BvhBox leafBox = bvh.nodes[leaf].box;
+    int32_t index = bvh.root;
+    while (!IsBvhLeaf(bvh, index))
+    {
+        const BvhNode& node = bvh.nodes[index];
+        float area = SurfaceArea(node.box);
+        float combinedArea = SurfaceArea(UnionBox(node.box, leafBox));
+
+        float cost = 2.0f * combinedArea;
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        float childCosts[2];
+        for (int i = 0; i < 2; i++)
+        {
+            const BvhNode& child = bvh.nodes[node.children[i]];
+            float childCombined = SurfaceArea(UnionBox(child.box, leafBox));
+            childCosts[i] = childCombined + inheritanceCost;
+            if (child.object == BvhNull)
+                childCosts[i] -= SurfaceArea(child.box);
+        }
+
+        if (cost < childCosts[0] && cost < childCosts[1])
+            break;
+
+        index = childCosts[0] < childCosts[1] ? node.children[0] : node.children[1];
+    }
+
+    int32_t sibling = index;
+    int32_t oldParent = bvh.nodes[sibling].parent;
+    int32_t newParent = AllocateBvhNode(bvh);
+
+    BvhNode& parentNode = bvh.nodes[newParent];
+    parentNode.parent = oldParent;
+    parentNode.children[0] = sibling;
+    parentNode.children[1] = leaf;
+    parentNode.box = UnionBox(leafBox, bvh.nodes[sibling].box);
+    bvh.nodes[sibling].parent = newParent;
+    bvh.nodes[leaf].parent = newParent;
+
+    if (oldParent == BvhNull)
+    {
+        bvh.root = newParent;
+    }
+    else
+    {
+        BvhNode& old = bvh.nodes[oldParent];
+        old.children[old.children[0] == sibling ? 0 : 1] = newParent;
+        RefitBvhUpwards(bvh, oldParent);
+    }
+}
+
+void RemoveBvhLeaf(Bvh& bvh, int32_t leaf)
+{
+    bvh.wideDirty = true;
+
+    if (leaf == bvh.root)
+    {
+        bvh.root = BvhNull;
+        return;
+    }
+
+    int32_t parent = bvh.nodes[leaf].parent;
+    int32_t grandparent = bvh.nodes[parent].parent;
+    int32_t sibling = bvh.nodes[parent].children[0] == leaf ? bvh.nodes[parent].children[1] : bvh.nodes[parent].children[0];
+
+    bvh.nodes[sibling].parent = grandparent;
+    FreeBvhNode(bvh, parent);
+
+    if (grandparent == BvhNull)
+    {
+        bvh.root = sibling;
+    }
+    else
+    {
+        BvhNode& node = bvh.nodes[grandparent];
+        node.children[node.children[0] == parent ? 0 : 1] = sibling;
+        RefitBvhUpwards(bvh, grandparent);
+    }
+}
+
+void InsertBvhObject(Bvh& bvh, uint32_t object, glm::vec3 center, glm::vec3 extent)
+{
+    if (object >= bvh.objectLeaves.size())
+        bvh.objectLeaves.resize(object + 1, BvhNull);
+
+    int32_t leaf = AllocateBvhNode(bvh);
+    bvh.nodes[leaf].object = static_cast<int32_t>(object);
+    bvh.nodes[leaf].box = MakeFatBox(bvh, center, extent);
+    bvh.objectLeaves[object] = leaf;
+
+    InsertBvhLeaf(bvh, leaf);
+}
+
+void RemoveBvhObject(Bvh& bvh, uint32_t object)
+{
+    int32_t leaf = bvh.objectLeaves[object];
+    if (leaf == BvhNull)
+        return;
+
+    RemoveBvhLeaf(bvh, leaf);
+    FreeBvhNode(bvh, leaf);
+    bvh.objectLeaves[object] = BvhNull;
+}
+
+//Returns false when the object is still inside its enlarged box and nothing had to change,
+//or is not in the tree
+bool UpdateBvhObject(Bvh& bvh, uint32_t object, glm::vec3 center, glm::vec3 extent)
+{
+    int32_t leaf = bvh.objectLeaves[object];
+    if (leaf == BvhNull)
+        return false;
+    BvhBox tight = { center - extent, center + extent };
+    if (ContainsBox(bvh.nodes[leaf].box, tight))
+        return false;
+
+    BvhBox fat = MakeFatBox(bvh, center, extent);
+
+    //Objects that jumped away are reinserted, small moves are refitted and rotated in place
+    if (!OverlapsBox(bvh.nodes[leaf].box, fat))
+    {
+        RemoveBvhLeaf(bvh, leaf);
+        bvh.nodes[leaf].box = fat;
+        InsertBvhLeaf(bvh, leaf);
+        return true;
+    }
+
+    bvh.nodes[leaf].box = fat;
+    UpdateWideSlot(bvh, leaf);
+    RefitBvhUpwards(bvh, bvh.nodes[leaf].parent);
+    return true;
+}
+
+//Wide layout
+
+void WriteWideSlot(BvhWideNode& wide, int slot, const BvhBox& box)
+{
+    wide.minX[slot] = box.min.x;
+    wide.minY[slot] = box.min.y;
+    wide.minZ[slot] = box.min.z;
+    wide.maxX[slot] = box.max.x;
+    wide.maxY[slot] = box.max.y;
+    wide.maxZ[slot] = box.max.z;
+}
+
+//Pulls the largest grandchildren up until every wide node has four children
+void CollapseBvh(Bvh& bvh)
+{
+    bvh.wideNodes.clear();
+    bvh.wideSlots.assign(bvh.nodes.size(), BvhNull);
+    bvh.wideDirty = false;
+
+    if (bvh.root == BvhNull)
+        return;
+
+    std::vector<std::pair<int32_t, int32_t>> stack;
+    bvh.wideNodes.push_back({});
+    stack.push_back({ bvh.root, 0 });
+
+    while (!stack.empty())
+    {
+        int32_t binary = stack.back().first;
+        int32_t wideIndex = stack.back().second;
+        stack.pop_back();
+
+        int32_t candidates[4];
+        int candidateCount = 0;
+        if (IsBvhLeaf(bvh, binary))
+        {
+            candidates[candidateCount++] = binary;
+        }
+        else
+        {
+            candidates[candidateCount++] = bvh.nodes[binary].children[0];
+            candidates[candidateCount++] = bvh.nodes[binary].children[1];
+        }
+
+        while (candidateCount < 4)
+        {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (int i = 0; i < candidateCount; i++)
+            {
+                if (IsBvhLeaf(bvh, candidates[i]))
+                    continue;
+                float area = SurfaceArea(bvh.nodes[candidates[i]].box);
+                if (area > largestArea)
+                {
+                    largestArea = area;
+                    largest = i;
+                }
+            }
+
+            if (largest < 0)
+                break;
+
+            int32_t expanded = candidates[largest];
+            candidates[largest] = bvh.nodes[expanded].children[0];
+            candidates[candidateCount++] = bvh.nodes[expanded].children[1];
+        }
+
+        for (int slot = 0; slot < 4; slot++)
+        {
+            if (slot >= candidateCount)
+            {
+                WriteWideSlot(bvh.wideNodes[wideIndex], slot, { glm::vec3(0.0f), glm::vec3(0.0f) });
+                bvh.wideNodes[wideIndex].children[slot] = BvhEmptySlot;
+                continue;
+            }
+
+            int32_t candidate = candidates[slot];
+            WriteWideSlot(bvh.wideNodes[wideIndex], slot, bvh.nodes[candidate].box);
+            bvh.wideSlots[candidate] = wideIndex * 4 + slot;
+
+            if (IsBvhLeaf(bvh, candidate))
+            {
+                bvh.wideNodes[wideIndex].children[slot] = ~bvh.nodes[candidate].object;
+            }
+            else
+            {
+                int32_t child = static_cast<int32_t>(bvh.wideNodes.size());
+                bvh.wideNodes.push_back({});
+                bvh.wideNodes[wideIndex].children[slot] = child;
+                stack.push_back({ candidate, child });
+            }
+        }
+    }
+}
+
+//Queries, each node tests its four children at once
+
+int TestWideNodeFrustum(const BvhWideNode& node, const Frustum& frustum)
+{
+#if defined(CUBEAPP_SSE)
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 minX = _mm_loadu_ps(node.minX), maxX = _mm_loadu_ps(node.maxX);
+    __m128 minY = _mm_loadu_ps(node.minY), maxY = _mm_loadu_ps(node.maxY);
+    __m128 minZ = _mm_loadu_ps(node.minZ), maxZ = _mm_loadu_ps(node.maxZ);
+    __m128 centerX = _mm_mul_ps(_mm_add_ps(minX, maxX), half), extentX = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+    __m128 centerY = _mm_mul_ps(_mm_add_ps(minY, maxY), half), extentY = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+    __m128 centerZ = _mm_mul_ps(_mm_add_ps(minZ, maxZ), half), extentZ = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (const glm::vec4& plane : frustum.planes)
+    {
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane.x)), _mm_mul_ps(centerY, _mm_set1_ps(plane.y))),
+                                     _mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(std::fabs(plane.x))), _mm_mul_ps(extentY, _mm_set1_ps(std::fabs(plane.y)))),
+                                   _mm_mul_ps(extentZ, _mm_set1_ps(std::fabs(plane.z))));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+    }
+    return _mm_movemask_ps(inside);
+#else
+    int mask = 0;
+    for (int slot = 0; slot < 4; slot++)
+    {
+        glm::vec3 boxMin(node.minX[slot], node.minY[slot], node.minZ[slot]);
+        glm::vec3 boxMax(node.maxX[slot], node.maxY[slot], node.maxZ[slot]);
+        if (IsBoxVisible(frustum, (boxMin + boxMax) * 0.5f, (boxMax - boxMin) * 0.5f))
+            mask |= 1 << slot;
+    }
+    return mask;
+#endif
+}
+
+//Sets bit i when the ray enters child i before maxDistance, entry distances are written to outDistances
+int TestWideNodeRay(const BvhWideNode& node, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance, float outDistances[4])
+{
+#if defined(CUBEAPP_SSE)
+    __m128 originX = _mm_set1_ps(origin.x), inverseX = _mm_set1_ps(inverseDirection.x);
+    __m128 originY = _mm_set1_ps(origin.y), inverseY = _mm_set1_ps(inverseDirection.y);
+    __m128 originZ = _mm_set1_ps(origin.z), inverseZ = _mm_set1_ps(inverseDirection.z);
+
+    __m128 nearX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), originX), inverseX);
+    __m128 farX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), originX), inverseX);
+    __m128 nearY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), originY), inverseY);
+    __m128 farY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), originY), inverseY);
+    __m128 nearZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), originZ), inverseZ);
+    __m128 farZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), originZ), inverseZ);
+
+    __m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(nearX, farX), _mm_min_ps(nearY, farY)), _mm_max_ps(_mm_min_ps(nearZ, farZ), _mm_setzero_ps()));
+    __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(nearX, farX), _mm_max_ps(nearY, farY)), _mm_min_ps(_mm_max_ps(nearZ, farZ), _mm_set1_ps(maxDistance)));
+
+    _mm_storeu_ps(outDistances, entry);
+    return _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+#else
+    int mask = 0;
+    for (int slot = 0; slot < 4; slot++)
+    {
+        glm::vec3 near = (glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]) - origin) * inverseDirection;
+        glm::vec3 far = (glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]) - origin) * inverseDirection;
+        glm::vec3 lower = glm::min(near, far);
+        glm::vec3 upper = glm::max(near, far);
+        float entry = std::max(std::max(lower.x, lower.y), std::max(lower.z, 0.0f));
+        float exit = std::min(std::min(upper.x, upper.y), std::min(upper.z, maxDistance));
+        outDistances[slot] = entry;
+        if (entry <= exit)
+            mask |= 1 << slot;
+    }
+    return mask;
+#endif
+}
+
+int TestWideNodeBox(const BvhWideNode& node, const BvhBox& box)
+{
+#if defined(CUBEAPP_SSE)
+    __m128 overlap = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minX), _mm_set1_ps(box.max.x)), _mm_cmpge_ps(_mm_loadu_ps(node.maxX), _mm_set1_ps(box.min.x)));
+    overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minY), _mm_set1_ps(box.max.y)), _mm_cmpge_ps(_mm_loadu_ps(node.maxY), _mm_set1_ps(box.min.y))));
+    overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minZ), _mm_set1_ps(box.max.z)), _mm_cmpge_ps(_mm_loadu_ps(node.maxZ), _mm_set1_ps(box.min.z))));
+    return _mm_movemask_ps(overlap);
+#else
+    int mask = 0;
+    for (int slot = 0; slot < 4; slot++)
+    {
+        BvhBox child = { glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]), glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]) };
+        if (OverlapsBox(child, box))
+            mask |= 1 << slot;
+    }
+    return mask;
+#endif
+}
+
+//Calls visit(child) for every used slot in the mask
+template<typename Visit>
+void ForEachWideChild(const BvhWideNode& node, int mask, Visit&& visit)
+{
+    for (int slot = 0; slot < 4; slot++)
+    {
+        if ((mask & (1 << slot)) != 0 && node.children[slot] != BvhEmptySlot)
+            visit(slot, node.children[slot]);
+    }
+}
+
+void QueryBvhFrustum(Bvh& bvh, const Frustum& frustum, std::vector<uint32_t>& outObjects)
+{
+    outObjects.clear();
+    if (bvh.root == BvhNull)
+        return;
+    if (bvh.wideDirty)
+        CollapseBvh(bvh);
+
+    std::vector<int32_t>& stack = bvh.queryStack;
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty())
+    {
+        const BvhWideNode& node = bvh.wideNodes[stack.back()];
+        stack.pop_back();
+        ForEachWideChild(node, TestWideNodeFrustum(node, frustum), [&](int, int32_t child)
+        {
+            if (child >= 0)
+                stack.push_back(child);
+            else
+                outObjects.push_back(static_cast<uint32_t>(~child));
+        });
+    }
+}
+
+void QueryBvhBox(Bvh& bvh, glm::vec3 boxMin, glm::vec3 boxMax, std::vector<uint32_t>& outObjects)
+{
+    outObjects.clear();
+    if (bvh.root == BvhNull)
+        return;
+    if (bvh.wideDirty)
+        CollapseBvh(bvh);
+
+    BvhBox box = { boxMin, boxMax };
+    std::vector<int32_t>& stack = bvh.queryStack;
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty())
+    {
+        const BvhWideNode& node = bvh.wideNodes[stack.back()];
+        stack.pop_back();
+        ForEachWideChild(node, TestWideNodeBox(node, box), [&](int, int32_t child)
+        {
+            if (child >= 0)
+                stack.push_back(child);
+            else
+                outObjects.push_back(static_cast<uint32_t>(~child));
+        });
+    }
+}
+
+//onHit(object, entryDistance) tests the object exactly and returns the new maximum distance,
+//so a closest hit query shrinks the ray as it goes
+template<typename OnHit>
+void QueryBvhRay(Bvh& bvh, glm::vec3 origin, glm::vec3 direction, float maxDistance, OnHit&& onHit)
+{
+    if (bvh.root == BvhNull)
+        return;
+    if (bvh.wideDirty)
+        CollapseBvh(bvh);
+
+    glm::vec3 inverseDirection;
+    for (int axis = 0; axis < 3; axis++)
+        inverseDirection[axis] = 1.0f / (std::fabs(direction[axis]) > 1e-20f ? direction[axis] : 1e-20f);
+
+    std::vector<std::pair<int32_t, float>>& stack = bvh.rayStack;
+    stack.clear();
+    stack.push_back({ 0, 0.0f });
+
+    while (!stack.empty())
+    {
+        std::pair<int32_t, float> entry = stack.back();
+        stack.pop_back();
+        if (entry.second > maxDistance)
+            continue;
+
+        const BvhWideNode& node = bvh.wideNodes[entry.first];
+        float distances[4];
+        int mask = TestWideNodeRay(node, origin, inverseDirection, maxDistance, distances);
+
+        //Push far children first so the nearest is visited next
+        int order[4] = { 0, 1, 2, 3 };
+        std::sort(order, order + 4, [&](int a, int b) { return distances[a] > distances[b]; });
+
+        for (int slot : order)
+        {
+            int32_t child = node.children[slot];
+            if ((mask & (1 << slot)) == 0 || child == BvhEmptySlot)
+                continue;
+
+            if (child >= 0)
+                stack.push_back({ child, distances[slot] });
+            else
+                maxDistance = std::min(maxDistance, onHit(static_cast<uint32_t>(~child), distances[slot]));
+        }
+    }
+}
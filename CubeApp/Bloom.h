@@ -0,0 +1,190 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "SceneTarget.h"
+
+const int BloomDefaultLevels = 5;
+const int BloomMaxLevels = 8;
+
+//Luminance where bloom starts, and the width of the soft knee below it
+const float BloomThreshold = 1.0f;
+const float BloomKnee = 0.5f;
+//Weight of the bloom added to the scene, spread over the levels so the chain length does
+//not change how bright it is
+const float BloomIntensity = 0.5f;
+
+struct BloomSettings
+{
+    int levels = BloomDefaultLevels;
+};
+
+//Chain of targets at half, quarter... of the scene. The bright part of the scene is filtered
+//down the chain, then back up with each level added onto the next larger one. Every level
+//has a quarter of the pixels of the one above, so the chain costs about a third more than
+//its first level however many levels, and so however wide, the bloom is.
+struct Bloom
+{
+    BloomSettings settings;
+
+    std::vector<GLuint> textures;
+    std::vector<GLuint> framebuffers;
+    std::vector<glm::ivec2> sizes;
+
+    GLuint downsampleProgram = 0;
+    GLint downsampleTexelSizeLocation = -1;
+    GLint downsampleSourceScaleLocation = -1;
+    GLint thresholdLocation = -1;
+
+    GLuint upsampleProgram = 0;
+    GLint upsampleTexelSizeLocation = -1;
+    GLint upsampleSourceScaleLocation = -1;
+
+    GLuint emptyVertexArray = 0;
+
+    //Part of the first level written this frame
+    glm::ivec2 region = glm::ivec2(0);
+};
+
+//--bloom-levels <0 to 8>, 0 turns bloom off
+bool ParseBloomArguments(int argc, char** argv, BloomSettings& settings)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--bloom-levels") != 0)
+            continue;
+
+        const char* value = argv[++i];
+        settings.levels = atoi(value);
+        if (settings.levels < 0 || settings.levels > BloomMaxLevels || (settings.levels == 0 && strcmp(value, "0") != 0))
+        {
+            std::cout << "Invalid value for --bloom-levels, expected 0 to " << BloomMaxLevels << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//width and height of the scene target
+void CreateBloom(Bloom& bloom, int width, int height, const char* vertexShaderFileName, const char* downsampleFragmentShaderFileName, const char* upsampleFragmentShaderFileName)
+{
+    for (int level = 0; level < bloom.settings.levels; level++)
+    {
+        glm::ivec2 size = glm::max(glm::ivec2(1), (glm::ivec2(width, height) + (1 << (level + 1)) - 1) >> (level + 1));
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, size.x, size.y, 0, GL_RGB, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Bloom framebuffer " << level << " is incomplete" << std::endl;
+
+        bloom.textures.push_back(texture);
+        bloom.framebuffers.push_back(framebuffer);
+        bloom.sizes.push_back(size);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    bloom.downsampleProgram = CompileShaders(vertexShaderFileName, downsampleFragmentShaderFileName);
+    glUseProgram(bloom.downsampleProgram);
+    glUniform1i(glGetUniformLocation(bloom.downsampleProgram, "source"), 0);
+    bloom.downsampleTexelSizeLocation = glGetUniformLocation(bloom.downsampleProgram, "texelSize");
+    bloom.downsampleSourceScaleLocation = glGetUniformLocation(bloom.downsampleProgram, "sourceScale");
+    bloom.thresholdLocation = glGetUniformLocation(bloom.downsampleProgram, "threshold");
+
+    bloom.upsampleProgram = CompileShaders(vertexShaderFileName, upsampleFragmentShaderFileName);
+    glUseProgram(bloom.upsampleProgram);
+    glUniform1i(glGetUniformLocation(bloom.upsampleProgram, "source"), 0);
+    bloom.upsampleTexelSizeLocation = glGetUniformLocation(bloom.upsampleProgram, "texelSize");
+    bloom.upsampleSourceScaleLocation = glGetUniformLocation(bloom.upsampleProgram, "sourceScale");
+
+    glGenVertexArrays(1, &bloom.emptyVertexArray);
+}
+
+//Points the program's texelSize and sourceScale at the used part of a source texture
+void SetBloomSource(GLint texelSizeLocation, GLint sourceScaleLocation, GLuint texture, glm::ivec2 textureSize, glm::ivec2 region)
+{
+    glUniform2f(texelSizeLocation, 1.0f / textureSize.x, 1.0f / textureSize.y);
+    glUniform2f(sourceScaleLocation, static_cast<float>(region.x) / textureSize.x, static_cast<float>(region.y) / textureSize.y);
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+//Filters the viewport of the scene target into the first level, which then holds the bloom
+void RenderBloom(Bloom& bloom, const SceneTarget& target, glm::ivec4 sceneViewport)
+{
+    int levels = static_cast<int>(bloom.textures.size());
+    if (levels == 0)
+        return;
+
+    glm::ivec2 regions[BloomMaxLevels] = {};
+    for (int level = 0; level < levels; level++)
+    {
+        regions[level] = glm::max(glm::ivec2(1), (glm::ivec2(sceneViewport.z, sceneViewport.w) + (1 << (level + 1)) - 1) >> (level + 1));
+        regions[level] = glm::min(regions[level], bloom.sizes[level]);
+    }
+    bloom.region = regions[0];
+
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(bloom.emptyVertexArray);
+    glActiveTexture(GL_TEXTURE0);
+
+    //Down, the first step keeps only what is above the threshold
+    glUseProgram(bloom.downsampleProgram);
+    for (int level = 0; level < levels; level++)
+    {
+        if (level == 0)
+            SetBloomSource(bloom.downsampleTexelSizeLocation, bloom.downsampleSourceScaleLocation, target.colorTexture,
+                glm::ivec2(target.width, target.height), glm::ivec2(sceneViewport.z, sceneViewport.w));
+        else
+            SetBloomSource(bloom.downsampleTexelSizeLocation, bloom.downsampleSourceScaleLocation, bloom.textures[level - 1], bloom.sizes[level - 1], regions[level - 1]);
+        glUniform2f(bloom.thresholdLocation, level == 0 ? BloomThreshold : 0.0f, BloomKnee);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, bloom.framebuffers[level]);
+        glViewport(0, 0, regions[level].x, regions[level].y);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    //Up, each level added onto the one above
+    glUseProgram(bloom.upsampleProgram);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (int level = levels - 1; level > 0; level--)
+    {
+        SetBloomSource(bloom.upsampleTexelSizeLocation, bloom.upsampleSourceScaleLocation, bloom.textures[level], bloom.sizes[level], regions[level]);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, bloom.framebuffers[level - 1]);
+        glViewport(0, 0, regions[level - 1].x, regions[level - 1].y);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glDisable(GL_BLEND);
+
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//Weight the tone mapping pass adds the first level with, 0 without bloom
+float GetBloomStrength(const Bloom& bloom)
+{
+    return bloom.textures.empty() ? 0.0f : BloomIntensity / bloom.textures.size();
+}
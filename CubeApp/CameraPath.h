@@ -0,0 +1,111 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Camera position and the point it looks at, at a time in seconds
+struct CameraPathKey
+{
+    float time;
+    glm::vec3 position;
+    glm::vec3 target;
+};
+
+//Catmull-Rom spline through the keys. The keys do not have to be evenly spaced in time, the
+//tangents are divided by the time between the neighbours so the speed stays continuous.
+struct CameraPath
+{
+    std::vector<CameraPathKey> keys;
+};
+
+//One key per line: time px py pz tx ty tz, with increasing times. # starts a comment.
+bool LoadCameraPath(CameraPath& path, const char* fileName)
+{
+    std::ifstream file(fileName);
+    if (!file.is_open())
+    {
+        std::cout << "Could not open camera path " << fileName << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.resize(comment);
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        CameraPathKey key;
+        std::istringstream values(line);
+        values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.target.x >> key.target.y >> key.target.z;
+        if (values.fail() || glm::length(key.target - key.position) <= 0.0f || (!path.keys.empty() && key.time <= path.keys.back().time))
+        {
+            std::cout << "Invalid camera path key on line " << lineNumber << " of " << fileName << std::endl;
+            return false;
+        }
+        path.keys.push_back(key);
+    }
+
+    if (path.keys.size() < 2)
+    {
+        std::cout << "Camera path " << fileName << " needs at least two keys" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//Hermite between points[1] and points[2] with the Catmull-Rom tangents. At the ends of the
+//path the outer point repeats the inner one, which makes the tangent one sided.
+glm::vec3 InterpolateCameraPath(const glm::vec3 points[4], const float times[4], float time)
+{
+    float duration = times[2] - times[1];
+    float t = glm::clamp((time - times[1]) / duration, 0.0f, 1.0f);
+    glm::vec3 startTangent = (points[2] - points[0]) / (times[2] - times[0]) * duration;
+    glm::vec3 endTangent = (points[3] - points[1]) / (times[3] - times[1]) * duration;
+
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return (2.0f * t3 - 3.0f * t2 + 1.0f) * points[1] + (t3 - 2.0f * t2 + t) * startTangent
+        + (-2.0f * t3 + 3.0f * t2) * points[2] + (t3 - t2) * endTangent;
+}
+
+//Camera at time, clamped to the first and last key. False once time is past the last key.
+bool SampleCameraPath(const CameraPath& path, float time, glm::vec3& position, glm::vec3& forward)
+{
+    if (path.keys.size() < 2)
+        return false;
+
+    size_t segment = 0;
+    while (segment + 2 < path.keys.size() && time >= path.keys[segment + 1].time)
+        segment++;
+
+    //Keys around the segment
+    size_t indices[4] = { segment > 0 ? segment - 1 : segment, segment, segment + 1, std::min(segment + 2, path.keys.size() - 1) };
+    glm::vec3 positions[4];
+    glm::vec3 targets[4];
+    float times[4];
+    for (int i = 0; i < 4; i++)
+    {
+        positions[i] = path.keys[indices[i]].position;
+        targets[i] = path.keys[indices[i]].target;
+        times[i] = path.keys[indices[i]].time;
+    }
+
+    position = InterpolateCameraPath(positions, times, time);
+    glm::vec3 target = InterpolateCameraPath(targets, times, time);
+    glm::vec3 direction = target - position;
+    if (glm::length(direction) > 0.0f)
+        forward = glm::normalize(direction);
+
+    return time <= path.keys.back().time;
+}
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "JobSystem.h"
+#include "Scene.h"
+#include "VoxelWorld.h"
+
+struct ChunkStreamerSettings
+{
+    bool enabled = false;
+    //Columns within this many chunks of the camera are meshed, one more ring is loaded
+    int radius = 8;
+    size_t memoryBudget = 256ull * 1024 * 1024;
+
+    //Bounds on the render thread work per frame
+    int maxJobsInFlight = 8;
+    int maxUploadsPerFrame = 8;
+    size_t maxUploadBytesPerFrame = 4ull * 1024 * 1024;
+    int maxEvictionsPerFrame = 4;
+};
+
+enum ChunkColumnState
+{
+    ChunkColumnLoading,
+    ChunkColumnLoaded,
+    ChunkColumnMeshing,
+    ChunkColumnMeshed
+};
+
+//Columns of chunkHeight chunks are the unit of loading and eviction
+struct ChunkColumn
+{
+    ChunkColumnState state = ChunkColumnLoading;
+    uint64_t lastUsedFrame = 0;
+    int pendingMeshes = 0;
+    //Block storage plus mesh data
+    size_t bytes = 0;
+};
+
+struct ChunkLoadResult
+{
+    glm::ivec2 coordinate;
+    std::vector<VoxelStorage> blocks;
+    bool modified = false;
+};
+
+struct ChunkMeshResult
+{
+    glm::ivec3 coordinate;
+    VoxelMesh mesh;
+};
+
+struct ChunkStreamCandidate
+{
+    float priority;
+    glm::ivec2 coordinate;
+    bool load;
+};
+
+struct ChunkStreamer
+{
+    ChunkStreamerSettings settings;
+    int chunkHeight = 2;
+    uint32_t seed = 1;
+
+    std::unordered_map<uint64_t, ChunkColumn> columns;
+    //Edited columns keep their blocks when evicted instead of being regenerated
+    std::unordered_map<uint64_t, std::vector<VoxelStorage>> savedColumns;
+    uint64_t frame = 0;
+    size_t memoryUsed = 0;
+
+    //Handed back by the workers
+    std::mutex mutex;
+    std::vector<ChunkLoadResult> loaded;
+    std::deque<ChunkMeshResult> meshed;
+    std::atomic<int> jobsInFlight{ 0 };
+
+    //Scratch, kept between frames
+    std::vector<ChunkStreamCandidate> candidates;
+    std::vector<std::pair<uint64_t, uint64_t>> evictable;
+};
+
+//--stream <radius> [--stream-budget <megabytes>]
+bool ParseChunkStreamerArguments(int argc, char** argv, ChunkStreamerSettings& settings)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--stream") == 0)
+        {
+            settings.enabled = true;
+            settings.radius = atoi(argv[++i]);
+            if (settings.radius <= 0)
+            {
+                std::cout << "Invalid value for --stream" << std::endl;
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--stream-budget") == 0)
+        {
+            long megabytes = strtol(argv[++i], nullptr, 10);
+            if (megabytes <= 0)
+            {
+                std::cout << "Invalid value for --stream-budget" << std::endl;
+                return false;
+            }
+            settings.memoryBudget = static_cast<size_t>(megabytes) * 1024 * 1024;
+        }
+    }
+
+    return true;
+}
+
+uint64_t ChunkColumnKey(glm::ivec2 coordinate)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(coordinate.x)) << 32) | static_cast<uint32_t>(coordinate.y);
+}
+
+glm::ivec2 ChunkColumnFromKey(uint64_t key)
+{
+    return glm::ivec2(static_cast<int32_t>(key >> 32), static_cast<int32_t>(key & 0xFFFFFFFF));
+}
+
+//Ready to be a neighbour of a column being meshed
+bool IsChunkColumnResident(const ChunkStreamer& streamer, glm::ivec2 coordinate)
+{
+    auto found = streamer.columns.find(ChunkColumnKey(coordinate));
+    return found != streamer.columns.end() && found->second.state != ChunkColumnLoading;
+}
+
+size_t VoxelMeshBytes(const VoxelMesh& mesh)
+{
+    return mesh.vertices.size() * sizeof(float) + mesh.indices.size() * sizeof(uint32_t);
+}
+
+void StartChunkLoad(ChunkStreamer& streamer, JobSystem& jobSystem, glm::ivec2 coordinate)
+{
+    uint64_t key = ChunkColumnKey(coordinate);
+    streamer.columns[key].state = ChunkColumnLoading;
+
+    auto saved = streamer.savedColumns.find(key);
+    if (saved != streamer.savedColumns.end())
+    {
+        ChunkLoadResult result;
+        result.coordinate = coordinate;
+        result.blocks = std::move(saved->second);
+        result.modified = true;
+        streamer.savedColumns.erase(saved);
+
+        std::lock_guard<std::mutex> lock(streamer.mutex);
+        streamer.loaded.push_back(std::move(result));
+        return;
+    }
+
+    streamer.jobsInFlight++;
+
+    PushJob(jobSystem, [&streamer, coordinate]()
+    {
+        ChunkLoadResult result;
+        result.coordinate = coordinate;
+        result.blocks.resize(streamer.chunkHeight);
+        GenerateVoxelColumn(result.blocks.data(), coordinate, streamer.chunkHeight, streamer.seed);
+
+        std::lock_guard<std::mutex> lock(streamer.mutex);
+        streamer.loaded.push_back(std::move(result));
+        streamer.jobsInFlight--;
+    });
+}
+
+void StartChunkMesh(ChunkStreamer& streamer, const VoxelWorld& world, JobSystem& jobSystem, glm::ivec2 coordinate)
+{
+    ChunkColumn& column = streamer.columns[ChunkColumnKey(coordinate)];
+    column.state = ChunkColumnMeshing;
+    column.pendingMeshes = streamer.chunkHeight;
+    streamer.jobsInFlight++;
+
+    //Snapshots make the job independent of later loads, edits and evictions
+    std::vector<VoxelMeshSnapshot> snapshots(streamer.chunkHeight);
+    for (int chunkY = 0; chunkY < streamer.chunkHeight; chunkY++)
+        TakeVoxelMeshSnapshot(world, *FindVoxelChunk(world, glm::ivec3(coordinate.x, chunkY, coordinate.y)), snapshots[chunkY]);
+
+    PushJob(jobSystem, [&streamer, coordinate, snapshots = std::move(snapshots)]()
+    {
+        std::vector<ChunkMeshResult> results(snapshots.size());
+        for (size_t chunkY = 0; chunkY < snapshots.size(); chunkY++)
+        {
+            results[chunkY].coordinate = snapshots[chunkY].coordinate;
+            BuildVoxelChunkMesh(GetSnapshotNeighborhood(snapshots[chunkY]), results[chunkY].mesh);
+            results[chunkY].mesh.version = snapshots[chunkY].version;
+        }
+
+        std::lock_guard<std::mutex> lock(streamer.mutex);
+        for (ChunkMeshResult& result : results)
+            streamer.meshed.push_back(std::move(result));
+        streamer.jobsInFlight--;
+    });
+}
+
+void EvictChunkColumn(ChunkStreamer& streamer, VoxelWorld& world, Scene& scene, uint64_t key)
+{
+    glm::ivec2 coordinate = ChunkColumnFromKey(key);
+
+    bool modified = false;
+    for (int chunkY = 0; chunkY < streamer.chunkHeight; chunkY++)
+        modified = modified || FindVoxelChunk(world, glm::ivec3(coordinate.x, chunkY, coordinate.y))->modified;
+
+    if (modified)
+    {
+        std::vector<VoxelStorage>& saved = streamer.savedColumns[key];
+        saved.resize(streamer.chunkHeight);
+        for (int chunkY = 0; chunkY < streamer.chunkHeight; chunkY++)
+            saved[chunkY] = std::move(FindVoxelChunk(world, glm::ivec3(coordinate.x, chunkY, coordinate.y))->blocks);
+    }
+
+    for (int chunkY = 0; chunkY < streamer.chunkHeight; chunkY++)
+        RemoveVoxelChunk(world, scene, glm::ivec3(coordinate.x, chunkY, coordinate.y));
+
+    streamer.memoryUsed -= streamer.columns[key].bytes;
+    streamer.columns.erase(key);
+}
+
+//Loads and meshes columns around the camera on the job system, nearest and in view first,
+//and evicts the least recently used columns once over the memory budget. The render thread
+//only integrates finished work, within the per frame limits in the settings.
+void UpdateChunkStreamer(ChunkStreamer& streamer, VoxelWorld& world, Scene& scene, glm::vec3 cameraPosition, glm::vec3 cameraForward, JobSystem& jobSystem)
+{
+    const ChunkStreamerSettings& settings = streamer.settings;
+    streamer.frame++;
+
+    //Finished loads
+    std::vector<ChunkLoadResult> loaded;
+    {
+        std::lock_guard<std::mutex> lock(streamer.mutex);
+        loaded.swap(streamer.loaded);
+    }
+    for (ChunkLoadResult& result : loaded)
+    {
+        ChunkColumn& column = streamer.columns[ChunkColumnKey(result.coordinate)];
+        for (int chunkY = 0; chunkY < streamer.chunkHeight; chunkY++)
+        {
+            VoxelChunk* chunk = GetOrCreateVoxelChunk(world, glm::ivec3(result.coordinate.x, chunkY, result.coordinate.y));
+            chunk->blocks = std::move(result.blocks[chunkY]);
+            chunk->modified = result.modified;
+            column.bytes += VoxelStorageBytes(chunk->blocks);
+        }
+        column.state = ChunkColumnLoaded;
+        streamer.memoryUsed += column.bytes;
+    }
+
+    //Finished meshes, bounded by count and bytes but always at least one
+    size_t uploadBytes = 0;
+    for (int uploads = 0; uploads < settings.maxUploadsPerFrame && uploadBytes < settings.maxUploadBytesPerFrame; uploads++)
+    {
+        ChunkMeshResult result;
+        {
+            std::lock_guard<std::mutex> lock(streamer.mutex);
+            if (streamer.meshed.empty())
+                break;
+            result = std::move(streamer.meshed.front());
+            streamer.meshed.pop_front();
+        }
+
+        ChunkColumn& column = streamer.columns[ChunkColumnKey(glm::ivec2(result.coordinate.x, result.coordinate.z))];
+        //An edit may already have replaced this mesh with a newer one
+        VoxelChunk* chunk = FindVoxelChunk(world, result.coordinate);
+        if (result.mesh.version >= chunk->meshVersion)
+            ApplyVoxelChunkMesh(world, scene, *chunk, result.mesh);
+
+        size_t bytes = VoxelMeshBytes(result.mesh);
+        uploadBytes += bytes;
+        column.bytes += bytes;
+        streamer.memoryUsed += bytes;
+        if (--column.pendingMeshes == 0)
+            column.state = ChunkColumnMeshed;
+    }
+
+    //Wanted columns, scored by distance and favouring the view direction
+    glm::ivec2 center(static_cast<int>(std::floor(cameraPosition.x / ChunkSize)), static_cast<int>(std::floor(cameraPosition.z / ChunkSize)));
+    glm::vec2 forward(cameraForward.x, cameraForward.z);
+    if (glm::length(forward) > 0.001f)
+        forward = glm::normalize(forward);
+
+    int loadRadius = settings.radius + 1;
+    streamer.candidates.clear();
+    for (int z = -loadRadius; z <= loadRadius; z++)
+    {
+        for (int x = -loadRadius; x <= loadRadius; x++)
+        {
+            int distanceSquared = x * x + z * z;
+            if (distanceSquared > loadRadius * loadRadius)
+                continue;
+
+            glm::ivec2 coordinate = center + glm::ivec2(x, z);
+            float distance = std::sqrt(static_cast<float>(distanceSquared));
+            float facing = distance > 0.0f ? glm::dot(glm::vec2(x, z) / distance, forward) : 1.0f;
+            float priority = distance * (1.25f - 0.5f * facing);
+
+            auto found = streamer.columns.find(ChunkColumnKey(coordinate));
+            if (found == streamer.columns.end())
+            {
+                streamer.candidates.push_back({ priority, coordinate, true });
+                continue;
+            }
+
+            found->second.lastUsedFrame = streamer.frame;
+            if (found->second.state != ChunkColumnLoaded || distanceSquared > settings.radius * settings.radius)
+                continue;
+
+            //Border faces need all four neighbours
+            if (IsChunkColumnResident(streamer, coordinate + glm::ivec2(1, 0)) && IsChunkColumnResident(streamer, coordinate - glm::ivec2(1, 0))
+                && IsChunkColumnResident(streamer, coordinate + glm::ivec2(0, 1)) && IsChunkColumnResident(streamer, coordinate - glm::ivec2(0, 1)))
+                streamer.candidates.push_back({ priority, coordinate, false });
+        }
+    }
+
+    int freeSlots = settings.maxJobsInFlight - streamer.jobsInFlight.load();
+    if (freeSlots > 0 && !streamer.candidates.empty())
+    {
+        size_t count = std::min(streamer.candidates.size(), static_cast<size_t>(freeSlots));
+        std::partial_sort(streamer.candidates.begin(), streamer.candidates.begin() + count, streamer.candidates.end(),
+            [](const ChunkStreamCandidate& a, const ChunkStreamCandidate& b) { return a.priority < b.priority; });
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const ChunkStreamCandidate& candidate = streamer.candidates[i];
+            if (candidate.load)
+                StartChunkLoad(streamer, jobSystem, candidate.coordinate);
+            else
+                StartChunkMesh(streamer, world, jobSystem, candidate.coordinate);
+        }
+    }
+
+    //Least recently used first, never what is wanted this frame or has work in flight
+    if (streamer.memoryUsed > settings.memoryBudget)
+    {
+        streamer.evictable.clear();
+        for (auto& entry : streamer.columns)
+        {
+            const ChunkColumn& column = entry.second;
+            bool busy = column.state == ChunkColumnLoading || column.state == ChunkColumnMeshing;
+            if (!busy && column.lastUsedFrame != streamer.frame)
+                streamer.evictable.push_back({ column.lastUsedFrame, entry.first });
+        }
+
+        size_t count = std::min(streamer.evictable.size(), static_cast<size_t>(settings.maxEvictionsPerFrame));
+        std::partial_sort(streamer.evictable.begin(), streamer.evictable.begin() + count, streamer.evictable.end());
+        for (size_t i = 0; i < count && streamer.memoryUsed > settings.memoryBudget; i++)
+            EvictChunkColumn(streamer, world, scene, streamer.evictable[i].second);
+    }
+}
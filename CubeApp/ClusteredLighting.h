@@ -0,0 +1,442 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "Culling.h"
+#include "JobSystem.h"
+#include "Scene.h"
+
+//Froxels: screen tiles split into slices that grow exponentially with depth
+const int ClusterCountX = 16;
+const int ClusterCountY = 9;
+const int ClusterCountZ = 24;
+const int ClusterCount = ClusterCountX * ClusterCountY * ClusterCountZ;
+
+//Light indices are 16 bit
+const size_t MaxClusteredLights = 65535;
+
+const size_t ClusterLightGrainSize = 256;
+//Slices per job. A job per slice costs more in queueing than the few lights take to assign.
+const size_t ClusterSliceGrainSize = 8;
+
+//Texture units of the buffer textures in shaderPhong, 0 and 1 hold the material and the shadow map
+const GLint ClusterLightsTextureUnit = 2;
+const GLint ClusterGridTextureUnit = 3;
+const GLint ClusterIndicesTextureUnit = 4;
+
+//Lights overlapping one slice, then one row of tiles of that slice, padded to four with
+//lights that never pass
+struct ClusterSliceScratch
+{
+    std::vector<uint32_t> sliceLights;
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radiusSquared;
+    std::vector<int32_t> minTileX;
+    std::vector<int32_t> maxTileX;
+    std::vector<uint16_t> lights;
+
+    std::vector<uint16_t> indices;
+};
+
+//Point lights are assigned to the froxels they touch every frame on the CPU. The fragment
+//shader finds its froxel and only walks that list, so its cost follows the local light
+//density rather than the total light count.
+struct ClusteredLighting
+{
+    //View space boxes of the froxels, rebuilt when the projection changes
+    glm::mat4 projection = glm::mat4(0.0f);
+    float nearPlane = 0.0f;
+    float farPlane = 0.0f;
+    float sliceScale = 0.0f;
+    float sliceBias = 0.0f;
+    std::vector<glm::vec3> clusterMin;
+    std::vector<glm::vec3> clusterMax;
+
+    //View space spheres and froxel ranges per light, padded to four
+    size_t lightCount = 0;
+    std::vector<float> viewX;
+    std::vector<float> viewY;
+    std::vector<float> viewZ;
+    std::vector<float> radius;
+    std::vector<int32_t> minTileX;
+    std::vector<int32_t> maxTileX;
+    std::vector<int32_t> minTileY;
+    std::vector<int32_t> maxTileY;
+    std::vector<int32_t> minSlice;
+    std::vector<int32_t> maxSlice;
+
+    std::vector<ClusterSliceScratch> slices;
+
+    //Uploaded: position and radius then color per light, offset and count per froxel,
+    //and the light lists of all froxels back to back
+    std::vector<glm::vec4> lightData;
+    std::vector<glm::uvec2> grid;
+    std::vector<uint16_t> indices;
+
+    GLuint lightBuffer = 0;
+    GLuint lightTexture = 0;
+    GLuint gridBuffer = 0;
+    GLuint gridTexture = 0;
+    GLuint indexBuffer = 0;
+    GLuint indexTexture = 0;
+};
+
+void CreateClusterTexture(GLuint& buffer, GLuint& texture, GLenum format)
+{
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+}
+
+void CreateClusteredLighting(ClusteredLighting& clustered)
+{
+    CreateClusterTexture(clustered.lightBuffer, clustered.lightTexture, GL_RGBA32F);
+    CreateClusterTexture(clustered.gridBuffer, clustered.gridTexture, GL_RG32UI);
+    CreateClusterTexture(clustered.indexBuffer, clustered.indexTexture, GL_R16UI);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    clustered.slices.resize(ClusterCountZ);
+    clustered.grid.resize(ClusterCount);
+}
+
+//The samplers are fixed per program
+void SetClusteredLightingSamplers(GLuint program)
+{
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "pointLights"), ClusterLightsTextureUnit);
+    glUniform1i(glGetUniformLocation(program, "clusterGrid"), ClusterGridTextureUnit);
+    glUniform1i(glGetUniformLocation(program, "clusterIndices"), ClusterIndicesTextureUnit);
+}
+
+void BindClusteredLighting(const ClusteredLighting& clustered)
+{
+    glActiveTexture(GL_TEXTURE0 + ClusterLightsTextureUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, clustered.lightTexture);
+    glActiveTexture(GL_TEXTURE0 + ClusterGridTextureUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, clustered.gridTexture);
+    glActiveTexture(GL_TEXTURE0 + ClusterIndicesTextureUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, clustered.indexTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//Slice of a view depth: log(depth) * sliceScale + sliceBias
+float GetClusterSlice(const ClusteredLighting& clustered, float depth)
+{
+    return std::log(depth) * clustered.sliceScale + clustered.sliceBias;
+}
+
+//Symmetric perspective projections only, x and y in normalized device coordinates scale
+//with 1 / depth
+void BuildClusterGrid(ClusteredLighting& clustered, const glm::mat4& projection, float nearPlane, float farPlane)
+{
+    clustered.projection = projection;
+    clustered.nearPlane = nearPlane;
+    clustered.farPlane = farPlane;
+    clustered.sliceScale = ClusterCountZ / std::log(farPlane / nearPlane);
+    clustered.sliceBias = -std::log(nearPlane) * clustered.sliceScale;
+
+    clustered.clusterMin.resize(ClusterCount);
+    clustered.clusterMax.resize(ClusterCount);
+
+    for (int slice = 0; slice < ClusterCountZ; slice++)
+    {
+        float nearDepth = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(slice) / ClusterCountZ);
+        float farDepth = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(slice + 1) / ClusterCountZ);
+
+        for (int tileY = 0; tileY < ClusterCountY; tileY++)
+        {
+            float minY = (2.0f * tileY / ClusterCountY - 1.0f) / projection[1][1];
+            float maxY = (2.0f * (tileY + 1) / ClusterCountY - 1.0f) / projection[1][1];
+
+            for (int tileX = 0; tileX < ClusterCountX; tileX++)
+            {
+                float minX = (2.0f * tileX / ClusterCountX - 1.0f) / projection[0][0];
+                float maxX = (2.0f * (tileX + 1) / ClusterCountX - 1.0f) / projection[0][0];
+
+                int cluster = (slice * ClusterCountY + tileY) * ClusterCountX + tileX;
+                clustered.clusterMin[cluster] = glm::vec3(std::min(minX * nearDepth, minX * farDepth), std::min(minY * nearDepth, minY * farDepth), -farDepth);
+                clustered.clusterMax[cluster] = glm::vec3(std::max(maxX * nearDepth, maxX * farDepth), std::max(maxY * nearDepth, maxY * farDepth), -nearDepth);
+            }
+        }
+    }
+}
+
+//Range of tiles covered by [minimum, maximum] on one axis, seen between nearDepth and
+//farDepth. Returns false when it is off screen.
+bool GetClusterTileRange(float minimum, float maximum, float nearDepth, float farDepth, float scale, int tileCount, int32_t& first, int32_t& last)
+{
+    float minNdc = (minimum < 0.0f ? minimum / nearDepth : minimum / farDepth) * scale;
+    float maxNdc = (maximum > 0.0f ? maximum / nearDepth : maximum / farDepth) * scale;
+    if (maxNdc < -1.0f || minNdc > 1.0f)
+        return false;
+
+    first = std::clamp(static_cast<int32_t>(std::floor((minNdc * 0.5f + 0.5f) * tileCount)), 0, tileCount - 1);
+    last = std::clamp(static_cast<int32_t>(std::floor((maxNdc * 0.5f + 0.5f) * tileCount)), 0, tileCount - 1);
+    return true;
+}
+
+//Moves lights first .. last - 1 to view space, four at a time, and finds the froxels their
+//spheres may touch. Lights that touch none get an empty slice range.
+void TransformClusterLights(ClusteredLighting& clustered, const std::vector<SceneLight>& lights, const glm::mat4& view, size_t first, size_t last)
+{
+#if defined(CUBEAPP_SSE)
+    for (size_t i = first; i < last; i += 4)
+    {
+        float worldX[4], worldY[4], worldZ[4];
+        for (size_t lane = 0; lane < 4; lane++)
+        {
+            size_t light = std::min(i + lane, clustered.lightCount - 1);
+            worldX[lane] = lights[light].position.x;
+            worldY[lane] = lights[light].position.y;
+            worldZ[lane] = lights[light].position.z;
+        }
+
+        __m128 x = _mm_loadu_ps(worldX), y = _mm_loadu_ps(worldY), z = _mm_loadu_ps(worldZ);
+        for (int row = 0; row < 3; row++)
+        {
+            __m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(view[0][row])), _mm_mul_ps(y, _mm_set1_ps(view[1][row]))),
+                                      _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(view[2][row])), _mm_set1_ps(view[3][row])));
+            float* target = row == 0 ? clustered.viewX.data() : row == 1 ? clustered.viewY.data() : clustered.viewZ.data();
+            _mm_storeu_ps(target + i, value);
+        }
+    }
+#else
+    for (size_t i = first; i < last; i++)
+    {
+        glm::vec3 position = glm::vec3(view * glm::vec4(lights[std::min(i, clustered.lightCount - 1)].position, 1.0f));
+        clustered.viewX[i] = position.x;
+        clustered.viewY[i] = position.y;
+        clustered.viewZ[i] = position.z;
+    }
+#endif
+
+    last = std::min(last, clustered.lightCount);
+    for (size_t i = first; i < last; i++)
+    {
+        float lightRadius = lights[i].radius;
+        clustered.radius[i] = lightRadius;
+        clustered.minSlice[i] = 0;
+        clustered.maxSlice[i] = -1;
+
+        float depth = -clustered.viewZ[i];
+        if (depth + lightRadius < clustered.nearPlane || depth - lightRadius > clustered.farPlane)
+            continue;
+
+        float nearDepth = std::max(depth - lightRadius, clustered.nearPlane);
+        float farDepth = std::min(depth + lightRadius, clustered.farPlane);
+        if (!GetClusterTileRange(clustered.viewX[i] - lightRadius, clustered.viewX[i] + lightRadius, nearDepth, farDepth, clustered.projection[0][0], ClusterCountX, clustered.minTileX[i], clustered.maxTileX[i])
+            || !GetClusterTileRange(clustered.viewY[i] - lightRadius, clustered.viewY[i] + lightRadius, nearDepth, farDepth, clustered.projection[1][1], ClusterCountY, clustered.minTileY[i], clustered.maxTileY[i]))
+            continue;
+
+        clustered.minSlice[i] = std::clamp(static_cast<int32_t>(std::floor(GetClusterSlice(clustered, nearDepth))), 0, ClusterCountZ - 1);
+        clustered.maxSlice[i] = std::clamp(static_cast<int32_t>(std::floor(GetClusterSlice(clustered, farDepth))), 0, ClusterCountZ - 1);
+    }
+}
+
+//Bit i of the result is set when light first + i of the row overlaps the froxel box
+int TestClusterRow4(const ClusterSliceScratch& row, size_t first, int32_t tileX, glm::vec3 boxMin, glm::vec3 boxMax)
+{
+#if defined(CUBEAPP_SSE)
+    __m128 zero = _mm_setzero_ps();
+    __m128 x = _mm_loadu_ps(&row.x[first]);
+    __m128 y = _mm_loadu_ps(&row.y[first]);
+    __m128 z = _mm_loadu_ps(&row.z[first]);
+    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(boxMin.x), x), _mm_sub_ps(x, _mm_set1_ps(boxMax.x))), zero);
+    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(boxMin.y), y), _mm_sub_ps(y, _mm_set1_ps(boxMax.y))), zero);
+    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(boxMin.z), z), _mm_sub_ps(z, _mm_set1_ps(boxMax.z))), zero);
+    __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    __m128 inside = _mm_cmple_ps(distanceSquared, _mm_loadu_ps(&row.radiusSquared[first]));
+
+    __m128i tile = _mm_set1_epi32(tileX);
+    __m128i minTile = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&row.minTileX[first]));
+    __m128i maxTile = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&row.maxTileX[first]));
+    __m128i outsideTiles = _mm_or_si128(_mm_cmplt_epi32(tile, minTile), _mm_cmpgt_epi32(tile, maxTile));
+    return _mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(outsideTiles), inside));
+#else
+    int mask = 0;
+    for (size_t lane = 0; lane < 4; lane++)
+    {
+        size_t i = first + lane;
+        if (tileX < row.minTileX[i] || tileX > row.maxTileX[i])
+            continue;
+
+        glm::vec3 center(row.x[i], row.y[i], row.z[i]);
+        glm::vec3 delta = glm::max(glm::max(boxMin - center, center - boxMax), glm::vec3(0.0f));
+        if (glm::dot(delta, delta) <= row.radiusSquared[i])
+            mask |= 1 << lane;
+    }
+    return mask;
+#endif
+}
+
+//Fills the light lists of one slice. Offsets in the grid are relative to the slice until
+//the slices are merged.
+void AssignClusterSlice(ClusteredLighting& clustered, int slice)
+{
+    ClusterSliceScratch& scratch = clustered.slices[slice];
+    scratch.sliceLights.clear();
+    scratch.indices.clear();
+
+    for (uint32_t light = 0; light < clustered.lightCount; light++)
+    {
+        if (clustered.minSlice[light] <= slice && slice <= clustered.maxSlice[light])
+            scratch.sliceLights.push_back(light);
+    }
+
+    for (int tileY = 0; tileY < ClusterCountY; tileY++)
+    {
+        scratch.x.clear();
+        scratch.y.clear();
+        scratch.z.clear();
+        scratch.radiusSquared.clear();
+        scratch.minTileX.clear();
+        scratch.maxTileX.clear();
+        scratch.lights.clear();
+
+        for (uint32_t light : scratch.sliceLights)
+        {
+            if (tileY < clustered.minTileY[light] || tileY > clustered.maxTileY[light])
+                continue;
+
+            scratch.x.push_back(clustered.viewX[light]);
+            scratch.y.push_back(clustered.viewY[light]);
+            scratch.z.push_back(clustered.viewZ[light]);
+            scratch.radiusSquared.push_back(clustered.radius[light] * clustered.radius[light]);
+            scratch.minTileX.push_back(clustered.minTileX[light]);
+            scratch.maxTileX.push_back(clustered.maxTileX[light]);
+            scratch.lights.push_back(static_cast<uint16_t>(light));
+        }
+
+        size_t rowCount = scratch.lights.size();
+        size_t padded = (rowCount + 3) & ~size_t(3);
+        scratch.x.resize(padded, 0.0f);
+        scratch.y.resize(padded, 0.0f);
+        scratch.z.resize(padded, 0.0f);
+        scratch.radiusSquared.resize(padded, -1.0f);
+        scratch.minTileX.resize(padded, 0);
+        scratch.maxTileX.resize(padded, -1);
+
+        for (int tileX = 0; tileX < ClusterCountX; tileX++)
+        {
+            int cluster = (slice * ClusterCountY + tileY) * ClusterCountX + tileX;
+            uint32_t offset = static_cast<uint32_t>(scratch.indices.size());
+
+            for (size_t first = 0; first < padded; first += 4)
+            {
+                int mask = TestClusterRow4(scratch, first, tileX, clustered.clusterMin[cluster], clustered.clusterMax[cluster]);
+                while (mask != 0)
+                {
+                    int lane = 0;
+                    while ((mask & (1 << lane)) == 0)
+                        lane++;
+                    mask &= mask - 1;
+                    scratch.indices.push_back(scratch.lights[first + lane]);
+                }
+            }
+
+            clustered.grid[cluster] = glm::uvec2(offset, static_cast<uint32_t>(scratch.indices.size()) - offset);
+        }
+    }
+}
+
+void UploadClusterBuffer(GLuint buffer, const void* data, size_t bytes)
+{
+    //Orphaned every frame, a buffer texture needs some storage even when empty
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+    if (bytes > 0)
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+}
+
+//Assigns the scene's point lights to the froxels of this frame's camera and uploads the
+//lists. Lights are transformed in parallel chunks, then the slices are filled a few at a time.
+void UpdateClusteredLighting(ClusteredLighting& clustered, const std::vector<SceneLight>& lights, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, JobSystem* jobSystem)
+{
+    if (projection != clustered.projection || nearPlane != clustered.nearPlane || farPlane != clustered.farPlane)
+        BuildClusterGrid(clustered, projection, nearPlane, farPlane);
+
+    clustered.lightCount = std::min(lights.size(), MaxClusteredLights);
+    size_t padded = (clustered.lightCount + 3) & ~size_t(3);
+    clustered.viewX.resize(padded);
+    clustered.viewY.resize(padded);
+    clustered.viewZ.resize(padded);
+    clustered.radius.resize(padded);
+    clustered.minTileX.resize(padded);
+    clustered.maxTileX.resize(padded);
+    clustered.minTileY.resize(padded);
+    clustered.maxTileY.resize(padded);
+    clustered.minSlice.resize(padded);
+    clustered.maxSlice.resize(padded);
+
+    clustered.indices.clear();
+    if (clustered.lightCount == 0)
+    {
+        //Every froxel gets an empty list, no jobs needed
+        std::fill(clustered.grid.begin(), clustered.grid.end(), glm::uvec2(0));
+    }
+    else
+    {
+        //Chunks stay multiples of four for the transform
+        ParallelFor(jobSystem, padded / 4, ClusterLightGrainSize / 4, [&](size_t begin, size_t end)
+        {
+            TransformClusterLights(clustered, lights, view, begin * 4, end * 4);
+        });
+
+        ParallelFor(jobSystem, ClusterCountZ, ClusterSliceGrainSize, [&](size_t begin, size_t end)
+        {
+            for (size_t slice = begin; slice < end; slice++)
+                AssignClusterSlice(clustered, static_cast<int>(slice));
+        });
+
+        //Merge the slices into one list
+        for (int slice = 0; slice < ClusterCountZ; slice++)
+        {
+            uint32_t base = static_cast<uint32_t>(clustered.indices.size());
+            for (int cluster = slice * ClusterCountX * ClusterCountY; cluster < (slice + 1) * ClusterCountX * ClusterCountY; cluster++)
+                clustered.grid[cluster].x += base;
+
+            const std::vector<uint16_t>& sliceIndices = clustered.slices[slice].indices;
+            clustered.indices.insert(clustered.indices.end(), sliceIndices.begin(), sliceIndices.end());
+        }
+    }
+
+    clustered.lightData.resize(clustered.lightCount * 2);
+    for (size_t i = 0; i < clustered.lightCount; i++)
+    {
+        clustered.lightData[i * 2] = glm::vec4(lights[i].position, lights[i].radius);
+        clustered.lightData[i * 2 + 1] = glm::vec4(lights[i].color, 0.0f);
+    }
+
+    UploadClusterBuffer(clustered.lightBuffer, clustered.lightData.data(), clustered.lightData.size() * sizeof(glm::vec4));
+    UploadClusterBuffer(clustered.gridBuffer, clustered.grid.data(), clustered.grid.size() * sizeof(glm::uvec2));
+    UploadClusterBuffer(clustered.indexBuffer, clustered.indices.data(), clustered.indices.size() * sizeof(uint16_t));
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+//Values for the cluster fields of the Lighting block: tiles per pixel and the slice
+//mapping, then the grid size and the light count
+glm::vec4 GetClusterScale(const ClusteredLighting& clustered, glm::ivec2 viewportSize)
+{
+    return glm::vec4(static_cast<float>(ClusterCountX) / viewportSize.x, static_cast<float>(ClusterCountY) / viewportSize.y, clustered.sliceScale, clustered.sliceBias);
+}
+
+glm::vec4 GetClusterSize(const ClusteredLighting& clustered)
+{
+    return glm::vec4(ClusterCountX, ClusterCountY, ClusterCountZ, static_cast<float>(clustered.lightCount));
+}
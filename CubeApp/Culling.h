@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CUBEAPP_SSE 1
+#include <immintrin.h>
+#endif
+
+struct Frustum
+{
+    //xyz normal pointing inwards, w distance
+    glm::vec4 planes[6];
+};
+
+//Axis aligned boxes as center and half extent, one array per component
+struct BoundsSoA
+{
+    size_t count = 0;
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+};
+
+//Gribb/Hartmann plane extraction for OpenGL clip space
+Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row3 + row2;
+    frustum.planes[5] = row3 - row2;
+
+    for (glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    return frustum;
+}
+
+void ResizeBounds(BoundsSoA& bounds, size_t count)
+{
+    bounds.count = count;
+    bounds.centerX.resize(count, 0.0f);
+    bounds.centerY.resize(count, 0.0f);
+    bounds.centerZ.resize(count, 0.0f);
+    bounds.extentX.resize(count, 0.0f);
+    bounds.extentY.resize(count, 0.0f);
+    bounds.extentZ.resize(count, 0.0f);
+}
+
+void SetBounds(BoundsSoA& bounds, size_t index, glm::vec3 center, glm::vec3 extent)
+{
+    bounds.centerX[index] = center.x;
+    bounds.centerY[index] = center.y;
+    bounds.centerZ[index] = center.z;
+    bounds.extentX[index] = extent.x;
+    bounds.extentY[index] = extent.y;
+    bounds.extentZ[index] = extent.z;
+}
+
+//World space box enclosing a transformed local box (Arvo)
+void TransformBounds(const glm::mat4& model, glm::vec3 localCenter, glm::vec3 localExtent, glm::vec3& outCenter, glm::vec3& outExtent)
+{
+    outCenter = glm::vec3(model * glm::vec4(localCenter, 1.0f));
+
+    glm::mat3 absolute(model);
+    for (int column = 0; column < 3; column++)
+        absolute[column] = glm::abs(absolute[column]);
+
+    outExtent = absolute * localExtent;
+}
+
+bool IsBoxVisible(const Frustum& frustum, glm::vec3 center, glm::vec3 extent)
+{
+    for (const glm::vec4& plane : frustum.planes)
+    {
+        glm::vec3 normal(plane);
+        float distance = glm::dot(normal, center) + plane.w;
+        float radius = glm::dot(glm::abs(normal), extent);
+        if (distance + radius < 0.0f)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstring>
+#include <iostream>
+
+#include "ClusteredLighting.h"
+
+//Texture units of the G-buffer in shaderDeferred, the shadow map and the cluster lists
+//keep the units of the forward path
+const GLint DeferredAlbedoTextureUnit = 0;
+const GLint DeferredNormalTextureUnit = 5;
+const GLint DeferredDepthTextureUnit = 6;
+
+struct DeferredSettings
+{
+    bool enabled = false;
+};
+
+//12 bytes per pixel: albedo, an octahedral normal in two 16 bit channels and depth, which
+//the lighting pass turns back into a position. Lighting is one full screen pass that reads
+//the froxel light lists, so every pixel is shaded once however much overdraw the geometry
+//pass had.
+struct DeferredShading
+{
+    DeferredSettings settings;
+
+    int width = 0;
+    int height = 0;
+    GLuint framebuffer = 0;
+    GLuint albedoTexture = 0;
+    GLuint normalTexture = 0;
+    GLuint depthTexture = 0;
+
+    GLuint geometryProgram = 0;
+    GLuint lightingProgram = 0;
+    GLint inverseProjectionLocation = -1;
+    GLint inverseViewLocation = -1;
+
+    //The full screen triangle has no attributes, but core profiles need a vertex array bound
+    GLuint emptyVertexArray = 0;
+};
+
+//--deferred
+bool ParseDeferredArguments(int argc, char** argv, DeferredSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--deferred") == 0)
+            settings.enabled = true;
+    }
+
+    return true;
+}
+
+GLuint CreateGBufferTexture(GLint internalFormat, GLenum format, GLenum type, int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+void CreateDeferredShading(DeferredShading& deferred, int width, int height, const char* geometryVertexShaderFileName, const char* geometryFragmentShaderFileName,
+    const char* lightingVertexShaderFileName, const char* lightingFragmentShaderFileName, GLuint lightingUniformBinding)
+{
+    deferred.width = width;
+    deferred.height = height;
+
+    deferred.albedoTexture = CreateGBufferTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    deferred.normalTexture = CreateGBufferTexture(GL_RG16, GL_RG, GL_UNSIGNED_SHORT, width, height);
+    deferred.depthTexture = CreateGBufferTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &deferred.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, deferred.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, deferred.albedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, deferred.normalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, deferred.depthTexture, 0);
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "G-buffer framebuffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    deferred.geometryProgram = CompileShaders(geometryVertexShaderFileName, geometryFragmentShaderFileName);
+    glUseProgram(deferred.geometryProgram);
+    glUniform1i(glGetUniformLocation(deferred.geometryProgram, "texture1"), 0);
+
+    deferred.lightingProgram = CompileShaders(lightingVertexShaderFileName, lightingFragmentShaderFileName);
+    glUseProgram(deferred.lightingProgram);
+    glUniform1i(glGetUniformLocation(deferred.lightingProgram, "gAlbedo"), DeferredAlbedoTextureUnit);
+    glUniform1i(glGetUniformLocation(deferred.lightingProgram, "gNormal"), DeferredNormalTextureUnit);
+    glUniform1i(glGetUniformLocation(deferred.lightingProgram, "gDepth"), DeferredDepthTextureUnit);
+    glUniform1i(glGetUniformLocation(deferred.lightingProgram, "shadowMap"), 1);
+    glUniformBlockBinding(deferred.lightingProgram, glGetUniformBlockIndex(deferred.lightingProgram, "Lighting"), lightingUniformBinding);
+    SetClusteredLightingSamplers(deferred.lightingProgram);
+    deferred.inverseProjectionLocation = glGetUniformLocation(deferred.lightingProgram, "inverseProjection");
+    deferred.inverseViewLocation = glGetUniformLocation(deferred.lightingProgram, "inverseView");
+
+    glGenVertexArrays(1, &deferred.emptyVertexArray);
+}
+
+//Shades the G-buffer into framebuffer with the camera of the geometry pass. The shadow map
+//and the cluster lists are expected on their units already.
+void RenderDeferredLighting(const DeferredShading& deferred, GLuint framebuffer, glm::ivec4 viewport, const glm::mat4& view, const glm::mat4& projection)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glUseProgram(deferred.lightingProgram);
+    glUniformMatrix4fv(deferred.inverseProjectionLocation, 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+    glUniformMatrix4fv(deferred.inverseViewLocation, 1, GL_FALSE, glm::value_ptr(glm::inverse(view)));
+
+    glActiveTexture(GL_TEXTURE0 + DeferredAlbedoTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, deferred.albedoTexture);
+    glActiveTexture(GL_TEXTURE0 + DeferredNormalTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, deferred.normalTexture);
+    glActiveTexture(GL_TEXTURE0 + DeferredDepthTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, deferred.depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(deferred.emptyVertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
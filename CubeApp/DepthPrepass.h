@@ -0,0 +1,162 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "RenderQueue.h"
+
+//Query pairs in flight, results are read a few frames late without waiting
+const int DepthPrepassQueryCount = 4;
+
+//Fragments passing the depth test per screen pixel in front to back order. The prepass
+//turns on above the first and off below the second, and never switches more often than
+//every DepthPrepassSwitchFrames frames.
+const float DepthPrepassEnableOverdraw = 2.0f;
+const float DepthPrepassDisableOverdraw = 1.5f;
+const int DepthPrepassSwitchFrames = 30;
+
+enum DepthPrepassMode
+{
+    DepthPrepassAuto,
+    DepthPrepassOn,
+    DepthPrepassOff
+};
+
+struct DepthPrepass
+{
+    DepthPrepassMode mode = DepthPrepassAuto;
+    bool enabled = false;
+    //Set while something reads the prepass depth, keeps it on whatever the mode
+    bool required = false;
+
+    //Samples passed by the prepass and by the opaque pass, per frame in flight
+    GLuint prepassQueries[DepthPrepassQueryCount] = {};
+    GLuint opaqueQueries[DepthPrepassQueryCount] = {};
+    bool queryPending[DepthPrepassQueryCount] = {};
+    bool queryPrepass[DepthPrepassQueryCount] = {};
+    int nextQuery = 0;
+    //Slot used this frame, -1 when every slot was still in flight
+    int frameQuery = -1;
+
+    float overdraw = 0.0f;
+    int framesSinceSwitch = 0;
+};
+
+//--depth-prepass auto|on|off
+bool ParseDepthPrepassArguments(int argc, char** argv, DepthPrepassMode& mode)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--depth-prepass") != 0)
+            continue;
+
+        const char* name = argv[++i];
+        if (strcmp(name, "auto") == 0)
+            mode = DepthPrepassAuto;
+        else if (strcmp(name, "on") == 0)
+            mode = DepthPrepassOn;
+        else if (strcmp(name, "off") == 0)
+            mode = DepthPrepassOff;
+        else
+        {
+            std::cout << "Invalid value for --depth-prepass, expected auto, on or off" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CreateDepthPrepass(DepthPrepass& prepass)
+{
+    glGenQueries(DepthPrepassQueryCount, prepass.prepassQueries);
+    glGenQueries(DepthPrepassQueryCount, prepass.opaqueQueries);
+    prepass.enabled = prepass.mode == DepthPrepassOn;
+}
+
+//Reads the finished measurements and applies the thresholds. Without the prepass the
+//opaque pass samples are the fragments shaded, with it the prepass samples are what the
+//opaque pass would have shaded.
+void UpdateDepthPrepass(DepthPrepass& prepass, uint64_t pixelCount)
+{
+    prepass.framesSinceSwitch++;
+
+    for (int i = 0; i < DepthPrepassQueryCount; i++)
+    {
+        int query = (prepass.nextQuery + i) % DepthPrepassQueryCount;
+        if (!prepass.queryPending[query])
+            continue;
+
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(prepass.opaqueQueries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint samples = 0;
+        glGetQueryObjectuiv(prepass.queryPrepass[query] ? prepass.prepassQueries[query] : prepass.opaqueQueries[query], GL_QUERY_RESULT, &samples);
+        prepass.overdraw = pixelCount > 0 ? static_cast<float>(samples) / static_cast<float>(pixelCount) : 0.0f;
+        prepass.queryPending[query] = false;
+    }
+
+    if (prepass.required || prepass.mode != DepthPrepassAuto)
+    {
+        prepass.enabled = prepass.required || prepass.mode == DepthPrepassOn;
+        return;
+    }
+
+    if (prepass.framesSinceSwitch < DepthPrepassSwitchFrames)
+        return;
+
+    bool enable = prepass.enabled ? prepass.overdraw >= DepthPrepassDisableOverdraw : prepass.overdraw > DepthPrepassEnableOverdraw;
+    if (enable == prepass.enabled)
+        return;
+
+    prepass.enabled = enable;
+    prepass.framesSinceSwitch = 0;
+    std::cout << "Depth prepass " << (enable ? "on" : "off") << ", overdraw " << prepass.overdraw << std::endl;
+}
+
+//Configures the prepass from the opaque pass state: depth only with the same camera and
+//target, then the opaque pass shades where the depth is equal without writing it. Call
+//after every other pass has copied the opaque state.
+void SetupDepthPrepass(DepthPrepass& prepass, RenderQueue& queue)
+{
+    RenderPassState& opaquePass = queue.passes[RenderPassOpaque];
+    RenderPassState& prepassState = queue.passes[RenderPassDepthPrepass];
+    opaquePass.depthFunc = GL_LESS;
+    opaquePass.depthWrite = GL_TRUE;
+    opaquePass.samplesQuery = 0;
+    prepassState = opaquePass;
+
+    prepass.frameQuery = prepass.queryPending[prepass.nextQuery] ? -1 : prepass.nextQuery;
+
+    if (prepass.enabled)
+    {
+        prepassState.colorWrite = GL_FALSE;
+        opaquePass.clearMask = 0;
+        opaquePass.depthFunc = GL_EQUAL;
+        opaquePass.depthWrite = GL_FALSE;
+    }
+    else
+        prepassState.clearMask = 0;
+
+    if (prepass.frameQuery >= 0)
+    {
+        prepassState.samplesQuery = prepass.enabled ? prepass.prepassQueries[prepass.frameQuery] : 0;
+        opaquePass.samplesQuery = prepass.opaqueQueries[prepass.frameQuery];
+    }
+}
+
+//After the queue has executed
+void EndDepthPrepassFrame(DepthPrepass& prepass)
+{
+    if (prepass.frameQuery < 0)
+        return;
+
+    prepass.queryPending[prepass.frameQuery] = true;
+    prepass.queryPrepass[prepass.frameQuery] = prepass.enabled;
+    prepass.nextQuery = (prepass.frameQuery + 1) % DepthPrepassQueryCount;
+}
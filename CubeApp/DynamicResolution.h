@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Bounds of the scale applied to both sides of the render target
+const float DynamicResolutionMinScale = 0.5f;
+const float DynamicResolutionMaxScale = 1.0f;
+
+//No change while the GPU time is within this fraction of the target, below it the scale
+//grows, above it shrinks
+const float DynamicResolutionLowerBand = 0.85f;
+const float DynamicResolutionUpperBand = 1.0f;
+
+//Fraction of the way to the estimated scale taken per measurement, growth is slower so a
+//spike is answered quickly but the recovery does not overshoot
+const float DynamicResolutionShrinkRate = 0.5f;
+const float DynamicResolutionGrowRate = 0.1f;
+
+const float DynamicResolutionDefaultSharpness = 0.5f;
+
+struct DynamicResolutionSettings
+{
+    bool enabled = false;
+    float targetMilliseconds = 16.0f;
+    float sharpness = DynamicResolutionDefaultSharpness;
+};
+
+//The camera passes render into the lower left part of a full size scene target, so the
+//scale can change every frame without reallocating. Tone mapping stretches that part over
+//the back buffer.
+struct DynamicResolution
+{
+    DynamicResolutionSettings settings;
+
+    int width = 0;
+    int height = 0;
+
+    float scale = DynamicResolutionMaxScale;
+};
+
+//--dynamic-resolution <target ms of the passes that scale with the resolution> [--upscale bilinear|sharpen]
+bool ParseDynamicResolutionArguments(int argc, char** argv, DynamicResolutionSettings& settings)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        const char* option = argv[i];
+        const char* value = argv[++i];
+
+        if (strcmp(option, "--dynamic-resolution") == 0)
+        {
+            settings.enabled = true;
+            settings.targetMilliseconds = static_cast<float>(atof(value));
+            if (settings.targetMilliseconds <= 0.0f)
+            {
+                std::cout << "Invalid value for --dynamic-resolution, expected a frame time in milliseconds" << std::endl;
+                return false;
+            }
+        }
+        else if (strcmp(option, "--upscale") == 0)
+        {
+            if (strcmp(value, "bilinear") == 0)
+                settings.sharpness = 0.0f;
+            else if (strcmp(value, "sharpen") == 0)
+                settings.sharpness = DynamicResolutionDefaultSharpness;
+            else
+            {
+                std::cout << "Invalid value for --upscale, expected bilinear or sharpen" << std::endl;
+                return false;
+            }
+        }
+        else
+            i--;
+    }
+
+    return true;
+}
+
+void CreateDynamicResolution(DynamicResolution& resolution, int width, int height)
+{
+    resolution.width = width;
+    resolution.height = height;
+}
+
+//Part of the target the camera passes render to this frame
+glm::ivec4 GetDynamicResolutionViewport(const DynamicResolution& resolution)
+{
+    int width = std::max(1, static_cast<int>(std::round(resolution.width * resolution.scale)));
+    int height = std::max(1, static_cast<int>(std::round(resolution.height * resolution.scale)));
+    return glm::ivec4(0, 0, width, height);
+}
+
+//GPU time of the passes that scale with the resolution is roughly proportional to the pixel
+//count, so the scale that would have met the target is the measured one times the square
+//root of target over measured. Call with each new measurement of those passes and the scale
+//it was rendered at. The whole frame is not used, it also holds fixed size work and time the
+//GPU waits on the CPU.
+void UpdateDynamicResolutionScale(DynamicResolution& resolution, float gpuMilliseconds, float measuredScale)
+{
+    float target = resolution.settings.targetMilliseconds;
+    if (gpuMilliseconds <= 0.0f)
+        return;
+
+    //Measurements arrive a few frames late. Ones taken before the last change describe a
+    //scale that is gone, using them would apply the same spike again.
+    if (measuredScale != resolution.scale)
+        return;
+
+    if (gpuMilliseconds >= target * DynamicResolutionLowerBand && gpuMilliseconds <= target * DynamicResolutionUpperBand)
+        return;
+
+    float estimate = measuredScale * std::sqrt(target * DynamicResolutionUpperBand / gpuMilliseconds);
+    float rate = estimate < resolution.scale ? DynamicResolutionShrinkRate : DynamicResolutionGrowRate;
+    resolution.scale = std::clamp(resolution.scale + (estimate - resolution.scale) * rate, DynamicResolutionMinScale, DynamicResolutionMaxScale);
+}
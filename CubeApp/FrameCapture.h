@@ -0,0 +1,373 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ImageWriter.h"
+
+//Pixel pack buffers in flight. A readback is mapped once its fence has passed, normally two
+//frames later, so the render thread never waits for the GPU.
+const int FrameCaptureBufferCount = 3;
+
+//Frames waiting for the writer. When it falls this far behind, new frames are dropped
+//rather than letting the render thread wait or memory grow.
+const size_t FrameCaptureQueueLimit = 8;
+
+enum FrameCaptureMode
+{
+    FrameCaptureOff,
+    //One PNG per press of the capture key
+    FrameCapturePng,
+    //Every frame into one uncompressed YUV 4:2:0 stream
+    FrameCaptureY4m,
+    //Every frame as a numbered PNG
+    FrameCaptureSequence
+};
+
+struct FrameCaptureSettings
+{
+    FrameCaptureMode mode = FrameCaptureOff;
+    std::string path;
+    int framesPerSecond = 60;
+};
+
+//RGBA rows bottom up, as glReadPixels returns them
+struct CapturedFrame
+{
+    std::vector<uint8_t> pixels;
+    uint32_t number = 0;
+};
+
+struct FrameCapture
+{
+    FrameCaptureSettings settings;
+
+    int width = 0;
+    int height = 0;
+
+    GLuint buffers[FrameCaptureBufferCount] = {};
+    GLsync fences[FrameCaptureBufferCount] = {};
+    uint32_t bufferFrames[FrameCaptureBufferCount] = {};
+    int next = 0;
+
+    //Continuous modes record from the start, the capture key pauses and resumes them
+    bool recording = false;
+    bool screenshotRequested = false;
+    uint32_t capturedCount = 0;
+    uint32_t droppedCount = 0;
+
+    //Writer thread, owns the output file
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<CapturedFrame> queue;
+    //Pixel storage of written frames, reused so capturing does not allocate every frame
+    std::vector<std::vector<uint8_t>> freePixels;
+    bool stopping = false;
+    std::ofstream y4mFile;
+    uint32_t writtenCount = 0;
+};
+
+//--capture png|y4m|sequence <path> [--capture-fps <rate>]
+bool ParseFrameCaptureArguments(int argc, char** argv, FrameCaptureSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--capture") == 0)
+        {
+            if (i + 2 >= argc)
+            {
+                std::cout << "--capture expects a mode and a path" << std::endl;
+                return false;
+            }
+
+            const char* mode = argv[++i];
+            if (strcmp(mode, "png") == 0)
+                settings.mode = FrameCapturePng;
+            else if (strcmp(mode, "y4m") == 0)
+                settings.mode = FrameCaptureY4m;
+            else if (strcmp(mode, "sequence") == 0)
+                settings.mode = FrameCaptureSequence;
+            else
+            {
+                std::cout << "Invalid value for --capture, expected png, y4m or sequence" << std::endl;
+                return false;
+            }
+            settings.path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--capture-fps") == 0 && i + 1 < argc)
+        {
+            settings.framesPerSecond = atoi(argv[++i]);
+            if (settings.framesPerSecond <= 0)
+            {
+                std::cout << "Invalid value for --capture-fps, expected frames per second" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+std::string GetCaptureFileName(const FrameCaptureSettings& settings, uint32_t number)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), settings.mode == FrameCapturePng ? "_%04u.png" : "_%06u.png", number);
+    return settings.path + suffix;
+}
+
+//Full range BT.601, the chroma of each 2x2 block averaged
+void WriteY4mFrame(std::ofstream& file, const uint8_t* pixels, int width, int height, std::vector<uint8_t>& planes)
+{
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+    size_t lumaSize = static_cast<size_t>(width) * height;
+    size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+    planes.resize(lumaSize + chromaSize * 2);
+    uint8_t* luma = planes.data();
+    uint8_t* cb = luma + lumaSize;
+    uint8_t* cr = cb + chromaSize;
+
+    //Rows arrive bottom up
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* row = pixels + static_cast<size_t>(height - 1 - y) * width * 4;
+        for (int x = 0; x < width; x++)
+        {
+            const uint8_t* p = row + x * 4;
+            luma[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+        }
+    }
+
+    for (int y = 0; y < chromaHeight; y++)
+    {
+        for (int x = 0; x < chromaWidth; x++)
+        {
+            int r = 0;
+            int g = 0;
+            int b = 0;
+            for (int dy = 0; dy < 2; dy++)
+            {
+                for (int dx = 0; dx < 2; dx++)
+                {
+                    int sx = std::min(2 * x + dx, width - 1);
+                    int sy = std::min(2 * y + dy, height - 1);
+                    const uint8_t* p = pixels + (static_cast<size_t>(height - 1 - sy) * width + sx) * 4;
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+            }
+            //Sums of four pixels, so the shift is two more than for one pixel
+            cb[static_cast<size_t>(y) * chromaWidth + x] = static_cast<uint8_t>(std::clamp((-43 * r - 85 * g + 128 * b + 512) / 1024 + 128, 0, 255));
+            cr[static_cast<size_t>(y) * chromaWidth + x] = static_cast<uint8_t>(std::clamp((128 * r - 107 * g - 21 * b + 512) / 1024 + 128, 0, 255));
+        }
+    }
+
+    file.write("FRAME\n", 6);
+    file.write(reinterpret_cast<const char*>(planes.data()), planes.size());
+}
+
+void FrameCaptureWriterLoop(FrameCapture* capture)
+{
+    std::vector<uint8_t> planes;
+    while (true)
+    {
+        CapturedFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(capture->mutex);
+            capture->wake.wait(lock, [capture] { return capture->stopping || !capture->queue.empty(); });
+            if (capture->queue.empty())
+                return;
+            frame = std::move(capture->queue.front());
+            capture->queue.pop_front();
+        }
+
+        if (capture->settings.mode == FrameCaptureY4m)
+            WriteY4mFrame(capture->y4mFile, frame.pixels.data(), capture->width, capture->height, planes);
+        else
+        {
+            std::string fileName = GetCaptureFileName(capture->settings, frame.number);
+            if (!WritePng(fileName.c_str(), frame.pixels.data(), capture->width, capture->height, 4, static_cast<size_t>(capture->width) * 4, true))
+                std::cout << "Could not write " << fileName << std::endl;
+            else if (capture->settings.mode == FrameCapturePng)
+                std::cout << "Saved " << fileName << std::endl;
+        }
+
+        std::lock_guard<std::mutex> lock(capture->mutex);
+        capture->freePixels.push_back(std::move(frame.pixels));
+        capture->writtenCount++;
+    }
+}
+
+//width and height of the back buffer
+bool StartFrameCapture(FrameCapture& capture, int width, int height)
+{
+    if (capture.settings.mode == FrameCaptureOff)
+        return true;
+
+    capture.width = width;
+    capture.height = height;
+
+    if (capture.settings.mode == FrameCaptureY4m)
+    {
+        capture.y4mFile.open(capture.settings.path, std::ios::binary);
+        if (!capture.y4mFile.is_open())
+        {
+            std::cout << "Could not open " << capture.settings.path << " for capture" << std::endl;
+            return false;
+        }
+        capture.y4mFile << "YUV4MPEG2 W" << width << " H" << height << " F" << capture.settings.framesPerSecond << ":1 Ip A1:1 C420jpeg\n";
+    }
+
+    glGenBuffers(FrameCaptureBufferCount, capture.buffers);
+    for (int i = 0; i < FrameCaptureBufferCount; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.buffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    capture.recording = capture.settings.mode != FrameCapturePng;
+    capture.writer = std::thread(FrameCaptureWriterLoop, &capture);
+    return true;
+}
+
+//Copies a finished readback out of its buffer and hands it to the writer, or drops it when
+//the writer is too far behind and canDrop is set
+void CollectFrameCaptureBuffer(FrameCapture& capture, int index, bool canDrop)
+{
+    glDeleteSync(capture.fences[index]);
+    capture.fences[index] = 0;
+
+    std::vector<uint8_t> pixels;
+    {
+        std::lock_guard<std::mutex> lock(capture.mutex);
+        if (canDrop && capture.queue.size() >= FrameCaptureQueueLimit)
+        {
+            capture.droppedCount++;
+            return;
+        }
+        if (!capture.freePixels.empty())
+        {
+            pixels = std::move(capture.freePixels.back());
+            capture.freePixels.pop_back();
+        }
+    }
+
+    size_t size = static_cast<size_t>(capture.width) * capture.height * 4;
+    pixels.resize(size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.buffers[index]);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(size), GL_MAP_READ_BIT);
+    if (mapped != nullptr)
+    {
+        memcpy(pixels.data(), mapped, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (mapped == nullptr)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(capture.mutex);
+        CapturedFrame frame;
+        frame.pixels = std::move(pixels);
+        frame.number = capture.bufferFrames[index];
+        capture.queue.push_back(std::move(frame));
+    }
+    capture.wake.notify_one();
+}
+
+//After the last pass into the back buffer, before the swap. Collects readbacks that have
+//finished, then starts one of this frame when recording or a screenshot was asked for.
+void CaptureFrame(FrameCapture& capture)
+{
+    if (capture.settings.mode == FrameCaptureOff)
+        return;
+
+    for (int i = 0; i < FrameCaptureBufferCount; i++)
+    {
+        int index = (capture.next + i) % FrameCaptureBufferCount;
+        if (capture.fences[index] == 0)
+            continue;
+        if (glClientWaitSync(capture.fences[index], 0, 0) == GL_TIMEOUT_EXPIRED)
+            break;
+        CollectFrameCaptureBuffer(capture, index, true);
+    }
+
+    if (!capture.recording && !capture.screenshotRequested)
+        return;
+
+    //Every buffer still in flight, the GPU is further behind than the ring covers
+    if (capture.fences[capture.next] != 0)
+    {
+        capture.droppedCount++;
+        return;
+    }
+
+    capture.screenshotRequested = false;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.buffers[capture.next]);
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, capture.width, capture.height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture.fences[capture.next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    capture.bufferFrames[capture.next] = capture.capturedCount++;
+    capture.next = (capture.next + 1) % FrameCaptureBufferCount;
+}
+
+//The capture key takes a screenshot in png mode and pauses or resumes the continuous modes
+void ToggleFrameCapture(FrameCapture& capture)
+{
+    if (capture.settings.mode == FrameCaptureOff)
+        return;
+
+    if (capture.settings.mode == FrameCapturePng)
+        capture.screenshotRequested = true;
+    else
+    {
+        capture.recording = !capture.recording;
+        std::cout << (capture.recording ? "Capture resumed" : "Capture paused") << std::endl;
+    }
+}
+
+//Waits for the readbacks in flight and for the writer to finish them
+void StopFrameCapture(FrameCapture& capture)
+{
+    if (capture.settings.mode == FrameCaptureOff)
+        return;
+
+    for (int i = 0; i < FrameCaptureBufferCount; i++)
+    {
+        int index = (capture.next + i) % FrameCaptureBufferCount;
+        if (capture.fences[index] == 0)
+            continue;
+        glClientWaitSync(capture.fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        CollectFrameCaptureBuffer(capture, index, false);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(capture.mutex);
+        capture.stopping = true;
+    }
+    capture.wake.notify_all();
+    capture.writer.join();
+    capture.y4mFile.close();
+
+    glDeleteBuffers(FrameCaptureBufferCount, capture.buffers);
+    if (capture.settings.mode != FrameCapturePng)
+        std::cout << "Captured " << capture.writtenCount << " frames, dropped " << capture.droppedCount << std::endl;
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Culling.h"
+#include "ImageWriter.h"
+#include "SceneTarget.h"
+
+//Fixed camera and scene time of each golden image
+struct GoldenPose
+{
+    glm::vec3 position;
+    glm::vec3 forward;
+    float time;
+};
+
+const GoldenPose GoldenPoses[] =
+{
+    { glm::vec3(2.0f, 0.0f, 3.0f), glm::vec3(-0.7f, 0.0f, -0.7f), 0.0f },
+    { glm::vec3(0.0f, 1.5f, 4.0f), glm::vec3(0.0f, -0.35f, -1.0f), 1.0f },
+    { glm::vec3(-3.0f, 0.5f, -2.0f), glm::vec3(0.8f, -0.1f, 0.6f), 2.5f },
+    { glm::vec3(4.0f, 3.0f, 4.0f), glm::vec3(-1.0f, -0.8f, -1.0f), 4.0f },
+};
+const int GoldenPoseCount = sizeof(GoldenPoses) / sizeof(GoldenPoses[0]);
+
+//Frames rendered at a pose before it is captured, so results that arrive frames late, like
+//the occlusion pyramid and the query readbacks, have caught up
+const int GoldenWarmupFrames = 8;
+
+//An image passes when all three hold. Mismatched pixels differ by more than
+//mismatchTolerance in some channel.
+struct GoldenThresholds
+{
+    double minPsnr = 40.0;
+    int maxError = 64;
+    int mismatchTolerance = 16;
+    double maxMismatchFraction = 0.001;
+};
+
+struct GoldenSettings
+{
+    bool enabled = false;
+    bool update = false;
+    std::string directory;
+    std::string name;
+    GoldenThresholds thresholds;
+};
+
+struct ImageDifference
+{
+    double psnr = INFINITY;
+    int maxError = 0;
+    uint64_t mismatchCount = 0;
+};
+
+//Renders every pose without a visible window and compares the result with the stored
+//images, or records them with --golden-update. The frame is tone mapped into an RGBA8
+//target of its own, since the back buffer of a hidden window has undefined contents.
+struct GoldenTest
+{
+    GoldenSettings settings;
+    SceneTarget target;
+
+    int pose = 0;
+    int frame = 0;
+    int passedCount = 0;
+    int failedCount = 0;
+    int createdCount = 0;
+
+    std::vector<uint8_t> pixels;
+};
+
+//--golden <directory> [--golden-name <name>] [--golden-update] [--golden-psnr <dB>]
+bool ParseGoldenArguments(int argc, char** argv, GoldenSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--golden-update") == 0)
+            settings.update = true;
+        else if (i + 1 >= argc)
+            continue;
+        else if (strcmp(argv[i], "--golden") == 0)
+        {
+            settings.enabled = true;
+            settings.directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--golden-name") == 0)
+            settings.name = argv[++i];
+        else if (strcmp(argv[i], "--golden-psnr") == 0)
+        {
+            settings.thresholds.minPsnr = atof(argv[++i]);
+            if (settings.thresholds.minPsnr <= 0.0)
+            {
+                std::cout << "Invalid value for --golden-psnr, expected a PSNR in dB" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//RGB of two RGBA8 images, alpha is ignored
+ImageDifference CompareImages(const uint8_t* a, const uint8_t* b, size_t pixelCount, int mismatchTolerance)
+{
+    uint64_t squaredError = 0;
+    int maxError = 0;
+    uint64_t mismatchCount = 0;
+    size_t i = 0;
+
+#if defined(CUBEAPP_SSE)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i tolerance = _mm_set1_epi32(mismatchTolerance);
+    __m128i maxDifference = zero;
+    __m128i squaredSum = zero;
+
+    //Four pixels per step
+    for (; i + 4 <= pixelCount; i += 4)
+    {
+        __m128i pixelsA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * 4));
+        __m128i pixelsB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 4));
+        __m128i difference = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(pixelsA, pixelsB), _mm_subs_epu8(pixelsB, pixelsA)), rgbMask);
+        maxDifference = _mm_max_epu8(maxDifference, difference);
+
+        //Squares summed in pairs by madd, then widened so the sums can not overflow
+        __m128i low = _mm_unpacklo_epi8(difference, zero);
+        __m128i high = _mm_unpackhi_epi8(difference, zero);
+        __m128i squares = _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high));
+        squaredSum = _mm_add_epi64(squaredSum, _mm_unpacklo_epi32(squares, zero));
+        squaredSum = _mm_add_epi64(squaredSum, _mm_unpackhi_epi32(squares, zero));
+
+        //Largest channel of each pixel into its low byte
+        __m128i pixelMax = _mm_max_epu8(difference, _mm_srli_epi32(difference, 8));
+        pixelMax = _mm_and_si128(_mm_max_epu8(pixelMax, _mm_srli_epi32(pixelMax, 16)), byteMask);
+        mismatchCount += std::popcount(static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(pixelMax, tolerance)))));
+    }
+
+    alignas(16) uint8_t maxBytes[16];
+    alignas(16) uint64_t sums[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(maxBytes), maxDifference);
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), squaredSum);
+    maxError = *std::max_element(maxBytes, maxBytes + 16);
+    squaredError = sums[0] + sums[1];
+#endif
+
+    for (; i < pixelCount; i++)
+    {
+        int pixelMax = 0;
+        for (int channel = 0; channel < 3; channel++)
+        {
+            int difference = std::abs(static_cast<int>(a[i * 4 + channel]) - static_cast<int>(b[i * 4 + channel]));
+            squaredError += static_cast<uint64_t>(difference * difference);
+            pixelMax = std::max(pixelMax, difference);
+        }
+        maxError = std::max(maxError, pixelMax);
+        if (pixelMax > mismatchTolerance)
+            mismatchCount++;
+    }
+
+    ImageDifference result;
+    result.maxError = maxError;
+    result.mismatchCount = mismatchCount;
+    if (squaredError > 0)
+    {
+        double meanSquaredError = static_cast<double>(squaredError) / (static_cast<double>(pixelCount) * 3.0);
+        result.psnr = 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+    }
+    return result;
+}
+
+//Golden in dark gray with the error of each pixel in red, amplified so small ones show
+void WriteDifferenceImage(const char* fileName, const uint8_t* golden, const uint8_t* actual, int width, int height)
+{
+    std::vector<uint8_t> image(static_cast<size_t>(width) * height * 4);
+    for (size_t i = 0; i < image.size(); i += 4)
+    {
+        int error = 0;
+        for (int channel = 0; channel < 3; channel++)
+            error = std::max(error, std::abs(static_cast<int>(golden[i + channel]) - static_cast<int>(actual[i + channel])));
+        uint8_t gray = static_cast<uint8_t>((golden[i] + golden[i + 1] + golden[i + 2]) / 12);
+        image[i] = static_cast<uint8_t>(std::min(255, gray + error * 4));
+        image[i + 1] = gray;
+        image[i + 2] = gray;
+        image[i + 3] = 255;
+    }
+    WritePng(fileName, image.data(), width, height, 4, static_cast<size_t>(width) * 4, false);
+}
+
+void CreateGoldenTest(GoldenTest& test, int width, int height)
+{
+    if (test.settings.enabled)
+        CreateSceneTarget(test.target, width, height, GL_RGBA8);
+}
+
+//Framebuffer the frame is tone mapped into, the back buffer outside golden mode
+GLuint GetGoldenFramebuffer(const GoldenTest& test)
+{
+    return test.settings.enabled ? test.target.framebuffer : 0;
+}
+
+bool IsGoldenTestRunning(const GoldenTest& test)
+{
+    return test.settings.enabled && test.pose < GoldenPoseCount;
+}
+
+const GoldenPose& GetGoldenPose(const GoldenTest& test)
+{
+    return GoldenPoses[std::min(test.pose, GoldenPoseCount - 1)];
+}
+
+//Reads the golden target top down with opaque alpha
+void ReadGoldenPixels(const SceneTarget& target, std::vector<uint8_t>& pixels, int width, int height)
+{
+    size_t stride = static_cast<size_t>(width) * 4;
+    pixels.resize(stride * height);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    for (int y = 0; y < height / 2; y++)
+        std::swap_ranges(pixels.begin() + y * stride, pixels.begin() + (y + 1) * stride, pixels.begin() + (height - 1 - y) * stride);
+    for (size_t i = 3; i < pixels.size(); i += 4)
+        pixels[i] = 255;
+}
+
+void CheckGoldenImage(GoldenTest& test, int width, int height)
+{
+    std::string baseName = test.settings.directory + "/" + test.settings.name + "_" + std::to_string(test.pose);
+    std::string goldenName = baseName + ".png";
+    ReadGoldenPixels(test.target, test.pixels, width, height);
+
+    if (test.settings.update)
+    {
+        if (!WritePng(goldenName.c_str(), test.pixels.data(), width, height, 4, static_cast<size_t>(width) * 4, false))
+        {
+            std::cout << "Golden " << goldenName << " could not be written" << std::endl;
+            test.failedCount++;
+            return;
+        }
+        std::cout << "Golden " << goldenName << " created" << std::endl;
+        test.createdCount++;
+        return;
+    }
+
+    //Missing images fail, so a wrong directory does not pass with nothing compared
+    int goldenWidth = 0;
+    int goldenHeight = 0;
+    int goldenChannels = 0;
+    unsigned char* golden = stbi_load(goldenName.c_str(), &goldenWidth, &goldenHeight, &goldenChannels, 4);
+    if (golden == nullptr)
+    {
+        std::cout << "Golden " << goldenName << " FAILED, missing, record it with --golden-update" << std::endl;
+        test.failedCount++;
+        return;
+    }
+
+    if (goldenWidth != width || goldenHeight != height)
+    {
+        std::cout << "Golden " << goldenName << " FAILED, size " << goldenWidth << "x" << goldenHeight << " instead of " << width << "x" << height << std::endl;
+        stbi_image_free(golden);
+        test.failedCount++;
+        return;
+    }
+
+    const GoldenThresholds& thresholds = test.settings.thresholds;
+    size_t pixelCount = static_cast<size_t>(width) * height;
+    ImageDifference difference = CompareImages(golden, test.pixels.data(), pixelCount, thresholds.mismatchTolerance);
+    bool passed = difference.psnr >= thresholds.minPsnr && difference.maxError <= thresholds.maxError
+        && difference.mismatchCount <= static_cast<uint64_t>(thresholds.maxMismatchFraction * pixelCount);
+
+    std::cout << "Golden " << goldenName << (passed ? " passed" : " FAILED") << ", PSNR " << difference.psnr << " dB, max error "
+        << difference.maxError << ", " << difference.mismatchCount << " mismatched pixels" << std::endl;
+
+    if (passed)
+        test.passedCount++;
+    else
+    {
+        test.failedCount++;
+        std::string actualName = baseName + "_actual.png";
+        std::string differenceName = baseName + "_diff.png";
+        WritePng(actualName.c_str(), test.pixels.data(), width, height, 4, static_cast<size_t>(width) * 4, false);
+        WriteDifferenceImage(differenceName.c_str(), golden, test.pixels.data(), width, height);
+    }
+    stbi_image_free(golden);
+}
+
+//After the frame is tone mapped into the golden target. Captures the pose once it has warmed
+//up and moves on, false once every pose is done. The frame is copied on to the back buffer
+//so frame capture still sees it.
+bool UpdateGoldenTest(GoldenTest& test, int width, int height)
+{
+    if (!IsGoldenTestRunning(test))
+        return false;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, test.target.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (++test.frame < GoldenWarmupFrames)
+        return true;
+
+    CheckGoldenImage(test, width, height);
+    test.frame = 0;
+    test.pose++;
+    if (test.pose < GoldenPoseCount)
+        return true;
+
+    std::cout << "Golden images: " << test.passedCount << " passed, " << test.failedCount << " failed, " << test.createdCount << " created" << std::endl;
+    return false;
+}
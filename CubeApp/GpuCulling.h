@@ -0,0 +1,386 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Culling.h"
+#include "HiZ.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "StreamBuffer.h"
+
+//Passes culled on the GPU, one set of outputs each
+enum GpuCullingPass
+{
+    GpuCullingCamera = 0,
+    GpuCullingLight = 1,
+    GpuCullingPassCount
+};
+
+//Attributes of the culling vertex shader
+const GLuint GpuCullingModelAttribute = 0;
+const GLuint GpuCullingCenterAttribute = 4;
+const GLuint GpuCullingExtentAttribute = 5;
+
+struct GpuCullingSettings
+{
+    bool enabled = false;
+};
+
+//Per instance input of the culling shader. The model matrix already has the mesh decode
+//applied, it is copied to the output as is.
+struct GpuCullingInstance
+{
+    glm::mat4 model;
+    glm::vec4 center;
+    glm::vec4 extent;
+};
+
+//Instances sharing a mesh and a texture. Moving instances come first, so a frame only
+//uploads that prefix.
+struct GpuCullingGroup
+{
+    DrawCall draw;
+    GLuint texture = 0;
+    std::vector<uint32_t> objects;
+    uint32_t dynamicCount = 0;
+
+    GLuint inputBuffer = 0;
+    GLuint inputVertexArray = 0;
+
+    //Compacted model matrices and the indirect command reading their count, per pass
+    GLuint outputBuffers[GpuCullingPassCount] = {};
+    GLuint indirectBuffer = 0;
+
+    //Primitives written per pass, stored into the indirect command
+    GLuint queries[GpuCullingPassCount] = {};
+
+    //Last draw of the survivors per pass, other render passes can draw them again
+    InstancedDraw draws[GpuCullingPassCount];
+};
+
+//Frustum and Hi-Z tests for instances, run in a vertex shader with rasterization discarded.
+//A geometry shader emits only the survivors into transform feedback, so the CPU never sees
+//per instance visibility. With query buffer objects (GL 4.4) the primitives written count
+//is stored straight into an indirect draw command. Otherwise every instance is drawn from
+//a cleared output, see RunGpuCulling.
+struct GpuCulling
+{
+    GpuCullingSettings settings;
+
+    GLuint program = 0;
+    GLint frustumPlanesLocation = -1;
+    GLint occlusionEnabledLocation = -1;
+    GLint occlusionViewProjectionLocation = -1;
+    GLint occlusionLevelsLocation = -1;
+    GLint depthBiasLocation = -1;
+
+    bool queryBuffer = false;
+    GLuint zeroBuffer = 0;
+
+    std::vector<GpuCullingGroup> groups;
+    std::vector<GpuCullingInstance> staging;
+};
+
+//--gpu-culling
+bool ParseGpuCullingArguments(int argc, char** argv, GpuCullingSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--gpu-culling") == 0)
+            settings.enabled = true;
+    }
+
+    return true;
+}
+
+void CreateGpuCullingProgram(GpuCulling& culling, const char* vertexShaderFileName, const char* geometryShaderFileName)
+{
+    const char* varyings[] = { "outModel" };
+    culling.program = CompileFeedbackShaders(vertexShaderFileName, geometryShaderFileName, varyings, 1);
+    culling.frustumPlanesLocation = glGetUniformLocation(culling.program, "frustumPlanes");
+    culling.occlusionEnabledLocation = glGetUniformLocation(culling.program, "occlusionEnabled");
+    culling.occlusionViewProjectionLocation = glGetUniformLocation(culling.program, "occlusionViewProjection");
+    culling.occlusionLevelsLocation = glGetUniformLocation(culling.program, "occlusionLevels");
+    culling.depthBiasLocation = glGetUniformLocation(culling.program, "depthBias");
+
+    glUseProgram(culling.program);
+    glUniform1i(glGetUniformLocation(culling.program, "occlusion"), 0);
+    glUniform1f(culling.depthBiasLocation, HiZDepthBias);
+}
+
+void WriteGpuCullingInstance(const Scene& scene, const MeshPool& pool, uint32_t object, GpuCullingInstance& instance)
+{
+    const SceneObject& sceneObject = scene.objects[object];
+    const BoundsSoA& bounds = scene.worldBounds;
+    instance.model = ApplyMeshDecode(sceneObject.model, pool.meshes[sceneObject.draw.mesh].decode);
+    instance.center = glm::vec4(bounds.centerX[object], bounds.centerY[object], bounds.centerZ[object], 0.0f);
+    instance.extent = glm::vec4(bounds.extentX[object], bounds.extentY[object], bounds.extentZ[object], 0.0f);
+}
+
+//Takes every pooled object that is not an occluder off the CPU: it leaves the BVH, so the
+//CPU passes never see it, and is culled and drawn from GPU buffers from now on.
+//dynamicObjects are the ones whose transform changes every frame.
+void BuildGpuCulling(GpuCulling& culling, Scene& scene, const MeshPool& pool, const std::vector<uint32_t>& dynamicObjects)
+{
+    culling.queryBuffer = GLAD_GL_VERSION_4_4 != 0;
+
+    std::vector<bool> dynamic(scene.objects.size(), false);
+    for (uint32_t object : dynamicObjects)
+        dynamic[object] = true;
+
+    //Dynamic objects first within each group
+    std::map<std::pair<uint32_t, GLuint>, size_t> groupIndices;
+    for (int dynamicPass = 1; dynamicPass >= 0; dynamicPass--)
+    {
+        for (uint32_t object = 0; object < scene.objects.size(); object++)
+        {
+            const SceneObject& sceneObject = scene.objects[object];
+            if (sceneObject.draw.mesh == MeshNull || sceneObject.draw.count == 0 || sceneObject.occluder || dynamic[object] != (dynamicPass == 1))
+                continue;
+
+            auto key = std::make_pair(sceneObject.draw.mesh, sceneObject.texture);
+            auto found = groupIndices.find(key);
+            if (found == groupIndices.end())
+            {
+                found = groupIndices.emplace(key, culling.groups.size()).first;
+                culling.groups.emplace_back();
+                culling.groups.back().draw = sceneObject.draw;
+                culling.groups.back().texture = sceneObject.texture;
+            }
+
+            GpuCullingGroup& group = culling.groups[found->second];
+            group.objects.push_back(object);
+            group.dynamicCount += dynamicPass;
+
+            if (scene.bvhBuilt)
+                RemoveBvhObject(scene.bvh, object);
+        }
+    }
+
+    size_t largest = 0;
+    for (GpuCullingGroup& group : culling.groups)
+    {
+        largest = std::max(largest, group.objects.size());
+
+        culling.staging.resize(group.objects.size());
+        for (size_t slot = 0; slot < group.objects.size(); slot++)
+            WriteGpuCullingInstance(scene, pool, group.objects[slot], culling.staging[slot]);
+
+        glGenVertexArrays(1, &group.inputVertexArray);
+        glBindVertexArray(group.inputVertexArray);
+        glGenBuffers(1, &group.inputBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, group.inputBuffer);
+        glBufferData(GL_ARRAY_BUFFER, group.objects.size() * sizeof(GpuCullingInstance), culling.staging.data(), GL_DYNAMIC_DRAW);
+
+        for (GLuint column = 0; column < 4; column++)
+        {
+            glVertexAttribPointer(GpuCullingModelAttribute + column, 4, GL_FLOAT, GL_FALSE, sizeof(GpuCullingInstance), (void*)(column * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(GpuCullingModelAttribute + column);
+        }
+        glVertexAttribPointer(GpuCullingCenterAttribute, 4, GL_FLOAT, GL_FALSE, sizeof(GpuCullingInstance), (void*)offsetof(GpuCullingInstance, center));
+        glEnableVertexAttribArray(GpuCullingCenterAttribute);
+        glVertexAttribPointer(GpuCullingExtentAttribute, 4, GL_FLOAT, GL_FALSE, sizeof(GpuCullingInstance), (void*)offsetof(GpuCullingInstance, extent));
+        glEnableVertexAttribArray(GpuCullingExtentAttribute);
+        glBindVertexArray(0);
+
+        glGenBuffers(GpuCullingPassCount, group.outputBuffers);
+        for (int pass = 0; pass < GpuCullingPassCount; pass++)
+        {
+            glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, group.outputBuffers[pass]);
+            glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, group.objects.size() * sizeof(glm::mat4), nullptr, GL_DYNAMIC_COPY);
+        }
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+
+        if (culling.queryBuffer)
+        {
+            glGenQueries(GpuCullingPassCount, group.queries);
+            glGenBuffers(1, &group.indirectBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, group.indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, GpuCullingPassCount * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+    }
+
+    //Source for clearing the outputs on the read back path
+    if (!culling.queryBuffer && largest > 0)
+    {
+        std::vector<char> zeros(largest * sizeof(glm::mat4), 0);
+        glGenBuffers(1, &culling.zeroBuffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, culling.zeroBuffer);
+        glBufferData(GL_COPY_READ_BUFFER, zeros.size(), zeros.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    culling.staging.clear();
+    culling.staging.shrink_to_fit();
+
+    size_t instanceCount = 0;
+    for (const GpuCullingGroup& group : culling.groups)
+        instanceCount += group.objects.size();
+    std::cout << "GPU culling: " << instanceCount << " instances in " << culling.groups.size() << " groups, visible counts "
+        << (culling.queryBuffer ? "stay on the GPU" : "not used, every instance is drawn") << std::endl;
+}
+
+//Uploads the moving instances through the stream buffer. Flushes the stream, so call it
+//before anything else reads stream data this frame.
+void UpdateGpuCulling(GpuCulling& culling, const Scene& scene, const MeshPool& pool, StreamBuffer& stream)
+{
+    std::vector<std::pair<GLintptr, size_t>> uploads(culling.groups.size(), { 0, 0 });
+    for (size_t i = 0; i < culling.groups.size(); i++)
+    {
+        const GpuCullingGroup& group = culling.groups[i];
+        if (group.dynamicCount == 0)
+            continue;
+
+        size_t bytes = group.dynamicCount * sizeof(GpuCullingInstance);
+        GpuCullingInstance* instances = static_cast<GpuCullingInstance*>(AllocateStream(stream, bytes, sizeof(glm::vec4), uploads[i].first));
+        if (instances == nullptr)
+        {
+            //The stream grows for the next frame, until then upload directly
+            culling.staging.resize(group.dynamicCount);
+            for (uint32_t slot = 0; slot < group.dynamicCount; slot++)
+                WriteGpuCullingInstance(scene, pool, group.objects[slot], culling.staging[slot]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, group.inputBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, bytes, culling.staging.data());
+            continue;
+        }
+
+        for (uint32_t slot = 0; slot < group.dynamicCount; slot++)
+            WriteGpuCullingInstance(scene, pool, group.objects[slot], instances[slot]);
+        uploads[i].second = bytes;
+    }
+
+    FlushStreamBuffer(stream);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, stream.buffer);
+    for (size_t i = 0; i < culling.groups.size(); i++)
+    {
+        if (uploads[i].second == 0)
+            continue;
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, culling.groups[i].inputBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, uploads[i].first, 0, uploads[i].second);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+//Culls every group against viewProjection and the GPU copy of the occlusion pyramid, which
+//holds the previous frame's occluders, and submits the survivors to renderPass
+void RunGpuCulling(GpuCulling& culling, RenderQueue& queue, GpuCullingPass pass, RenderPass renderPass, GLuint program, const glm::mat4& viewProjection, const HiZPyramid* occlusion)
+{
+    if (culling.groups.empty())
+        return;
+
+    Frustum frustum = ExtractFrustum(viewProjection);
+    bool occlusionEnabled = occlusion != nullptr && occlusion->gpuValid;
+
+    glUseProgram(culling.program);
+    glUniform4fv(culling.frustumPlanesLocation, 6, glm::value_ptr(frustum.planes[0]));
+    glUniform1i(culling.occlusionEnabledLocation, occlusionEnabled ? 1 : 0);
+    if (occlusionEnabled)
+    {
+        glUniformMatrix4fv(culling.occlusionViewProjectionLocation, 1, GL_FALSE, glm::value_ptr(occlusion->gpuViewProjection));
+        glUniform1i(culling.occlusionLevelsLocation, occlusion->levelCount);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, occlusion->texture);
+    }
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    for (GpuCullingGroup& group : culling.groups)
+    {
+        GLuint output = group.outputBuffers[pass];
+        GLsizeiptr outputBytes = static_cast<GLsizeiptr>(group.objects.size() * sizeof(glm::mat4));
+
+        if (!culling.queryBuffer)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, culling.zeroBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, output);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, outputBytes);
+        }
+
+        glBindVertexArray(group.inputVertexArray);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, output);
+        if (culling.queryBuffer)
+            glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, group.queries[pass]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(group.objects.size()));
+        glEndTransformFeedback();
+        if (culling.queryBuffer)
+            glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+        InstancedDraw draw;
+        draw.pass = renderPass;
+        draw.program = program;
+        draw.texture = renderPass == RenderPassOpaque || renderPass == RenderPassTransparent ? group.texture : 0;
+        draw.draw = group.draw;
+        draw.instanceBuffer = output;
+        draw.indirectBuffer = 0;
+        draw.indirectOffset = 0;
+        draw.instanceCount = 0;
+
+        if (culling.queryBuffer)
+        {
+            //Mesh offsets move when the pool is defragmented, so the command is rewritten
+            //every frame and the GPU then stores the count into it
+            DrawElementsIndirectCommand command;
+            GLuint indexBytes = group.draw.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+            command.count = static_cast<GLuint>(group.draw.count);
+            command.instanceCount = 0;
+            command.firstIndex = static_cast<GLuint>(reinterpret_cast<size_t>(GetMeshIndexOffset(*queue.meshPool, group.draw.mesh)) / indexBytes);
+            command.baseVertex = GetMeshBaseVertex(*queue.meshPool, group.draw.mesh);
+            command.baseInstance = 0;
+
+            GLintptr offset = static_cast<GLintptr>(pass * sizeof(DrawElementsIndirectCommand));
+            glBindBuffer(GL_QUERY_BUFFER, group.indirectBuffer);
+            glBufferSubData(GL_QUERY_BUFFER, offset, sizeof(command), &command);
+            glGetQueryObjectuiv(group.queries[pass], GL_QUERY_RESULT, (GLuint*)(offset + offsetof(DrawElementsIndirectCommand, instanceCount)));
+            glBindBuffer(GL_QUERY_BUFFER, 0);
+
+            draw.indirectBuffer = group.indirectBuffer;
+            draw.indirectOffset = offset;
+        }
+        else
+        {
+            //Without query buffers the count only reaches the CPU frames late, and a count
+            //that old misses instances a camera turn has just revealed. Every instance is
+            //drawn instead: the output was cleared, so the entries past the survivors are
+            //zero matrices whose triangles are degenerate and cost vertex work but no
+            //fragments.
+            draw.instanceCount = static_cast<GLsizei>(group.objects.size());
+        }
+
+        group.draws[pass] = draw;
+        SubmitInstancedDraw(queue, draw);
+    }
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+//Draws the survivors of the last RunGpuCulling for pass into another render pass
+void SubmitGpuCullingDraws(GpuCulling& culling, RenderQueue& queue, GpuCullingPass pass, RenderPass renderPass, GLuint program)
+{
+    for (const GpuCullingGroup& group : culling.groups)
+    {
+        InstancedDraw draw = group.draws[pass];
+        draw.pass = renderPass;
+        draw.program = program;
+        draw.texture = renderPass == RenderPassOpaque || renderPass == RenderPassTransparent ? group.texture : 0;
+        SubmitInstancedDraw(queue, draw);
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <glad/glad.h>
+
+//Measurements in flight, results are read a few frames late without waiting
+const int GpuTimerQueryCount = 4;
+
+//GPU time between two points of the command stream. Timestamps rather than
+//GL_TIME_ELAPSED, so timers can nest and overlap.
+struct GpuTimer
+{
+    GLuint beginQueries[GpuTimerQueryCount] = {};
+    GLuint endQueries[GpuTimerQueryCount] = {};
+    bool pending[GpuTimerQueryCount] = {};
+    int next = 0;
+    //Slot measured this frame, -1 when every slot was still in flight
+    int current = -1;
+
+    //Newest finished measurement, updated is set when BeginGpuTimer read a new one
+    float milliseconds = 0.0f;
+    bool updated = false;
+};
+
+void CreateGpuTimer(GpuTimer& timer)
+{
+    glGenQueries(GpuTimerQueryCount, timer.beginQueries);
+    glGenQueries(GpuTimerQueryCount, timer.endQueries);
+}
+
+//Collects finished measurements, then starts a new one
+void BeginGpuTimer(GpuTimer& timer)
+{
+    timer.updated = false;
+    for (int i = 0; i < GpuTimerQueryCount; i++)
+    {
+        int query = (timer.next + i) % GpuTimerQueryCount;
+        if (!timer.pending[query])
+            continue;
+
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(timer.endQueries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(timer.beginQueries[query], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(timer.endQueries[query], GL_QUERY_RESULT, &end);
+        timer.milliseconds = static_cast<float>(end - begin) / 1000000.0f;
+        timer.pending[query] = false;
+        timer.updated = true;
+    }
+
+    timer.current = timer.pending[timer.next] ? -1 : timer.next;
+    if (timer.current >= 0)
+        glQueryCounter(timer.beginQueries[timer.current], GL_TIMESTAMP);
+}
+
+void EndGpuTimer(GpuTimer& timer)
+{
+    if (timer.current < 0)
+        return;
+
+    glQueryCounter(timer.endQueries[timer.current], GL_TIMESTAMP);
+    timer.pending[timer.current] = true;
+    timer.next = (timer.current + 1) % GpuTimerQueryCount;
+    timer.current = -1;
+}
+
+//Most spans measured in one frame
+const int GpuSpanTimerMaxSpans = 4;
+
+//Sum of several spans of the command stream per frame, for work that is spread over the
+//frame. Leaves out what lies between the spans, including the GPU waiting on the CPU.
+struct GpuSpanTimer
+{
+    GLuint queries[GpuTimerQueryCount][GpuSpanTimerMaxSpans * 2] = {};
+    int spanCounts[GpuTimerQueryCount] = {};
+    //Value the caller stored with each measurement, such as the setting it was taken with
+    float tags[GpuTimerQueryCount] = {};
+    bool pending[GpuTimerQueryCount] = {};
+    int next = 0;
+    //Slot measured this frame, -1 when every slot was still in flight
+    int current = -1;
+    bool open = false;
+
+    //Newest finished measurement and its tag, updated is set when BeginGpuSpanTimerFrame read
+    //a new one
+    float milliseconds = 0.0f;
+    float tag = 0.0f;
+    bool updated = false;
+};
+
+void CreateGpuSpanTimer(GpuSpanTimer& timer)
+{
+    for (int query = 0; query < GpuTimerQueryCount; query++)
+        glGenQueries(GpuSpanTimerMaxSpans * 2, timer.queries[query]);
+}
+
+//Collects finished measurements, oldest first, then picks the slot for this frame
+void BeginGpuSpanTimerFrame(GpuSpanTimer& timer)
+{
+    timer.updated = false;
+    for (int i = 0; i < GpuTimerQueryCount; i++)
+    {
+        int query = (timer.next + i) % GpuTimerQueryCount;
+        if (!timer.pending[query])
+            continue;
+
+        //Timestamps finish in order, so the last one covers the rest
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(timer.queries[query][timer.spanCounts[query] * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 total = 0;
+        for (int span = 0; span < timer.spanCounts[query]; span++)
+        {
+            GLuint64 begin = 0;
+            GLuint64 end = 0;
+            glGetQueryObjectui64v(timer.queries[query][span * 2], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(timer.queries[query][span * 2 + 1], GL_QUERY_RESULT, &end);
+            total += end - begin;
+        }
+        timer.milliseconds = static_cast<float>(total) / 1000000.0f;
+        timer.tag = timer.tags[query];
+        timer.pending[query] = false;
+        timer.updated = true;
+    }
+
+    timer.current = timer.pending[timer.next] ? -1 : timer.next;
+    if (timer.current >= 0)
+        timer.spanCounts[timer.current] = 0;
+}
+
+void BeginGpuSpan(GpuSpanTimer& timer)
+{
+    if (timer.current < 0 || timer.open || timer.spanCounts[timer.current] >= GpuSpanTimerMaxSpans)
+        return;
+
+    glQueryCounter(timer.queries[timer.current][timer.spanCounts[timer.current] * 2], GL_TIMESTAMP);
+    timer.open = true;
+}
+
+void EndGpuSpan(GpuSpanTimer& timer)
+{
+    if (!timer.open)
+        return;
+
+    glQueryCounter(timer.queries[timer.current][timer.spanCounts[timer.current] * 2 + 1], GL_TIMESTAMP);
+    timer.spanCounts[timer.current]++;
+    timer.open = false;
+}
+
+void EndGpuSpanTimerFrame(GpuSpanTimer& timer, float tag = 0.0f)
+{
+    EndGpuSpan(timer);
+    if (timer.current >= 0 && timer.spanCounts[timer.current] > 0)
+    {
+        timer.tags[timer.current] = tag;
+        timer.pending[timer.current] = true;
+        timer.next = (timer.current + 1) % GpuTimerQueryCount;
+    }
+    timer.current = -1;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+//Readbacks in flight, the CPU only ever maps a buffer whose fence has signaled
+const int HiZReadbackCount = 3;
+const int HiZMaxLevels = 16;
+
+//Absorbs depth buffer quantization so surfaces never occlude themselves
+const float HiZDepthBias = 1e-4f;
+
+//Max depth pyramid built on the GPU from a small occluder depth pass and read back
+//asynchronously, so the CPU can test boxes against it a couple of frames later
+struct HiZPyramid
+{
+    //Occluder depth target
+    GLuint occluderFramebuffer = 0;
+    GLuint occluderDepth = 0;
+    int occluderWidth = 0;
+    int occluderHeight = 0;
+
+    //R32F mip chain, level 0 is half the occluder resolution
+    GLuint texture = 0;
+    GLuint framebuffer = 0;
+    int levelCount = 0;
+    int levelWidth[HiZMaxLevels];
+    int levelHeight[HiZMaxLevels];
+    size_t levelOffset[HiZMaxLevels];
+    size_t texelCount = 0;
+
+    //Readback ring
+    GLuint pixelBuffers[HiZReadbackCount] = {};
+    GLsync fences[HiZReadbackCount] = {};
+    glm::mat4 readbackViewProjection[HiZReadbackCount];
+    int nextReadback = 0;
+    //Waits for the readback from exactly HiZReadbackCount updates back instead of taking
+    //whichever has finished, so the CPU tests do not depend on GPU timing
+    bool fixedLatency = false;
+
+    //Latest pyramid on the CPU and the matrix it was rendered with
+    std::vector<float> depths;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    bool valid = false;
+
+    //Matrix of the pyramid currently in the texture, for tests that run on the GPU
+    glm::mat4 gpuViewProjection = glm::mat4(1.0f);
+    bool gpuValid = false;
+
+    GLuint emptyVertexArray = 0;
+};
+
+void CreateHiZPyramid(HiZPyramid& pyramid, int width, int height)
+{
+    pyramid.occluderWidth = width;
+    pyramid.occluderHeight = height;
+
+    //Occluder depth
+    glGenTextures(1, &pyramid.occluderDepth);
+    glBindTexture(GL_TEXTURE_2D, pyramid.occluderDepth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenFramebuffers(1, &pyramid.occluderFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, pyramid.occluderFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, pyramid.occluderDepth, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    //Pyramid levels
+    int levelWidth = std::max(1, width / 2);
+    int levelHeight = std::max(1, height / 2);
+    pyramid.levelCount = 0;
+    pyramid.texelCount = 0;
+    while (pyramid.levelCount < HiZMaxLevels)
+    {
+        pyramid.levelWidth[pyramid.levelCount] = levelWidth;
+        pyramid.levelHeight[pyramid.levelCount] = levelHeight;
+        pyramid.levelOffset[pyramid.levelCount] = pyramid.texelCount;
+        pyramid.texelCount += levelWidth * levelHeight;
+        pyramid.levelCount++;
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        levelWidth = std::max(1, levelWidth / 2);
+        levelHeight = std::max(1, levelHeight / 2);
+    }
+
+    glGenTextures(1, &pyramid.texture);
+    glBindTexture(GL_TEXTURE_2D, pyramid.texture);
+    for (int level = 0; level < pyramid.levelCount; level++)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, pyramid.levelWidth[level], pyramid.levelHeight[level], 0, GL_RED, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramid.levelCount - 1);
+
+    glGenFramebuffers(1, &pyramid.framebuffer);
+
+    //Readback buffers hold every level back to back
+    glGenBuffers(HiZReadbackCount, pyramid.pixelBuffers);
+    for (int i = 0; i < HiZReadbackCount; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pyramid.pixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, pyramid.texelCount * sizeof(float), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    pyramid.depths.assign(pyramid.texelCount, 1.0f);
+
+    glGenVertexArrays(1, &pyramid.emptyVertexArray);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//Copies any finished readback into the CPU pyramid without waiting on the GPU. With fixed
+//latency only the oldest is taken, waiting for it if needed.
+void CollectHiZReadback(HiZPyramid& pyramid)
+{
+    //Oldest first, so the newest finished one wins
+    int slotCount = pyramid.fixedLatency ? 1 : HiZReadbackCount;
+    for (int i = 0; i < slotCount; i++)
+    {
+        int slot = (pyramid.nextReadback + i) % HiZReadbackCount;
+        if (pyramid.fences[slot] == NULL)
+            continue;
+
+        GLenum status = glClientWaitSync(pyramid.fences[slot], 0, 0);
+        while (pyramid.fixedLatency && status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(pyramid.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(pyramid.fences[slot]);
+        pyramid.fences[slot] = NULL;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pyramid.pixelBuffers[slot]);
+        void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pyramid.texelCount * sizeof(float), GL_MAP_READ_BIT);
+        if (data != NULL)
+        {
+            std::memcpy(pyramid.depths.data(), data, pyramid.texelCount * sizeof(float));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            pyramid.viewProjection = pyramid.readbackViewProjection[slot];
+            pyramid.valid = true;
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+//Reduces the occluder depth into the pyramid and starts reading it back.
+//viewProjection is the matrix the occluder pass was rendered with.
+void UpdateHiZPyramid(HiZPyramid& pyramid, GLuint program, const glm::mat4& viewProjection)
+{
+    CollectHiZReadback(pyramid);
+
+    glUseProgram(program);
+    glBindVertexArray(pyramid.emptyVertexArray);
+    glBindFramebuffer(GL_FRAMEBUFFER, pyramid.framebuffer);
+    glDisable(GL_DEPTH_TEST);
+    glActiveTexture(GL_TEXTURE0);
+
+    for (int level = 0; level < pyramid.levelCount; level++)
+    {
+        //Only the previous level is readable, so the level being written never forms a feedback loop
+        if (level == 0)
+        {
+            glBindTexture(GL_TEXTURE_2D, pyramid.occluderDepth);
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, pyramid.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        }
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid.texture, level);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glViewport(0, 0, pyramid.levelWidth[level], pyramid.levelHeight[level]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, pyramid.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramid.levelCount - 1);
+    pyramid.gpuViewProjection = viewProjection;
+    pyramid.gpuValid = true;
+
+    //Skip the readback when every slot is still in flight rather than stall
+    int slot = pyramid.nextReadback;
+    if (pyramid.fences[slot] == NULL)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pyramid.pixelBuffers[slot]);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        for (int level = 0; level < pyramid.levelCount; level++)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid.texture, level);
+            glReadPixels(0, 0, pyramid.levelWidth[level], pyramid.levelHeight[level], GL_RED, GL_FLOAT, (void*)(pyramid.levelOffset[level] * sizeof(float)));
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        pyramid.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        pyramid.readbackViewProjection[slot] = viewProjection;
+        pyramid.nextReadback = (slot + 1) % HiZReadbackCount;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//True when the box is entirely behind the occluders the pyramid was built from
+bool IsOccluded(const HiZPyramid& pyramid, glm::vec3 center, glm::vec3 extent)
+{
+    if (!pyramid.valid)
+        return false;
+
+    glm::vec3 rectMin(FLT_MAX);
+    glm::vec3 rectMax(-FLT_MAX);
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 offset((corner & 1) ? extent.x : -extent.x, (corner & 2) ? extent.y : -extent.y, (corner & 4) ? extent.z : -extent.z);
+        glm::vec4 clip = pyramid.viewProjection * glm::vec4(center + offset, 1.0f);
+
+        //Crossing the near plane, treat as visible
+        if (clip.w <= 1e-5f)
+            return false;
+
+        glm::vec3 window = glm::vec3(clip) / clip.w * 0.5f + 0.5f;
+        rectMin = glm::min(rectMin, window);
+        rectMax = glm::max(rectMax, window);
+    }
+
+    //Outside the pyramid, the frustum test decides
+    if (rectMax.x < 0.0f || rectMax.y < 0.0f || rectMin.x > 1.0f || rectMin.y > 1.0f)
+        return false;
+
+    rectMin = glm::clamp(rectMin, glm::vec3(0.0f), glm::vec3(1.0f));
+    rectMax = glm::clamp(rectMax, glm::vec3(0.0f), glm::vec3(1.0f));
+
+    //Pick the level where the rectangle covers at most two texels in each direction
+    float texelsX = (rectMax.x - rectMin.x) * pyramid.levelWidth[0];
+    float texelsY = (rectMax.y - rectMin.y) * pyramid.levelHeight[0];
+    int level = static_cast<int>(std::ceil(std::log2(std::max(1.0f, std::max(texelsX, texelsY)))));
+    level = std::min(level, pyramid.levelCount - 1);
+
+    int width = pyramid.levelWidth[level];
+    int height = pyramid.levelHeight[level];
+    int x0 = std::min(width - 1, static_cast<int>(rectMin.x * width));
+    int x1 = std::min(width - 1, static_cast<int>(rectMax.x * width));
+    int y0 = std::min(height - 1, static_cast<int>(rectMin.y * height));
+    int y1 = std::min(height - 1, static_cast<int>(rectMax.y * height));
+
+    const float* depths = pyramid.depths.data() + pyramid.levelOffset[level];
+    float occluderDepth = 0.0f;
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+            occluderDepth = std::max(occluderDepth, depths[y * width + x]);
+    }
+
+    return rectMin.z > occluderDepth + HiZDepthBias;
+}
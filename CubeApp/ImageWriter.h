@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+//PNG without compression: the image data goes into stored deflate blocks, so encoding is a
+//copy plus the checksums and runs at memory speed, at the price of larger files
+const uint32_t PngStoredBlockSize = 65535;
+
+//Bytes Adler-32 can sum before its 32 bit sums have to be reduced
+const uint32_t AdlerBlockSize = 5552;
+
+struct PngCrcTable
+{
+    uint32_t values[256];
+
+    PngCrcTable()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            values[n] = c;
+        }
+    }
+};
+
+uint32_t UpdatePngCrc(uint32_t crc, const uint8_t* data, size_t size)
+{
+    //Built on first use, safe when several threads write images
+    static const PngCrcTable table;
+    for (size_t i = 0; i < size; i++)
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+void AppendPngUint32(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void WritePngChunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> header;
+    AppendPngUint32(header, static_cast<uint32_t>(data.size()));
+    header.insert(header.end(), type, type + 4);
+
+    uint32_t crc = UpdatePngCrc(0xFFFFFFFFu, header.data() + 4, 4);
+    crc = UpdatePngCrc(crc, data.data(), data.size()) ^ 0xFFFFFFFFu;
+    std::vector<uint8_t> footer;
+    AppendPngUint32(footer, crc);
+
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+}
+
+//8 bit RGB or RGBA rows of stride bytes. bottomUp takes the rows in OpenGL order, last row
+//first. Returns false when the file can not be written.
+bool WritePng(const char* fileName, const uint8_t* pixels, int width, int height, int channels, size_t stride, bool bottomUp)
+{
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<uint8_t> header;
+    AppendPngUint32(header, static_cast<uint32_t>(width));
+    AppendPngUint32(header, static_cast<uint32_t>(height));
+    //Bit depth, color type RGB or RGBA, compression, filter, no interlace
+    header.insert(header.end(), { 8, static_cast<uint8_t>(channels == 4 ? 6 : 2), 0, 0, 0 });
+    WritePngChunk(file, "IHDR", header);
+
+    //Every row starts with its filter type, 0 for none
+    size_t rowSize = static_cast<size_t>(width) * channels;
+    size_t rawSize = (rowSize + 1) * height;
+    std::vector<uint8_t> raw(rawSize);
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* row = pixels + static_cast<size_t>(bottomUp ? height - 1 - y : y) * stride;
+        uint8_t* out = raw.data() + y * (rowSize + 1);
+        out[0] = 0;
+        std::copy(row, row + rowSize, out + 1);
+    }
+
+    //zlib stream of stored blocks, then the Adler-32 of the raw data
+    std::vector<uint8_t> data;
+    data.reserve(rawSize + rawSize / PngStoredBlockSize * 5 + 16);
+    data.push_back(0x78);
+    data.push_back(0x01);
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (size_t offset = 0; offset < rawSize; offset += PngStoredBlockSize)
+    {
+        uint32_t size = static_cast<uint32_t>(std::min<size_t>(PngStoredBlockSize, rawSize - offset));
+        data.push_back(offset + size >= rawSize ? 1 : 0);
+        data.push_back(static_cast<uint8_t>(size));
+        data.push_back(static_cast<uint8_t>(size >> 8));
+        data.push_back(static_cast<uint8_t>(~size));
+        data.push_back(static_cast<uint8_t>(~size >> 8));
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+
+        for (uint32_t first = 0; first < size; first += AdlerBlockSize)
+        {
+            uint32_t last = std::min(size, first + AdlerBlockSize);
+            for (uint32_t i = first; i < last; i++)
+            {
+                a += raw[offset + i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+    }
+    AppendPngUint32(data, (b << 16) | a);
+    WritePngChunk(file, "IDAT", data);
+    WritePngChunk(file, "IEND", std::vector<uint8_t>());
+
+    return file.good();
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "CameraPath.h"
+
+//Keys and buttons the app polls. Escape is left out so a replay can always be stopped.
+enum InputKey
+{
+    InputKeyW,
+    InputKeyA,
+    InputKeyS,
+    InputKeyD,
+    InputKeyG,
+    InputKeyF12,
+    InputMouseLeft,
+    InputMouseRight,
+    InputKeyCount
+};
+
+const int InputKeyCodes[InputKeyCount] =
+{
+    GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_G, GLFW_KEY_F12, GLFW_MOUSE_BUTTON_LEFT, GLFW_MOUSE_BUTTON_RIGHT
+};
+
+const int InputDefaultFramesPerSecond = 60;
+
+//File header, magic "CBIN" then the version and the timestep
+const uint32_t InputFileMagic = 0x4E494243;
+const uint32_t InputFileVersion = 1;
+
+//After the header the file is a list of events, each the frame it belongs to and its type,
+//then the key for key events or the cursor position for cursor events. Only changes are
+//stored, so a frame where nothing happens costs nothing.
+enum InputEventType : uint8_t
+{
+    InputEventKeyDown,
+    InputEventKeyUp,
+    InputEventCursor,
+    InputEventEnd
+};
+
+struct InputEvent
+{
+    uint32_t frame;
+    InputEventType type;
+    uint8_t key;
+    glm::vec2 cursor;
+};
+
+enum InputMode
+{
+    InputLive,
+    InputRecord,
+    InputReplay
+};
+
+struct InputSettings
+{
+    InputMode mode = InputLive;
+    std::string fileName;
+    std::string cameraPathFileName;
+    int framesPerSecond = InputDefaultFramesPerSecond;
+};
+
+//Sits between GLFW and the app. Recording and replay step time by a fixed timestep instead
+//of the clock, so frame n of a replay sees exactly the input and time frame n of the
+//recording saw, however fast either run renders.
+struct InputRecorder
+{
+    InputSettings settings;
+
+    float timestep = 1.0f / InputDefaultFramesPerSecond;
+    //Frame being processed, and its time when the timestep is fixed
+    uint32_t frame = 0;
+    float time = 0.0f;
+
+    //Bit per InputKey
+    uint32_t keys = 0;
+
+    std::ofstream file;
+    std::vector<InputEvent> events;
+    size_t nextEvent = 0;
+
+    //Cursor positions of this frame when replaying, in the order they arrived
+    std::vector<glm::vec2> cursorMoves;
+
+    CameraPath cameraPath;
+    bool hasCameraPath = false;
+
+    //Replay or camera path has run out
+    bool finished = false;
+};
+
+//--record <file> or --replay <file>, --camera-path <file>, --fixed-fps <frames per second>
+bool ParseInputArguments(int argc, char** argv, InputSettings& settings)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0)
+        {
+            InputMode mode = strcmp(argv[i], "--record") == 0 ? InputRecord : InputReplay;
+            if (settings.mode != InputLive && settings.mode != mode)
+            {
+                std::cout << "--record and --replay can not be used together" << std::endl;
+                return false;
+            }
+            settings.mode = mode;
+            settings.fileName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--camera-path") == 0)
+            settings.cameraPathFileName = argv[++i];
+        else if (strcmp(argv[i], "--fixed-fps") == 0)
+        {
+            settings.framesPerSecond = atoi(argv[++i]);
+            if (settings.framesPerSecond <= 0)
+            {
+                std::cout << "Invalid value for --fixed-fps, expected frames per second" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void WriteInputEvent(InputRecorder& recorder, uint32_t frame, InputEventType type, uint8_t key, glm::vec2 cursor)
+{
+    recorder.file.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+    recorder.file.write(reinterpret_cast<const char*>(&type), sizeof(type));
+    if (type == InputEventKeyDown || type == InputEventKeyUp)
+        recorder.file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    else if (type == InputEventCursor)
+        recorder.file.write(reinterpret_cast<const char*>(&cursor), sizeof(cursor));
+}
+
+//Copies size bytes at offset, false past the end of the data
+bool ReadInputValue(const std::vector<char>& data, size_t& offset, void* value, size_t size)
+{
+    if (offset + size > data.size())
+        return false;
+    memcpy(value, data.data() + offset, size);
+    offset += size;
+    return true;
+}
+
+bool LoadInputRecording(InputRecorder& recorder)
+{
+    const char* fileName = recorder.settings.fileName.c_str();
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "Could not open input recording " << fileName << std::endl;
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t offset = 0;
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    if (!ReadInputValue(data, offset, &magic, sizeof(magic)) || !ReadInputValue(data, offset, &version, sizeof(version))
+        || !ReadInputValue(data, offset, &recorder.timestep, sizeof(recorder.timestep)) || magic != InputFileMagic || version != InputFileVersion
+        || !(recorder.timestep > 0.0f))
+    {
+        std::cout << fileName << " is not an input recording" << std::endl;
+        return false;
+    }
+
+    while (true)
+    {
+        InputEvent event = {};
+        bool valid = ReadInputValue(data, offset, &event.frame, sizeof(event.frame)) && ReadInputValue(data, offset, &event.type, sizeof(event.type));
+        if (valid && (event.type == InputEventKeyDown || event.type == InputEventKeyUp))
+            valid = ReadInputValue(data, offset, &event.key, sizeof(event.key)) && event.key < InputKeyCount;
+        else if (valid && event.type == InputEventCursor)
+            valid = ReadInputValue(data, offset, &event.cursor, sizeof(event.cursor));
+        valid = valid && event.type <= InputEventEnd && (recorder.events.empty() || event.frame >= recorder.events.back().frame);
+
+        if (!valid)
+        {
+            std::cout << "Input recording " << fileName << " is truncated or damaged" << std::endl;
+            return false;
+        }
+        recorder.events.push_back(event);
+        if (event.type == InputEventEnd)
+            return true;
+    }
+}
+
+bool StartInput(InputRecorder& recorder)
+{
+    recorder.timestep = 1.0f / recorder.settings.framesPerSecond;
+
+    if (!recorder.settings.cameraPathFileName.empty())
+    {
+        if (!LoadCameraPath(recorder.cameraPath, recorder.settings.cameraPathFileName.c_str()))
+            return false;
+        recorder.hasCameraPath = true;
+    }
+
+    if (recorder.settings.mode == InputReplay)
+        return LoadInputRecording(recorder);
+
+    if (recorder.settings.mode == InputRecord)
+    {
+        const char* fileName = recorder.settings.fileName.c_str();
+        recorder.file.open(fileName, std::ios::binary);
+        if (!recorder.file.is_open())
+        {
+            std::cout << "Could not open " << fileName << " for recording" << std::endl;
+            return false;
+        }
+        recorder.file.write(reinterpret_cast<const char*>(&InputFileMagic), sizeof(InputFileMagic));
+        recorder.file.write(reinterpret_cast<const char*>(&InputFileVersion), sizeof(InputFileVersion));
+        recorder.file.write(reinterpret_cast<const char*>(&recorder.timestep), sizeof(recorder.timestep));
+    }
+    return true;
+}
+
+//True when time comes from the frame count instead of the clock
+bool IsInputDeterministic(const InputRecorder& recorder)
+{
+    return recorder.settings.mode != InputLive || recorder.hasCameraPath;
+}
+
+//Start of a frame, before anything reads the input. Polls the keys, or takes them and the
+//cursor moves from the recording when replaying.
+void BeginInputFrame(InputRecorder& recorder, GLFWwindow* window)
+{
+    uint32_t frame = recorder.frame++;
+    recorder.time = static_cast<float>(frame) * recorder.timestep;
+
+    if (recorder.settings.mode == InputReplay)
+    {
+        recorder.cursorMoves.clear();
+        for (; recorder.nextEvent < recorder.events.size() && recorder.events[recorder.nextEvent].frame <= frame; recorder.nextEvent++)
+        {
+            const InputEvent& event = recorder.events[recorder.nextEvent];
+            if (event.type == InputEventKeyDown)
+                recorder.keys |= 1u << event.key;
+            else if (event.type == InputEventKeyUp)
+                recorder.keys &= ~(1u << event.key);
+            else if (event.type == InputEventCursor)
+                recorder.cursorMoves.push_back(event.cursor);
+            else
+                recorder.finished = true;
+        }
+        return;
+    }
+
+    for (int key = 0; key < InputKeyCount; key++)
+    {
+        bool mouseButton = key >= InputMouseLeft;
+        bool down = (mouseButton ? glfwGetMouseButton(window, InputKeyCodes[key]) : glfwGetKey(window, InputKeyCodes[key])) == GLFW_PRESS;
+        bool wasDown = (recorder.keys >> key) & 1;
+        if (down == wasDown)
+            continue;
+
+        recorder.keys ^= 1u << key;
+        if (recorder.settings.mode == InputRecord)
+            WriteInputEvent(recorder, frame, down ? InputEventKeyDown : InputEventKeyUp, static_cast<uint8_t>(key), glm::vec2(0.0f));
+    }
+}
+
+bool IsInputKeyDown(const InputRecorder& recorder, InputKey key)
+{
+    return (recorder.keys >> key) & 1;
+}
+
+//From the cursor callback. Callbacks run while events are polled at the end of a frame, so
+//the move belongs to the frame after it.
+void RecordInputCursor(InputRecorder& recorder, glm::vec2 cursor)
+{
+    if (recorder.settings.mode == InputRecord)
+        WriteInputEvent(recorder, recorder.frame, InputEventCursor, 0, cursor);
+}
+
+void StopInput(InputRecorder& recorder)
+{
+    if (recorder.settings.mode != InputRecord || !recorder.file.is_open())
+        return;
+
+    WriteInputEvent(recorder, recorder.frame, InputEventEnd, 0, glm::vec2(0.0f));
+    recorder.file.close();
+    std::cout << "Recorded " << recorder.frame << " frames of input to " << recorder.settings.fileName << std::endl;
+}
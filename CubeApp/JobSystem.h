@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Counts outstanding jobs so a caller can wait for a group of them
+struct JobCounter
+{
+    std::atomic<int> pending{ 0 };
+};
+
+struct Job
+{
+    std::function<void()> function;
+    //Group the job belongs to, null for jobs nobody waits on
+    JobCounter* counter = nullptr;
+};
+
+struct JobSystem
+{
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+//Runs the oldest job of the counter's group, false when none is queued. Only the group is
+//considered, so a waiting thread never picks up long background work such as chunk meshing.
+bool TryRunJob(JobSystem& jobSystem, const JobCounter& counter)
+{
+    Job job;
+    {
+        std::lock_guard<std::mutex> lock(jobSystem.mutex);
+        auto found = std::find_if(jobSystem.jobs.begin(), jobSystem.jobs.end(), [&counter](const Job& queued) { return queued.counter == &counter; });
+        if (found == jobSystem.jobs.end())
+            return false;
+        job = std::move(*found);
+        jobSystem.jobs.erase(found);
+    }
+    job.function();
+    return true;
+}
+
+void JobWorkerLoop(JobSystem* jobSystem)
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(jobSystem->mutex);
+            jobSystem->wake.wait(lock, [jobSystem] { return jobSystem->stopping || !jobSystem->jobs.empty(); });
+            if (jobSystem->jobs.empty())
+                return;
+            job = std::move(jobSystem->jobs.front());
+            jobSystem->jobs.pop_front();
+        }
+        job.function();
+    }
+}
+
+//Zero threads picks one per hardware thread, keeping one for the render thread. The hardware
+//thread count may be unknown, which is reported as 0.
+void StartJobSystem(JobSystem& jobSystem, unsigned int threadCount = 0)
+{
+    if (threadCount == 0)
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        threadCount = cores > 1 ? cores - 1 : 1;
+    }
+
+    jobSystem.stopping = false;
+    for (unsigned int i = 0; i < threadCount; i++)
+        jobSystem.workers.emplace_back(JobWorkerLoop, &jobSystem);
+}
+
+void StopJobSystem(JobSystem& jobSystem)
+{
+    {
+        std::lock_guard<std::mutex> lock(jobSystem.mutex);
+        jobSystem.stopping = true;
+    }
+    jobSystem.wake.notify_all();
+
+    for (std::thread& worker : jobSystem.workers)
+        worker.join();
+    jobSystem.workers.clear();
+}
+
+void PushJob(JobSystem& jobSystem, std::function<void()> job, JobCounter* counter = nullptr)
+{
+    if (counter != nullptr)
+    {
+        counter->pending++;
+        job = [job = std::move(job), counter]() { job(); counter->pending--; };
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobSystem.mutex);
+        jobSystem.jobs.push_back({ std::move(job), counter });
+    }
+    jobSystem.wake.notify_one();
+}
+
+//The waiting thread helps out with jobs of the same counter, so jobs may wait on jobs they
+//spawned, and a wait lasts no longer than the group's own work
+void WaitForJobs(JobSystem& jobSystem, JobCounter& counter)
+{
+    while (counter.pending.load() > 0)
+    {
+        if (!TryRunJob(jobSystem, counter))
+            std::this_thread::yield();
+    }
+}
+
+//Runs function(begin, end) over [0, count) in chunks of at most grainSize
+void ParallelFor(JobSystem* jobSystem, size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& function)
+{
+    if (jobSystem == nullptr || jobSystem->workers.empty() || count <= grainSize)
+    {
+        function(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    for (size_t begin = grainSize; begin < count; begin += grainSize)
+    {
+        size_t end = std::min(count, begin + grainSize);
+        PushJob(*jobSystem, [&function, begin, end]() { function(begin, end); }, &counter);
+    }
+
+    function(0, grainSize);
+    WaitForJobs(*jobSystem, counter);
+}
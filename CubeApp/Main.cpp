@@ -4,6 +4,9 @@
 #include <GLFW/glfw3.h>
 #include <stb_image.h>
 
+//Headers that include stb_image.h again only get the declarations
+#undef STB_IMAGE_IMPLEMENTATION
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -12,10 +15,36 @@
 #include <algorithm>
 #include <cstdint>
 #include <iomanip>
+#include <numeric>
 
 #include <iostream>
 
 #include "ShaderUtility.h";
+#include "AmbientOcclusion.h"
+#include "Bloom.h"
+#include "ChunkStreamer.h"
+#include "ClusteredLighting.h"
+#include "DeferredShading.h"
+#include "DepthPrepass.h"
+#include "DynamicResolution.h"
+#include "FrameCapture.h"
+#include "GoldenTest.h"
+#include "GpuCulling.h"
+#include "GpuTimer.h"
+#include "HiZ.h"
+#include "InputRecording.h"
+#include "JobSystem.h"
+#include "MeshImporter.h"
+#include "MeshOptimizer.h"
+#include "MeshPool.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "SceneTarget.h"
+#include "StreamBuffer.h"
+#include "StressScene.h"
+#include "ToneMapping.h"
+#include "VoxelEditing.h"
+#include "VoxelWorld.h"
 
 using namespace std;
 
@@ -23,21 +52,30 @@ void InitializeGLFW();
 GLFWwindow* SetupWindow();
 void LoadOpenGL();
 
-void CreateCubeVertexBuffer(GLuint bufferObject);
-void CreatePlaneVertexBuffer(GLuint bufferObject);
-void CreatePlaneIndexBuffer(GLuint bufferObject);
-void SetupCubeVertexArray();
+void SetupMeshPool();
+uint32_t CreateCubeMesh();
+uint32_t CreatePlaneMesh();
+uint32_t AddOptimizedMesh(const char* name, const float* vertexData, size_t floatCount, const uint32_t* indexData, size_t indexCount);
+bool CreateImportedMesh();
 
 void SetupTexture(GLuint texture, const char* fileName);
+std::vector<GLuint> CreateTintedTextures(const char* fileName, int count);
 
-void RenderScene(const GLuint& shader);
+void CreateScene();
+void CreateStressScene();
+void CreateVoxelScene();
+void SetupGpuCulling();
+void UpdateVoxelScene();
+void UpdateVoxelEditing();
+void RenderScene(RenderPass pass, GLuint shader, const glm::mat4& viewProjection, const HiZPyramid* occlusion, bool depthPrepass = false);
 
-void ApplyCubeTransformation(GLuint shader, glm::mat4 cameraView);
+glm::mat4 ApplyCubeTransformation(float time);
 
-void DrawStaticObject(GLuint vertexArrayObject, GLsizei vertexCount, GLuint shader, glm::vec3 position, glm::vec3 orientation, glm::vec3 scale, glm::mat4 cameraView);
+uint32_t AddStaticObject(const DrawCall& draw, glm::vec3 position, glm::vec3 orientation, glm::vec3 scale);
 
 void FramebufferSizeCallback(GLFWwindow* window, int width, int height);
 void MouseCallback(GLFWwindow* window, double xpos, double ypos);
+void UpdateCameraRotation(float xpos, float ypos);
 void UpdateKeybaordInput(GLFWwindow* window);
 
 //Screen
@@ -47,6 +85,24 @@ const unsigned int ScreenHeight = 720;
 const unsigned int ShadowMapWidth = 2048;
 const unsigned int ShadowMapHeight = 2048;
 
+const float CameraNearPlane = 0.1f;
+const float CameraFarPlane = 100.0f;
+
+const int CameraOcclusionWidth = 256;
+const int CameraOcclusionHeight = 128;
+const int LightOcclusionSize = 256;
+
+//Mesh pool sizes in vertices and 16 bit indices, grown when full
+const uint32_t MeshPoolVertexCapacity = 1 << 16;
+const uint32_t MeshPoolIndexCapacity = 1 << 18;
+const size_t MeshDefragmentBytesPerFrame = 1024 * 1024;
+
+//Uniform block binding of LightingBlock, RenderPassUniformBinding is 0
+const GLuint LightingUniformBinding = 1;
+
+const float VoxelEditDistance = 64.0f;
+const VoxelBlock VoxelPlaceBlock = 1;
+
 //Camera
 glm::vec3 _cameraPosition = glm::vec3(2.0f, 0.0f, 3.0f);
 glm::vec3 _cameraForward = glm::vec3(-0.7f, 0.0f, -0.7f);
@@ -64,28 +120,97 @@ float _lastY = (float)ScreenHeight / 2.0;
 //Timeing
 float _deltaTime = 0.0f;
 float _lastFrame = 0.0f;
+bool _deterministicRun = false;
 
-//Buffers
-GLuint _vertexBufferObjectCube;
-GLuint _vertextArrayObjectCube;
+//Input
+InputRecorder _input;
 
-GLuint _vertexBufferObjectPlane;
-GLuint _indexBufferObjectPlane;
-GLuint _vertexArrayObjectFloorPlane;
+//Buffers
+MeshVertexFormat _vertexFormat = MeshVertexCompact;
+MeshPool _meshPool;
+uint32_t _cubeMesh;
+uint32_t _planeMesh;
+MeshImportSettings _meshImport;
+uint32_t _importedMesh = MeshNull;
+glm::vec3 _importedCenter;
+glm::vec3 _importedExtent;
 
 GLuint _depthMapFrameBufferObject;
 
 //Shaders
 GLuint _shaderProgram;
 GLuint _depthShaderProgram;
+GLuint _hiZShaderProgram;
+
+//Occlusion
+HiZPyramid _cameraHiZ;
+HiZPyramid _lightHiZ;
+GpuCulling _gpuCulling;
 
 //Render Textures
 GLuint _depthMap;
 
+//Deferred
+DeferredShading _deferred;
+DepthPrepass _depthPrepass;
+
+//Resolution
+SceneTarget _sceneTarget;
+DynamicResolution _dynamicResolution;
+GpuTimer _frameTimer;
+GpuSpanTimer _resolutionTimer;
+bool _deferredKeyDown = false;
+
+//Ambient Occlusion
+AmbientOcclusion _ambientOcclusion;
+
+//Post Processing
+Bloom _bloom;
+ToneMapping _toneMapping;
+
+//Capture
+FrameCapture _frameCapture;
+bool _captureKeyDown = false;
+GoldenTest _goldenTest;
+
+//Lights
+ClusteredLighting _clusteredLighting;
+
+//Render Queue
+RenderQueue _renderQueue;
+StreamBuffer _streamBuffer;
+GLuint _lightingFallbackBuffer;
+
+//Jobs
+JobSystem _jobSystem;
+
+//Scene
+Scene _scene;
+StressScene _stressScene;
+VoxelWorldSettings _voxelSettings;
+VoxelWorld _voxelWorld;
+ChunkStreamer _chunkStreamer;
+VoxelRemesher _voxelRemesher;
+bool _breakButtonDown = false;
+bool _placeButtonDown = false;
+uint32_t _cubeObject;
+std::vector<uint32_t> _visibleObjects;
+
 //Textures
 GLuint _textureCube;
 
-//Lighting
+//Lighting, std140 layout of the Lighting block in shaderPhong
+struct LightingBlock
+{
+    glm::mat4 lightSpaceMatrix;
+    glm::vec4 lightPos;
+    glm::vec4 lightColor;
+    glm::vec4 viewPos;
+    glm::vec4 clusterScale;
+    glm::vec4 clusterSize;
+    glm::vec4 occlusionSize;
+};
+
 glm::vec3 _lightPos(1.2f, 1.0f, 1.0f);
 glm::vec3 _lightColor(1.0f, 0.95f, 0.85f);
 
@@ -99,43 +224,106 @@ const char* FragmentShaderFileName = "shaderPhong.fs";
 const char* DepthVertexShaderFileName = "shaderDepth.vs";
 const char* DepthFragmentShaderFileName = "shaderDepth.fs";
 
+const char* HiZVertexShaderFileName = "shaderHiZ.vs";
+const char* HiZFragmentShaderFileName = "shaderHiZ.fs";
+
+const char* CullVertexShaderFileName = "shaderCull.vs";
+const char* CullGeometryShaderFileName = "shaderCull.gs";
+
+const char* GBufferVertexShaderFileName = "shaderGBuffer.vs";
+const char* GBufferFragmentShaderFileName = "shaderGBuffer.fs";
+
+const char* FullscreenVertexShaderFileName = "shaderFullscreen.vs";
+
+const char* DeferredFragmentShaderFileName = "shaderDeferred.fs";
+
+const char* ToneMapFragmentShaderFileName = "shaderToneMap.fs";
+
+const char* BloomDownsampleFragmentShaderFileName = "shaderBloomDown.fs";
+const char* BloomUpsampleFragmentShaderFileName = "shaderBloomUp.fs";
+
+const char* SsaoDepthFragmentShaderFileName = "shaderSsaoDepth.fs";
+const char* SsaoFragmentShaderFileName = "shaderSsao.fs";
+const char* SsaoBlurFragmentShaderFileName = "shaderSsaoBlur.fs";
+
 const char* CubeTextureFileName = "Pilotage-Stretcher-Architextures.jpg";
 
-int main() 
+int main(int argc, char** argv)
 {
+    if (!ParseStressSceneArguments(argc, argv, _stressScene.settings) || !ParseVoxelWorldArguments(argc, argv, _voxelSettings)
+        || !ParseChunkStreamerArguments(argc, argv, _chunkStreamer.settings) || !ParseStreamBufferArguments(argc, argv, _streamBuffer.settings)
+        || !ParseVertexFormatArguments(argc, argv, _vertexFormat) || !ParseMeshImportArguments(argc, argv, _meshImport)
+        || !ParseRenderQueueArguments(argc, argv, _renderQueue) || !ParseGpuCullingArguments(argc, argv, _gpuCulling.settings)
+        || !ParseDeferredArguments(argc, argv, _deferred.settings) || !ParseDepthPrepassArguments(argc, argv, _depthPrepass.mode)
+        || !ParseDynamicResolutionArguments(argc, argv, _dynamicResolution.settings) || !ParseAmbientOcclusionArguments(argc, argv, _ambientOcclusion.settings)
+        || !ParseBloomArguments(argc, argv, _bloom.settings) || !ParseFrameCaptureArguments(argc, argv, _frameCapture.settings)
+        || !ParseGoldenArguments(argc, argv, _goldenTest.settings) || !ParseInputArguments(argc, argv, _input.settings))
+        return 1;
+
+    //Streaming implies the voxel world
+    _voxelSettings.enabled = _voxelSettings.enabled || _chunkStreamer.settings.enabled;
+    if (_voxelSettings.enabled && _stressScene.settings.enabled)
+    {
+        std::cout << "--stress can not be combined with the voxel world" << std::endl;
+        return 1;
+    }
+
+    //Golden images are named after the scene unless told otherwise
+    if (_goldenTest.settings.enabled && _goldenTest.settings.name.empty())
+        _goldenTest.settings.name = _stressScene.settings.enabled ? "stress" : _voxelSettings.enabled ? "voxel" : "scene";
+
+    //Golden images, recordings, replays and camera paths are compared between runs, anything
+    //steered by measured GPU time or by which readbacks have finished would make their frames
+    //differ
+    _deterministicRun = _goldenTest.settings.enabled || _input.settings.mode != InputLive || !_input.settings.cameraPathFileName.empty();
+    if (_deterministicRun)
+    {
+        if (_dynamicResolution.settings.enabled)
+            std::cout << "Dynamic resolution is off for a deterministic run" << std::endl;
+        _dynamicResolution.settings.enabled = false;
+
+        //Switches on sample counts read back whenever the GPU has finished them
+        if (_depthPrepass.mode == DepthPrepassAuto)
+            _depthPrepass.mode = DepthPrepassOff;
+    }
+
+    //Input, loaded before any thread is started
+    if (!StartInput(_input))
+        return 1;
+
     InitializeGLFW();
     GLFWwindow* window = SetupWindow();
     LoadOpenGL();
 
+    StartJobSystem(_jobSystem);
+
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     //Depth Test
     glEnable(GL_DEPTH_TEST);
 
-    //Generate Buffers
-    glGenBuffers(1, &_vertexBufferObjectCube);
-    glGenBuffers(1, &_vertexBufferObjectPlane);
-    glGenBuffers(1, &_indexBufferObjectPlane);
+    //Per frame data
+    CreateStreamBuffer(_streamBuffer, _streamBuffer.settings);
+    glGenBuffers(1, &_lightingFallbackBuffer);
 
-    //Generate Arrays
-    glGenVertexArrays(1, &_vertextArrayObjectCube);
-    glGenVertexArrays(1, &_vertexArrayObjectFloorPlane);
+    //Meshes
+    SetupMeshPool();
+    _cubeMesh = CreateCubeMesh();
+    _planeMesh = CreatePlaneMesh();
+    if (!CreateImportedMesh())
+    {
+        StopJobSystem(_jobSystem);
+        glfwTerminate();
+        return 1;
+    }
 
     //Generate Textures
     glGenTextures(1, &_textureCube);
 
-    CreateCubeVertexBuffer(_vertexBufferObjectCube);
-    glBindVertexArray(_vertextArrayObjectCube);
-
-    SetupCubeVertexArray();
-
-    CreatePlaneVertexBuffer(_vertexBufferObjectPlane);    
-    glBindVertexArray(_vertexArrayObjectFloorPlane);
-    CreatePlaneIndexBuffer(_indexBufferObjectPlane);
-    SetupCubeVertexArray();
-
     SetupTexture(_textureCube, CubeTextureFileName);
 
+    CreateScene();
+
     //Configure Depth Map
     glGenFramebuffers(1, &_depthMapFrameBufferObject);
 
@@ -155,11 +343,20 @@ int main()
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    //Configure Occlusion
+    CreateHiZPyramid(_cameraHiZ, CameraOcclusionWidth, CameraOcclusionHeight);
+    CreateHiZPyramid(_lightHiZ, LightOcclusionSize, LightOcclusionSize);
+    _cameraHiZ.fixedLatency = _deterministicRun;
+    _lightHiZ.fixedLatency = _deterministicRun;
+
     //Cube Shader
     _shaderProgram = CompileShaders(VertexShaderFileName, FragmentShaderFileName);
     glUseProgram(_shaderProgram);
     glUniform1i(glGetUniformLocation(_shaderProgram, "texture1"), 0);
     glUniform1i(glGetUniformLocation(_shaderProgram, "shadowMap"), 1);
+    glUniformBlockBinding(_shaderProgram, glGetUniformBlockIndex(_shaderProgram, "Lighting"), LightingUniformBinding);
+    SetClusteredLightingSamplers(_shaderProgram);
+    CreateClusteredLighting(_clusteredLighting);
 
 
     //Depth Shader
@@ -167,6 +364,49 @@ int main()
     glUseProgram(_depthShaderProgram);
     glUniform1i(glGetUniformLocation(_shaderProgram, "depthMap"), 0);
 
+    //Hi-Z Shader
+    _hiZShaderProgram = CompileShaders(HiZVertexShaderFileName, HiZFragmentShaderFileName);
+    glUseProgram(_hiZShaderProgram);
+    glUniform1i(glGetUniformLocation(_hiZShaderProgram, "source"), 0);
+
+    //Deferred Shaders
+    CreateDeferredShading(_deferred, ScreenWidth, ScreenHeight, GBufferVertexShaderFileName, GBufferFragmentShaderFileName,
+        FullscreenVertexShaderFileName, DeferredFragmentShaderFileName, LightingUniformBinding);
+
+    //Depth Prepass
+    CreateDepthPrepass(_depthPrepass);
+
+    //HDR Scene Target, tone mapped into the back buffer
+    CreateSceneTarget(_sceneTarget, ScreenWidth, ScreenHeight, GL_RGBA16F);
+    CreateBloom(_bloom, ScreenWidth, ScreenHeight, FullscreenVertexShaderFileName, BloomDownsampleFragmentShaderFileName, BloomUpsampleFragmentShaderFileName);
+    CreateToneMapping(_toneMapping, FullscreenVertexShaderFileName, ToneMapFragmentShaderFileName);
+    CreateGoldenTest(_goldenTest, ScreenWidth, ScreenHeight);
+
+    //Dynamic Resolution
+    CreateGpuTimer(_frameTimer);
+    CreateGpuSpanTimer(_resolutionTimer);
+    if (_dynamicResolution.settings.enabled)
+        CreateDynamicResolution(_dynamicResolution, ScreenWidth, ScreenHeight);
+
+    //Ambient Occlusion
+    if (_ambientOcclusion.settings.enabled)
+        CreateAmbientOcclusion(_ambientOcclusion, ScreenWidth, ScreenHeight, FullscreenVertexShaderFileName,
+            SsaoDepthFragmentShaderFileName, SsaoFragmentShaderFileName, SsaoBlurFragmentShaderFileName);
+    SetAmbientOcclusionSamplers(_shaderProgram);
+    SetAmbientOcclusionSamplers(_deferred.lightingProgram);
+
+    //GPU Culling
+    if (_gpuCulling.settings.enabled)
+        SetupGpuCulling();
+
+    //Capture, last of the fallible setup so no writer thread is left running on failure
+    if (!StartFrameCapture(_frameCapture, ScreenWidth, ScreenHeight))
+    {
+        StopJobSystem(_jobSystem);
+        glfwTerminate();
+        return 1;
+    }
+
     //Render Loop
     while (!glfwWindowShouldClose(window))
     {
@@ -175,12 +415,64 @@ int main()
         _deltaTime = currentFrame - _lastFrame;
         _lastFrame = currentFrame;
 
-        //Input
-        UpdateKeybaordInput(window);
+        //Golden images use the time and camera of their pose instead of the clock and input
+        if (_goldenTest.settings.enabled)
+        {
+            const GoldenPose& pose = GetGoldenPose(_goldenTest);
+            currentFrame = pose.time;
+            _deltaTime = 0.0f;
+            _cameraPosition = pose.position;
+            _cameraForward = glm::normalize(pose.forward);
+            _playerForward = _cameraForward;
+        }
+        else
+        {
+            //Recorded, replayed and camera path runs step a fixed time every frame
+            BeginInputFrame(_input, window);
+            if (IsInputDeterministic(_input))
+            {
+                currentFrame = _input.time;
+                _deltaTime = _input.timestep;
+            }
+            for (glm::vec2 cursor : _input.cursorMoves)
+                UpdateCameraRotation(cursor.x, cursor.y);
+            UpdateKeybaordInput(window);
+
+            //A camera path overrides the camera and ends the run after its last key
+            if (_input.hasCameraPath)
+            {
+                if (!SampleCameraPath(_input.cameraPath, _input.time, _cameraPosition, _cameraForward))
+                    _input.finished = true;
+                _playerForward = glm::vec3(_cameraForward.x, 0.0f, _cameraForward.z);
+            }
+            if (_input.finished)
+                glfwSetWindowShouldClose(window, true);
+        }
+
+        //Animate
+        if (_stressScene.settings.enabled)
+            UpdateStressScene(_stressScene, _scene, currentFrame, &_jobSystem);
+        else if (_voxelSettings.enabled)
+            UpdateVoxelScene();
+        else
+            SetObjectTransform(_scene, _cubeObject, ApplyCubeTransformation(currentFrame));
+
+        //Compact the mesh pool a little every frame
+        DefragmentMeshPool(_meshPool, MeshDefragmentBytesPerFrame);
+
+        //Waits if the GPU still reads the oldest region
+        BeginStreamFrame(_streamBuffer);
+
+        //Picks this frame's resolution and ambient occlusion quality from the GPU time of earlier frames
+        BeginGpuTimer(_frameTimer);
+        BeginGpuSpanTimerFrame(_resolutionTimer);
+        if (_resolutionTimer.updated && _dynamicResolution.settings.enabled)
+            UpdateDynamicResolutionScale(_dynamicResolution, _resolutionTimer.milliseconds, _resolutionTimer.tag);
+        if (_frameTimer.updated && _ambientOcclusion.settings.enabled && !_deterministicRun)
+            UpdateAmbientOcclusionBudget(_ambientOcclusion, _frameTimer.milliseconds);
 
         //Clear
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         //Render Depth
         glm::mat4 lightProjection;
@@ -190,47 +482,159 @@ int main()
         lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
         lightView = glm::lookAt(_lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
         lightSpaceMatrix = lightProjection * lightView;
-        glUseProgram(_depthShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(_depthShaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-
-        glViewport(0, 0, ShadowMapWidth, ShadowMapHeight);
-        glBindFramebuffer(GL_FRAMEBUFFER, _depthMapFrameBufferObject);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        RenderScene(_depthShaderProgram);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        //Reset and Clear
-        glViewport(0, 0, ScreenWidth, ScreenHeight);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        //Shader
-        glUseProgram(_shaderProgram);
+        RenderPassState& shadowPass = _renderQueue.passes[RenderPassShadow];
+        shadowPass.framebuffer = _depthMapFrameBufferObject;
+        shadowPass.viewport = glm::ivec4(0, 0, ShadowMapWidth, ShadowMapHeight);
+        shadowPass.clearMask = GL_DEPTH_BUFFER_BIT;
+        shadowPass.view = lightView;
+        shadowPass.projection = lightProjection;
+        shadowPass.farPlane = far_plane;
+
+        //Camera, into the scene target, with dynamic resolution only a part of it
+        GLuint sceneFramebuffer = _sceneTarget.framebuffer;
+        glm::ivec4 sceneViewport = _dynamicResolution.settings.enabled ? GetDynamicResolutionViewport(_dynamicResolution) : glm::ivec4(0, 0, ScreenWidth, ScreenHeight);
+
+        RenderPassState& opaquePass = _renderQueue.passes[RenderPassOpaque];
+        opaquePass = RenderPassState();
+        //The deferred path fills the G-buffer instead and lights it afterwards
+        opaquePass.framebuffer = _deferred.settings.enabled ? _deferred.framebuffer : sceneFramebuffer;
+        opaquePass.viewport = sceneViewport;
+        opaquePass.clearMask = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
+        opaquePass.view = glm::lookAt(_cameraPosition, _cameraPosition + _cameraForward, _worldUp);
+        opaquePass.projection = glm::perspective(glm::radians(45.0f), (float)ScreenWidth / (float)ScreenHeight, CameraNearPlane, CameraFarPlane);
+        opaquePass.farPlane = CameraFarPlane;
+
+        RenderPassState& transparentPass = _renderQueue.passes[RenderPassTransparent];
+        transparentPass = opaquePass;
+        transparentPass.clearMask = 0;
+
+        glm::mat4 cameraViewProjection = opaquePass.projection * opaquePass.view;
+
+        //Occluders
+        RenderPassState& cameraOccluderPass = _renderQueue.passes[RenderPassCameraOccluders];
+        cameraOccluderPass = opaquePass;
+        cameraOccluderPass.framebuffer = _cameraHiZ.occluderFramebuffer;
+        cameraOccluderPass.viewport = glm::ivec4(0, 0, CameraOcclusionWidth, CameraOcclusionHeight);
+        cameraOccluderPass.clearMask = GL_DEPTH_BUFFER_BIT;
+
+        RenderPassState& lightOccluderPass = _renderQueue.passes[RenderPassLightOccluders];
+        lightOccluderPass = shadowPass;
+        lightOccluderPass.framebuffer = _lightHiZ.occluderFramebuffer;
+        lightOccluderPass.viewport = glm::ivec4(0, 0, LightOcclusionSize, LightOcclusionSize);
+
+        //Depth prepass, decided from the overdraw measured a few frames ago. Forward ambient
+        //occlusion needs the camera depth before shading, so it keeps the prepass on.
+        bool forwardOcclusion = _ambientOcclusion.settings.enabled && !_deferred.settings.enabled;
+        _depthPrepass.required = forwardOcclusion;
+        UpdateDepthPrepass(_depthPrepass, static_cast<uint64_t>(opaquePass.viewport.z) * opaquePass.viewport.w);
+        SetupDepthPrepass(_depthPrepass, _renderQueue);
+
+        //Point lights
+        UpdateClusteredLighting(_clusteredLighting, _scene.lights, opaquePass.view, opaquePass.projection, CameraNearPlane, CameraFarPlane, &_jobSystem);
+
+        if (_ambientOcclusion.settings.enabled)
+            BeginAmbientOcclusionFrame(_ambientOcclusion, sceneViewport);
 
         //Lighting
-        glUniform3fv(glGetUniformLocation(_shaderProgram, "lightColor"), 1, glm::value_ptr(_lightColor));
-        glUniform3fv(glGetUniformLocation(_shaderProgram, "lightPos"), 1, glm::value_ptr(_lightPos));
-        glUniform3fv(glGetUniformLocation(_shaderProgram, "viewPos"), 1, glm::value_ptr(_cameraPosition));
-        glUniformMatrix4fv(glGetUniformLocation(_shaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+        LightingBlock lightingBlock;
+        lightingBlock.lightSpaceMatrix = lightSpaceMatrix;
+        lightingBlock.lightPos = glm::vec4(_lightPos, 1.0f);
+        lightingBlock.lightColor = glm::vec4(_lightColor, 1.0f);
+        lightingBlock.viewPos = glm::vec4(_cameraPosition, 1.0f);
+        lightingBlock.clusterScale = GetClusterScale(_clusteredLighting, glm::ivec2(opaquePass.viewport.z, opaquePass.viewport.w));
+        lightingBlock.clusterSize = GetClusterSize(_clusteredLighting);
+        lightingBlock.occlusionSize = GetAmbientOcclusionSize(_ambientOcclusion);
+
+        GLintptr lightingOffset = 0;
+        LightingBlock* lighting = static_cast<LightingBlock*>(AllocateStreamUniforms(_streamBuffer, sizeof(LightingBlock), lightingOffset));
+        if (lighting != nullptr)
+        {
+            *lighting = lightingBlock;
+            glBindBufferRange(GL_UNIFORM_BUFFER, LightingUniformBinding, _streamBuffer.buffer, lightingOffset, sizeof(LightingBlock));
+        }
+        else
+        {
+            //The ring is full this frame and grows for the next, offset 0 may belong to a frame
+            //the GPU is still reading
+            glBindBuffer(GL_UNIFORM_BUFFER, _lightingFallbackBuffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(LightingBlock), &lightingBlock, GL_STREAM_DRAW);
+            glBindBufferBase(GL_UNIFORM_BUFFER, LightingUniformBinding, _lightingFallbackBuffer);
+        }
 
         //Texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _textureCube);
+        BindClusteredLighting(_clusteredLighting);
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, _depthMap);
 
-        
         //Render
-        RenderScene(_shaderProgram);
+        ClearRenderQueue(_renderQueue);
+
+        //The camera passes follow the shadow pass, their cost scales with the resolution
+        _renderQueue.afterPass[RenderPassShadow] = [&]() { BeginGpuSpan(_resolutionTimer); };
+        _renderQueue.afterPass[RenderPassTransparent] = [&]() { EndGpuSpan(_resolutionTimer); };
+        if (forwardOcclusion)
+        {
+            //Between the prepass and the opaque pass, which upsamples the result
+            _renderQueue.afterPass[RenderPassDepthPrepass] = [&]()
+            {
+                RenderAmbientOcclusion(_ambientOcclusion, _sceneTarget.depthTexture, sceneViewport, opaquePass.projection);
+            };
+        }
+        RenderScene(RenderPassCameraOccluders, _depthShaderProgram, cameraViewProjection, nullptr);
+        RenderScene(RenderPassLightOccluders, _depthShaderProgram, lightSpaceMatrix, nullptr);
+        RenderScene(RenderPassShadow, _depthShaderProgram, lightSpaceMatrix, &_lightHiZ);
+        GLuint opaqueProgram = _deferred.settings.enabled ? _deferred.geometryProgram : _shaderProgram;
+        RenderScene(RenderPassOpaque, opaqueProgram, cameraViewProjection, &_cameraHiZ, _depthPrepass.enabled);
+        if (!_gpuCulling.groups.empty())
+        {
+            UpdateGpuCulling(_gpuCulling, _scene, _meshPool, _streamBuffer);
+            RunGpuCulling(_gpuCulling, _renderQueue, GpuCullingLight, RenderPassShadow, _depthShaderProgram, lightSpaceMatrix, &_lightHiZ);
+            RunGpuCulling(_gpuCulling, _renderQueue, GpuCullingCamera, RenderPassOpaque, opaqueProgram, cameraViewProjection, &_cameraHiZ);
+            if (_depthPrepass.enabled)
+                SubmitGpuCullingDraws(_gpuCulling, _renderQueue, GpuCullingCamera, RenderPassDepthPrepass, _depthShaderProgram);
+        }
+        SortRenderQueue(_renderQueue);
+        ExecuteRenderQueue(_renderQueue, _streamBuffer);
+        EndDepthPrepassFrame(_depthPrepass);
+
+        //Deferred lighting and post processing scale with the resolution too
+        BeginGpuSpan(_resolutionTimer);
+        if (_deferred.settings.enabled && _ambientOcclusion.settings.enabled)
+            RenderAmbientOcclusion(_ambientOcclusion, _deferred.depthTexture, sceneViewport, opaquePass.projection);
+        if (_deferred.settings.enabled)
+            RenderDeferredLighting(_deferred, sceneFramebuffer, opaquePass.viewport, opaquePass.view, opaquePass.projection);
+
+        //Post processing, into the back buffer
+        RenderBloom(_bloom, _sceneTarget, sceneViewport);
+        RenderToneMapping(_toneMapping, _sceneTarget, sceneViewport, _dynamicResolution.settings.sharpness, _bloom,
+            GetGoldenFramebuffer(_goldenTest), glm::ivec4(0, 0, ScreenWidth, ScreenHeight));
+        EndGpuSpan(_resolutionTimer);
+        if (_goldenTest.settings.enabled && !UpdateGoldenTest(_goldenTest, ScreenWidth, ScreenHeight))
+            glfwSetWindowShouldClose(window, true);
+        CaptureFrame(_frameCapture);
+        EndStreamFrame(_streamBuffer);
+
+        //Occlusion for the coming frames
+        UpdateHiZPyramid(_cameraHiZ, _hiZShaderProgram, cameraViewProjection);
+        UpdateHiZPyramid(_lightHiZ, _hiZShaderProgram, lightSpaceMatrix);
+
+        EndGpuSpanTimerFrame(_resolutionTimer, _dynamicResolution.scale);
+        EndGpuTimer(_frameTimer);
 
         //Swap buffer
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    StopInput(_input);
+    StopFrameCapture(_frameCapture);
+    StopJobSystem(_jobSystem);
+
     //Terminate glfw
     glfwTerminate();
 
-	return 0;
+	return _goldenTest.failedCount > 0 ? 1 : 0;
 }
 
 void InitializeGLFW()
@@ -240,6 +644,10 @@ void InitializeGLFW()
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+    //Golden images render without showing a window
+    if (_goldenTest.settings.enabled)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
@@ -268,9 +676,16 @@ void LoadOpenGL()
         std::cout << "Failed to initialize GLAD" << std::endl;
         exit(1);
     }
+    LoadBufferStorage((GLADloadproc)glfwGetProcAddress);
+}
+
+void SetupMeshPool()
+{
+    CreateMeshPool(_meshPool, _vertexFormat, MeshPoolVertexCapacity, MeshPoolIndexCapacity);
+    _renderQueue.meshPool = &_meshPool;
 }
 
-void CreateCubeVertexBuffer(GLuint bufferObject)
+uint32_t CreateCubeMesh()
 {
     //copied from: https://learnopengl.com/code_viewer_gh.php?code=src/2.lighting/4.2.lighting_maps_specular_map/lighting_maps_specular.cpp
     float vertices[] = 
@@ -319,11 +734,10 @@ void CreateCubeVertexBuffer(GLuint bufferObject)
         -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f
     };
 
-    glBindBuffer(GL_ARRAY_BUFFER, bufferObject);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    return AddOptimizedMesh("Cube mesh", vertices, sizeof(vertices) / sizeof(float), nullptr, 0);
 }
 
-void CreatePlaneVertexBuffer(GLuint bufferObject) 
+uint32_t CreatePlaneMesh()
 {
     float vertices[] = 
     {
@@ -333,35 +747,47 @@ void CreatePlaneVertexBuffer(GLuint bufferObject)
         -0.5f,  0.5f, 0.0f,   0.0f,  0.0f, -1.0f,   0.0f, 1.0f
     };
 
-    glBindBuffer(GL_ARRAY_BUFFER, bufferObject);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-}
-
-void CreatePlaneIndexBuffer(GLuint bufferObject) 
-{
-    unsigned int indices[] = 
+    uint32_t indices[] =
     {
         0, 1, 3, 
         1, 2, 3  
     };
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferObject);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    return AddOptimizedMesh("Plane mesh", vertices, sizeof(vertices) / sizeof(float), indices, 6);
 }
 
-void SetupCubeVertexArray() 
+//Unindexed when indices is null
+uint32_t AddOptimizedMesh(const char* name, const float* vertexData, size_t floatCount, const uint32_t* indexData, size_t indexCount)
 {
-    //Position Attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    //Color Attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    //Texture Attribute
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-
-    glBindVertexArray(0);
+    const int vertexFloats = MeshSourceVertexFloats;
+    std::vector<float> vertices(vertexData, vertexData + floatCount);
+    std::vector<uint32_t> indices(indexData, indexData + indexCount);
+    if (indexData == nullptr)
+    {
+        indices.resize(floatCount / vertexFloats);
+        std::iota(indices.begin(), indices.end(), 0);
+    }
+
+    PrintMeshOptimizeReport(name, OptimizeMesh(vertices, vertexFloats, indices));
+
+    return AddMesh(_meshPool, vertices.data(), static_cast<uint32_t>(vertices.size() / vertexFloats), indices.data(), static_cast<uint32_t>(indices.size()));
+}
+
+//--mesh, loaded through the binary mesh so later runs skip the import
+bool CreateImportedMesh()
+{
+    if (_meshImport.path.empty())
+        return true;
+
+    LoadedMesh mesh;
+    if (!LoadMeshFile(_meshImport, &_jobSystem, mesh))
+        return false;
+
+    _importedMesh = AddMesh(_meshPool, mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount);
+    _importedCenter = (mesh.minimum + mesh.maximum) * 0.5f;
+    _importedExtent = (mesh.maximum - mesh.minimum) * 0.5f;
+    UnloadMesh(mesh);
+    return true;
 }
 
 void SetupTexture(GLuint texture, const char* fileName) 
@@ -399,72 +825,244 @@ void SetupTexture(GLuint texture, const char* fileName)
     stbi_image_free(data);
 }
 
-void RenderScene(const GLuint& shader)
+//Copies of the texture with evenly spaced hue tints, so the material keys vary
+std::vector<GLuint> CreateTintedTextures(const char* fileName, int count)
+{
+    std::vector<GLuint> textures(count);
+    glGenTextures(count, textures.data());
+
+    int width;
+    int height;
+    int nrChannels;
+    unsigned char* data = stbi_load(fileName, &width, &height, &nrChannels, 3);
+    if (!data)
+    {
+        std::cout << "Failed to load texture" << std::endl;
+        return textures;
+    }
+
+    std::vector<unsigned char> tinted(static_cast<size_t>(width) * height * 3);
+    for (int i = 0; i < count; i++)
+    {
+        float hue = static_cast<float>(i) / static_cast<float>(count);
+        glm::vec3 tint = glm::clamp(glm::abs(glm::fract(glm::vec3(hue) + glm::vec3(1.0f, 2.0f / 3.0f, 1.0f / 3.0f)) * 6.0f - 3.0f) - 1.0f, 0.0f, 1.0f);
+        tint = glm::mix(glm::vec3(1.0f), tint, 0.6f);
+
+        for (size_t texel = 0; texel < tinted.size(); texel += 3)
+        {
+            for (int channel = 0; channel < 3; channel++)
+                tinted[texel + channel] = static_cast<unsigned char>(data[texel + channel] * tint[channel]);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, tinted.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    stbi_image_free(data);
+    return textures;
+}
+
+void CreateScene()
 {
-    //Camera transformation
-    glm::mat4 view = glm::lookAt(_cameraPosition, _cameraPosition + _cameraForward, _worldUp);
-
-    //Draw Cube
-    ApplyCubeTransformation(shader, view);
-    glBindVertexArray(_vertextArrayObjectCube);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-
-    //Draw Planes
-    DrawStaticObject(_vertexArrayObjectFloorPlane, 6, shader, glm::vec3(0.0f, 1.5f, -4.0), glm::vec3(glm::pi<float>(), 0.0f, 0.0f), glm::vec3(5.0f, 5.0, 1.0f), view);
-    DrawStaticObject(_vertexArrayObjectFloorPlane, 6, shader, glm::vec3(-2.5f, 1.5f, -1.5), glm::vec3(glm::pi<float>(), -0.5f * glm::pi<float>(), 0.0f), glm::vec3(5.0f, 5.0, 5.0f), view);
-    DrawStaticObject(_vertexArrayObjectFloorPlane, 6, shader, glm::vec3(0.0f, -1.0f, -1.5), glm::vec3(0.5f * glm::pi<float>(), 0.0f, 0.0f), glm::vec3(5.0f, 5.0, 5.0f), view);
+    if (_stressScene.settings.enabled)
+    {
+        CreateStressScene();
+        BuildSceneBvh(_scene, &_jobSystem);
+        return;
+    }
+
+    if (_voxelSettings.enabled)
+    {
+        CreateVoxelScene();
+        BuildSceneBvh(_scene, &_jobSystem);
+        return;
+    }
+
+    //Cube
+    DrawCall cube = MakeMeshDrawCall(_meshPool, _cubeMesh);
+    _cubeObject = AddSceneObject(_scene, cube, _textureCube, ApplyCubeTransformation(0.0f), glm::vec3(0.0f), glm::vec3(0.5f));
+
+    //Planes
+    DrawCall plane = MakeMeshDrawCall(_meshPool, _planeMesh);
+    AddStaticObject(plane, glm::vec3(0.0f, 1.5f, -4.0), glm::vec3(glm::pi<float>(), 0.0f, 0.0f), glm::vec3(5.0f, 5.0, 1.0f));
+    AddStaticObject(plane, glm::vec3(-2.5f, 1.5f, -1.5), glm::vec3(glm::pi<float>(), -0.5f * glm::pi<float>(), 0.0f), glm::vec3(5.0f, 5.0, 5.0f));
+    AddStaticObject(plane, glm::vec3(0.0f, -1.0f, -1.5), glm::vec3(0.5f * glm::pi<float>(), 0.0f, 0.0f), glm::vec3(5.0f, 5.0, 5.0f));
+
+    //Imported mesh, scaled to fit and standing on the floor next to the cube
+    if (_importedMesh != MeshNull)
+    {
+        float largest = std::max(std::max(_importedExtent.x, _importedExtent.y), _importedExtent.z);
+        float scale = largest > 0.0f ? 0.75f / largest : 1.0f;
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(1.25f, -1.0f + _importedExtent.y * scale, -2.5f));
+        model = glm::scale(model, glm::vec3(scale));
+        model = glm::translate(model, -_importedCenter);
+        AddSceneObject(_scene, MakeMeshDrawCall(_meshPool, _importedMesh), _textureCube, model, _importedCenter, _importedExtent);
+    }
+
+    BuildSceneBvh(_scene, &_jobSystem);
 }
 
-void ApplyCubeTransformation(GLuint shader, glm::mat4 cameraView)
+void CreateStressScene()
 {
-    //Reset
-    glm::mat4 model = glm::mat4(1.0f);
-    glm::mat4 view = glm::mat4(1.0f);
-    glm::mat4 projection = glm::mat4(1.0f);
+    DrawCall cube = MakeMeshDrawCall(_meshPool, _cubeMesh);
 
-    //Model
-    glm::mat4 translation = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.0f));
-    glm::mat4 rotation = glm::eulerAngleXYZ(0.6f, -1.0f, -0.8f);
-    model = translation * rotation;
-    model = glm::rotate(model, (float)glfwGetTime(), glm::vec3(0.6f, -0.3f, 0.3f));
+    std::vector<GLuint> textures = { _textureCube };
+    if (_stressScene.settings.textureCount > 1)
+        textures = CreateTintedTextures(CubeTextureFileName, _stressScene.settings.textureCount);
+
+    GenerateStressScene(_stressScene, _scene, cube, textures);
+
+    //Floor below the cubes, the main occluder
+    DrawCall plane = MakeMeshDrawCall(_meshPool, _planeMesh);
+    float size = _stressScene.extent * 2.0f + StressCubeSpacing * 4.0f;
+    AddStaticObject(plane, glm::vec3(0.0f, -_stressScene.extent - StressCubeSpacing, 0.0f), glm::vec3(0.5f * glm::pi<float>(), 0.0f, 0.0f), glm::vec3(size, size, size));
+
+    std::cout << "Stress scene: " << _stressScene.settings.cubeCount << " cubes, " << _stressScene.movers.size() << " moving, "
+        << textures.size() << " textures, " << _scene.lights.size() << " lights" << std::endl;
+}
+
+void CreateVoxelScene()
+{
+    _voxelWorld.texture = _textureCube;
+    _voxelWorld.meshPool = &_meshPool;
+
+    //Start above the terrain
+    _cameraPosition = glm::vec3(0.0f, static_cast<float>(_voxelSettings.chunkHeight * ChunkSize) + 4.0f, 0.0f);
+
+    if (_chunkStreamer.settings.enabled)
+    {
+        _chunkStreamer.chunkHeight = _voxelSettings.chunkHeight;
+        _chunkStreamer.seed = _voxelSettings.seed;
+        std::cout << "Streaming voxel world: radius " << _chunkStreamer.settings.radius << " chunks, budget "
+            << _chunkStreamer.settings.memoryBudget / (1024 * 1024) << " MB" << std::endl;
+        return;
+    }
+
+    GenerateVoxelTerrain(_voxelWorld, _voxelSettings.chunkRadius, _voxelSettings.chunkHeight, _voxelSettings.seed);
+    UpdateVoxelMeshes(_voxelWorld, _scene, &_jobSystem);
+
+    std::cout << "Voxel world: " << _voxelWorld.chunks.size() << " chunks, " << _voxelWorld.quadCount << " quads, "
+        << VoxelWorldBytes(_voxelWorld) / 1024 << " KB of blocks" << std::endl;
+}
+
+void SetupGpuCulling()
+{
+    //Chunks are rebuilt and replaced all the time, instances would need rebuilding with them
+    if (_voxelSettings.enabled)
+    {
+        std::cout << "GPU culling is not supported in the voxel world, culling on the CPU" << std::endl;
+        return;
+    }
+
+    CreateGpuCullingProgram(_gpuCulling, CullVertexShaderFileName, CullGeometryShaderFileName);
 
-    //View
-    view = cameraView;
+    std::vector<uint32_t> dynamicObjects;
+    if (_stressScene.settings.enabled)
+    {
+        for (const StressMover& mover : _stressScene.movers)
+            dynamicObjects.push_back(mover.object);
+    }
+    else
+        dynamicObjects.push_back(_cubeObject);
+
+    BuildGpuCulling(_gpuCulling, _scene, _meshPool, dynamicObjects);
+}
+
+void UpdateVoxelScene()
+{
+    if (_chunkStreamer.settings.enabled)
+        UpdateChunkStreamer(_chunkStreamer, _voxelWorld, _scene, _cameraPosition, _cameraForward, _jobSystem);
 
-    //Projection
-    projection = glm::perspective(glm::radians(45.0f), (float)ScreenWidth / (float)ScreenHeight, 0.1f, 100.0f);
+    UpdateVoxelEditing();
+    UpdateVoxelRemesher(_voxelRemesher, _voxelWorld, _scene, _jobSystem);
+}
 
-    //Pass to shader
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+void UpdateVoxelEditing()
+{
+    //Left click breaks and right click places, once per press
+    bool breakDown = IsInputKeyDown(_input, InputMouseLeft);
+    bool placeDown = IsInputKeyDown(_input, InputMouseRight);
+    bool breakPressed = breakDown && !_breakButtonDown;
+    bool placePressed = placeDown && !_placeButtonDown;
+    _breakButtonDown = breakDown;
+    _placeButtonDown = placeDown;
+
+    if (!breakPressed && !placePressed)
+        return;
+
+    VoxelHit hit;
+    if (!RaycastVoxels(_voxelWorld, _cameraPosition, _cameraForward, VoxelEditDistance, hit))
+        return;
+
+    if (breakPressed)
+        EditVoxel(_voxelWorld, hit.block, VoxelAir);
+    else
+        EditVoxel(_voxelWorld, hit.block + hit.normal, VoxelPlaceBlock);
 }
 
-void DrawStaticObject(GLuint vertexArrayObject, GLsizei vertexCount, GLuint shader, glm::vec3 position, glm::vec3 orientation, glm::vec3 scale, glm::mat4 cameraView)
+//With depthPrepass every object is also drawn depth only into RenderPassDepthPrepass
+void RenderScene(RenderPass pass, GLuint shader, const glm::mat4& viewProjection, const HiZPyramid* occlusion, bool depthPrepass)
 {
-    //Reset
-    glm::mat4 model = glm::mat4(1.0f);
-    glm::mat4 view = glm::mat4(1.0f);
-    glm::mat4 projection = glm::mat4(1.0f);
+    bool occluderPass = pass == RenderPassCameraOccluders || pass == RenderPassLightOccluders;
 
+    //Only submit what this pass can see
+    QueryBvhFrustum(_scene.bvh, ExtractFrustum(viewProjection), _visibleObjects);
+
+    for (uint32_t index : _visibleObjects)
+    {
+        const SceneObject& object = _scene.objects[index];
+
+        if (object.draw.count == 0)
+            continue;
+
+        if (occluderPass && !object.occluder)
+            continue;
+
+        //Occluders are in the pyramid themselves and are never hidden by it
+        if (occlusion != nullptr && !object.occluder)
+        {
+            const BoundsSoA& bounds = _scene.worldBounds;
+            glm::vec3 center(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]);
+            glm::vec3 extent(bounds.extentX[index], bounds.extentY[index], bounds.extentZ[index]);
+            if (IsOccluded(*occlusion, center, extent))
+                continue;
+        }
+
+        //Depth only passes do not sample the texture
+        GLuint texture = pass == RenderPassOpaque || pass == RenderPassTransparent ? object.texture : 0;
+        SubmitRenderCommand(_renderQueue, pass, shader, texture, object.draw, object.model);
+        if (depthPrepass)
+            SubmitRenderCommand(_renderQueue, RenderPassDepthPrepass, _depthShaderProgram, 0, object.draw, object.model);
+    }
+}
+
+glm::mat4 ApplyCubeTransformation(float time)
+{
+    //Model
+    glm::mat4 translation = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.0f));
+    glm::mat4 rotation = glm::eulerAngleXYZ(0.6f, -1.0f, -0.8f);
+    glm::mat4 model = translation * rotation;
+    model = glm::rotate(model, time, glm::vec3(0.6f, -0.3f, 0.3f));
+
+    return model;
+}
+
+uint32_t AddStaticObject(const DrawCall& draw, glm::vec3 position, glm::vec3 orientation, glm::vec3 scale)
+{
     //Model
     glm::mat4 translation = glm::translate(glm::mat4(1.0f), position);
     glm::mat4 scaling = glm::scale(glm::mat4(1.0f), scale);
     glm::mat4 rotation = glm::eulerAngleXYZ(orientation.x, orientation.y, orientation.z);
-    model = translation * scaling * rotation;
-
-    //View
-    view = cameraView;
-
-    //Projection
-    projection = glm::perspective(glm::radians(45.0f), (float)ScreenWidth / (float)ScreenHeight, 0.1f, 100.0f);
+    glm::mat4 model = translation * scaling * rotation;
 
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    glBindVertexArray(vertexArrayObject);
-    glDrawElements(GL_TRIANGLES, vertexCount, GL_UNSIGNED_INT, 0);
+    return AddSceneObject(_scene, draw, _textureCube, model, glm::vec3(0.0f), glm::vec3(0.5f, 0.5f, 0.0f), true);
 }
 
 void UpdateKeybaordInput(GLFWwindow* window)
@@ -472,22 +1070,46 @@ void UpdateKeybaordInput(GLFWwindow* window)
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
+    //G switches between forward and deferred shading
+    bool deferredDown = IsInputKeyDown(_input, InputKeyG);
+    if (deferredDown && !_deferredKeyDown)
+    {
+        _deferred.settings.enabled = !_deferred.settings.enabled;
+        std::cout << (_deferred.settings.enabled ? "Deferred shading" : "Forward shading") << std::endl;
+    }
+    _deferredKeyDown = deferredDown;
+
+    //F12 takes a screenshot, or pauses and resumes continuous capture
+    bool captureDown = IsInputKeyDown(_input, InputKeyF12);
+    if (captureDown && !_captureKeyDown)
+        ToggleFrameCapture(_frameCapture);
+    _captureKeyDown = captureDown;
+
     float cameraSpeed = static_cast<float>(2.5 * _deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if (IsInputKeyDown(_input, InputKeyW))
         _cameraPosition += cameraSpeed * _playerForward;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (IsInputKeyDown(_input, InputKeyS))
         _cameraPosition -= cameraSpeed * _playerForward;
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (IsInputKeyDown(_input, InputKeyA))
         _cameraPosition -= glm::normalize(glm::cross(_playerForward, _worldUp)) * cameraSpeed;
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (IsInputKeyDown(_input, InputKeyD))
         _cameraPosition += glm::normalize(glm::cross(_playerForward, _worldUp)) * cameraSpeed;
 }
 
 void MouseCallback(GLFWwindow* window, double xposIn, double yposIn)
 {
+    //Replays take the cursor from the recording
+    if (_goldenTest.settings.enabled || _input.settings.mode == InputReplay)
+        return;
+
     float xpos = static_cast<float>(xposIn);
     float ypos = static_cast<float>(yposIn);
+    RecordInputCursor(_input, glm::vec2(xpos, ypos));
+    UpdateCameraRotation(xpos, ypos);
+}
 
+void UpdateCameraRotation(float xpos, float ypos)
+{
     float xoffset = xpos - _lastX;
     float yoffset = _lastY - ypos; 
     _lastX = xpos;
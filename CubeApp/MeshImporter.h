@@ -0,0 +1,1457 @@
+#pragma once
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "JobSystem.h"
+#include "MeshOptimizer.h"
+#include "VertexFormat.h"
+
+//OBJ files are split into chunks of about this size at line ends and parsed in parallel
+const size_t ObjChunkBytes = 1 << 20;
+
+//Guards the recursive parts of the JSON and node parsing against broken files
+const int MeshImportMaxDepth = 64;
+
+const char BinaryMeshMagic[4] = { 'C', 'M', 'S', 'H' };
+const uint32_t BinaryMeshVersion = 1;
+const char* BinaryMeshExtension = ".cubemesh";
+
+struct MeshImportSettings
+{
+    //OBJ, glTF (.gltf with external buffers, or .glb) or an already converted binary mesh
+    std::string path;
+    //Imports again even when the binary mesh next to the source is up to date
+    bool rebuildCache = false;
+};
+
+//Loaded once by mapping the file, the vertex and index data are used in place. Little
+//endian, like every platform the app runs on.
+struct BinaryMeshHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexFloats;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    float minimum[3];
+    float maximum[3];
+    uint32_t reserved;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+};
+
+static_assert(sizeof(BinaryMeshHeader) == 64, "Binary mesh header layout changed");
+
+struct MappedFile
+{
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+};
+
+//Triangle list in the interleaved source layout
+struct ImportedMesh
+{
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+};
+
+//Points into the mapped binary mesh, or into the imported arrays when no binary mesh could
+//be written
+struct LoadedMesh
+{
+    const float* vertices = nullptr;
+    const uint32_t* indices = nullptr;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    glm::vec3 minimum = glm::vec3(0.0f);
+    glm::vec3 maximum = glm::vec3(0.0f);
+
+    MappedFile file;
+    ImportedMesh imported;
+};
+
+//--mesh <path> [--rebuild-mesh-cache]
+bool ParseMeshImportArguments(int argc, char** argv, MeshImportSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mesh") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                std::cout << "Missing value for --mesh, expected a .obj, .gltf, .glb or " << BinaryMeshExtension << " file" << std::endl;
+                return false;
+            }
+            settings.path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rebuild-mesh-cache") == 0)
+            settings.rebuildCache = true;
+    }
+
+    return true;
+}
+
+bool MapFile(const char* path, MappedFile& file)
+{
+#ifdef _WIN32
+    file.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER size;
+    if (file.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file.file, &size) || size.QuadPart == 0)
+    {
+        if (file.file != INVALID_HANDLE_VALUE)
+            CloseHandle(file.file);
+        file.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    file.mapping = CreateFileMappingA(file.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    file.data = file.mapping != nullptr ? static_cast<const char*>(MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (file.data == nullptr)
+    {
+        if (file.mapping != nullptr)
+            CloseHandle(file.mapping);
+        CloseHandle(file.file);
+        file.mapping = nullptr;
+        file.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    file.size = static_cast<size_t>(size.QuadPart);
+#else
+    file.descriptor = open(path, O_RDONLY);
+    struct stat status;
+    if (file.descriptor < 0 || fstat(file.descriptor, &status) != 0 || status.st_size == 0)
+    {
+        if (file.descriptor >= 0)
+            close(file.descriptor);
+        file.descriptor = -1;
+        return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file.descriptor, 0);
+    if (data == MAP_FAILED)
+    {
+        close(file.descriptor);
+        file.descriptor = -1;
+        return false;
+    }
+    file.data = static_cast<const char*>(data);
+    file.size = static_cast<size_t>(status.st_size);
+#endif
+    return true;
+}
+
+void UnmapFile(MappedFile& file)
+{
+#ifdef _WIN32
+    if (file.data != nullptr)
+        UnmapViewOfFile(file.data);
+    if (file.mapping != nullptr)
+        CloseHandle(file.mapping);
+    if (file.file != INVALID_HANDLE_VALUE)
+        CloseHandle(file.file);
+    file.mapping = nullptr;
+    file.file = INVALID_HANDLE_VALUE;
+#else
+    if (file.data != nullptr)
+        munmap(const_cast<char*>(file.data), file.size);
+    if (file.descriptor >= 0)
+        close(file.descriptor);
+    file.descriptor = -1;
+#endif
+    file.data = nullptr;
+    file.size = 0;
+}
+
+bool HasExtension(const std::string& path, const char* extension)
+{
+    size_t length = strlen(extension);
+    if (path.size() < length)
+        return false;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (tolower(static_cast<unsigned char>(path[path.size() - length + i])) != extension[i])
+            return false;
+    }
+    return true;
+}
+
+void ComputeMeshBounds(const float* vertices, uint32_t vertexCount, glm::vec3& minimum, glm::vec3& maximum)
+{
+    minimum = glm::vec3(vertexCount > 0 ? FLT_MAX : 0.0f);
+    maximum = glm::vec3(vertexCount > 0 ? -FLT_MAX : 0.0f);
+    for (uint32_t i = 0; i < vertexCount; i++)
+    {
+        const float* vertex = vertices + static_cast<size_t>(i) * MeshSourceVertexFloats;
+        minimum = glm::min(minimum, glm::vec3(vertex[0], vertex[1], vertex[2]));
+        maximum = glm::max(maximum, glm::vec3(vertex[0], vertex[1], vertex[2]));
+    }
+}
+
+//Fills in normals left at zero with the area weighted average of the faces around them.
+//Vertices are grouped by vertexKeys when given, so OBJ corners that only differ in their
+//texture coordinates still share a normal.
+void GenerateMissingNormals(std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::vector<uint32_t>& vertexKeys, size_t keyCount)
+{
+    const size_t vertexCount = vertices.size() / MeshSourceVertexFloats;
+    auto key = [&](uint32_t vertex) { return vertexKeys.empty() ? vertex : vertexKeys[vertex]; };
+    auto missing = [&](uint32_t vertex)
+    {
+        const float* normal = &vertices[static_cast<size_t>(vertex) * MeshSourceVertexFloats + 3];
+        return normal[0] == 0.0f && normal[1] == 0.0f && normal[2] == 0.0f;
+    };
+
+    std::vector<glm::vec3> accumulated(vertexKeys.empty() ? vertexCount : keyCount, glm::vec3(0.0f));
+    for (size_t triangle = 0; triangle + 2 < indices.size(); triangle += 3)
+    {
+        glm::vec3 corners[3];
+        for (int corner = 0; corner < 3; corner++)
+            corners[corner] = glm::make_vec3(&vertices[static_cast<size_t>(indices[triangle + corner]) * MeshSourceVertexFloats]);
+
+        glm::vec3 cross = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        for (int corner = 0; corner < 3; corner++)
+        {
+            if (missing(indices[triangle + corner]))
+                accumulated[key(indices[triangle + corner])] += cross;
+        }
+    }
+
+    for (uint32_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        if (!missing(vertex))
+            continue;
+
+        glm::vec3 normal = accumulated[key(vertex)];
+        float length = glm::length(normal);
+        normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        memcpy(&vertices[static_cast<size_t>(vertex) * MeshSourceVertexFloats + 3], &normal[0], sizeof(normal));
+    }
+}
+
+//OBJ
+
+struct ObjCornerKey
+{
+    uint32_t position;
+    uint32_t texture;
+    uint32_t normal;
+
+    bool operator==(const ObjCornerKey& other) const
+    {
+        return position == other.position && texture == other.texture && normal == other.normal;
+    }
+};
+
+struct ObjCornerHash
+{
+    size_t operator()(const ObjCornerKey& key) const
+    {
+        uint64_t hash = key.position * 0x9E3779B97F4A7C15ull;
+        hash ^= (key.texture + 0x632BE59BD9B4E019ull + (hash << 6) + (hash >> 2)) * 0xC2B2AE3D27D4EB4Full;
+        hash ^= (key.normal + 0x85EBCA77C2B2AE63ull + (hash << 6) + (hash >> 2)) * 0x165667B19E3779F9ull;
+        return static_cast<size_t>(hash ^ (hash >> 29));
+    }
+};
+
+struct ObjChunk
+{
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    //Counted in the first pass, the bases are where the chunk's elements start in the file
+    uint32_t positionCount = 0;
+    uint32_t textureCount = 0;
+    uint32_t normalCount = 0;
+    uint32_t positionBase = 0;
+    uint32_t textureBase = 0;
+    uint32_t normalBase = 0;
+
+    //Welded within the chunk, the optimizer merges what is shared across chunks
+    std::vector<float> vertices;
+    std::vector<uint32_t> vertexPositions;
+    std::vector<uint32_t> indices;
+    bool missingNormals = false;
+    bool invalid = false;
+
+    uint32_t vertexBase = 0;
+    size_t indexBase = 0;
+};
+
+enum ObjLineType
+{
+    ObjLineOther,
+    ObjLinePosition,
+    ObjLineTexture,
+    ObjLineNormal,
+    ObjLineFace
+};
+
+const char* SkipObjSpaces(const char* cursor, const char* end)
+{
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t'))
+        cursor++;
+    return cursor;
+}
+
+//Calls function(type, arguments, lineEnd) for every line, with arguments past the keyword
+template<typename Function>
+void ForEachObjLine(const char* begin, const char* end, Function function)
+{
+    const char* line = begin;
+    while (line < end)
+    {
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+        lineEnd = lineEnd != nullptr ? lineEnd : end;
+        const char* cursor = SkipObjSpaces(line, lineEnd);
+
+        ObjLineType type = ObjLineOther;
+        const char* arguments = cursor + 1;
+        if (lineEnd - cursor >= 2 && cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t'))
+            type = ObjLinePosition;
+        else if (lineEnd - cursor >= 3 && cursor[0] == 'v' && (cursor[2] == ' ' || cursor[2] == '\t'))
+        {
+            type = cursor[1] == 't' ? ObjLineTexture : cursor[1] == 'n' ? ObjLineNormal : ObjLineOther;
+            arguments = cursor + 2;
+        }
+        else if (lineEnd - cursor >= 2 && cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t'))
+            type = ObjLineFace;
+
+        if (type != ObjLineOther)
+            function(type, arguments, lineEnd);
+
+        line = lineEnd + 1;
+    }
+}
+
+//Missing trailing values stay zero, extra ones like w or vertex colors are ignored
+void ParseObjFloats(const char* cursor, const char* end, float* values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        cursor = SkipObjSpaces(cursor, end);
+        std::from_chars_result result = std::from_chars(cursor, end, values[i]);
+        if (result.ec != std::errc())
+            return;
+        cursor = result.ptr;
+    }
+}
+
+//One face corner: v, v/vt, v//vn or v/vt/vn. Indices are one based, negative ones count back
+//from the last element defined so far. Resolved to zero based, UINT32_MAX when left out.
+bool ParseObjCorner(const char*& cursor, const char* end, const uint32_t counts[3], uint32_t resolved[3])
+{
+    for (int element = 0; element < 3; element++)
+    {
+        resolved[element] = UINT32_MAX;
+        if (element > 0)
+        {
+            if (cursor >= end || *cursor != '/')
+                continue;
+            cursor++;
+        }
+
+        int64_t index = 0;
+        std::from_chars_result result = std::from_chars(cursor, end, index);
+        if (result.ec != std::errc())
+        {
+            //Only the texture coordinate may be left empty, as in v//vn
+            if (element == 1)
+                continue;
+            return false;
+        }
+        cursor = result.ptr;
+
+        index = index < 0 ? static_cast<int64_t>(counts[element]) + index : index - 1;
+        if (index < 0 || index >= static_cast<int64_t>(counts[element]))
+            return false;
+        resolved[element] = static_cast<uint32_t>(index);
+    }
+
+    return cursor >= end || *cursor == ' ' || *cursor == '\t' || *cursor == '\r';
+}
+
+//Polygons are triangulated as fans. Groups, objects and materials are ignored, the whole file
+//becomes one mesh.
+bool ImportObjMesh(const char* path, JobSystem* jobSystem, ImportedMesh& mesh)
+{
+    MappedFile file;
+    if (!MapFile(path, file))
+    {
+        std::cout << "Failed to open mesh: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<ObjChunk> chunks;
+    const char* fileEnd = file.data + file.size;
+    for (const char* begin = file.data; begin < fileEnd; )
+    {
+        const char* end = begin + std::min(ObjChunkBytes, static_cast<size_t>(fileEnd - begin));
+        const char* lineEnd = end < fileEnd ? static_cast<const char*>(memchr(end, '\n', fileEnd - end)) : nullptr;
+        end = lineEnd != nullptr ? lineEnd + 1 : fileEnd;
+
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().end = end;
+        begin = end;
+    }
+
+    //Pass 1: count the elements, so every chunk knows the file index of its first ones
+    ParallelFor(jobSystem, chunks.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            ObjChunk& chunk = chunks[i];
+            ForEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char*, const char*)
+            {
+                chunk.positionCount += type == ObjLinePosition;
+                chunk.textureCount += type == ObjLineTexture;
+                chunk.normalCount += type == ObjLineNormal;
+            });
+        }
+    });
+
+    uint32_t positionCount = 0;
+    uint32_t textureCount = 0;
+    uint32_t normalCount = 0;
+    for (ObjChunk& chunk : chunks)
+    {
+        chunk.positionBase = positionCount;
+        chunk.textureBase = textureCount;
+        chunk.normalBase = normalCount;
+        positionCount += chunk.positionCount;
+        textureCount += chunk.textureCount;
+        normalCount += chunk.normalCount;
+    }
+
+    //Pass 2: the elements, straight into their place in the file wide arrays
+    std::vector<float> positions(static_cast<size_t>(positionCount) * 3, 0.0f);
+    std::vector<float> textures(static_cast<size_t>(textureCount) * 2, 0.0f);
+    std::vector<float> normals(static_cast<size_t>(normalCount) * 3, 0.0f);
+    ParallelFor(jobSystem, chunks.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            ObjChunk& chunk = chunks[i];
+            float* position = positions.data() + static_cast<size_t>(chunk.positionBase) * 3;
+            float* texture = textures.data() + static_cast<size_t>(chunk.textureBase) * 2;
+            float* normal = normals.data() + static_cast<size_t>(chunk.normalBase) * 3;
+            ForEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char* arguments, const char* lineEnd)
+            {
+                if (type == ObjLinePosition)
+                {
+                    ParseObjFloats(arguments, lineEnd, position, 3);
+                    position += 3;
+                }
+                else if (type == ObjLineTexture)
+                {
+                    ParseObjFloats(arguments, lineEnd, texture, 2);
+                    texture += 2;
+                }
+                else if (type == ObjLineNormal)
+                {
+                    ParseObjFloats(arguments, lineEnd, normal, 3);
+                    normal += 3;
+                }
+            });
+        }
+    });
+
+    //Pass 3: the faces, each chunk welding the corners it uses
+    ParallelFor(jobSystem, chunks.size(), 1, [&](size_t begin, size_t end)
+    {
+        std::vector<uint32_t> polygon;
+        std::unordered_map<ObjCornerKey, uint32_t, ObjCornerHash> welded;
+        for (size_t i = begin; i < end; i++)
+        {
+            ObjChunk& chunk = chunks[i];
+            uint32_t counts[3] = { chunk.positionBase, chunk.textureBase, chunk.normalBase };
+            welded.clear();
+
+            ForEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char* cursor, const char* lineEnd)
+            {
+                if (type != ObjLineFace)
+                {
+                    counts[0] += type == ObjLinePosition;
+                    counts[1] += type == ObjLineTexture;
+                    counts[2] += type == ObjLineNormal;
+                    return;
+                }
+
+                polygon.clear();
+                cursor = SkipObjSpaces(cursor, lineEnd);
+                while (cursor < lineEnd && *cursor != '\r' && *cursor != '#')
+                {
+                    uint32_t resolved[3];
+                    if (!ParseObjCorner(cursor, lineEnd, counts, resolved))
+                    {
+                        chunk.invalid = true;
+                        return;
+                    }
+                    ObjCornerKey key = { resolved[0], resolved[1], resolved[2] };
+
+                    auto found = welded.find(key);
+                    if (found == welded.end())
+                    {
+                        uint32_t vertex = static_cast<uint32_t>(chunk.vertexPositions.size());
+                        found = welded.emplace(key, vertex).first;
+
+                        float data[MeshSourceVertexFloats] = {};
+                        memcpy(data, &positions[static_cast<size_t>(key.position) * 3], 3 * sizeof(float));
+                        if (key.normal != UINT32_MAX)
+                            memcpy(data + 3, &normals[static_cast<size_t>(key.normal) * 3], 3 * sizeof(float));
+                        else
+                            chunk.missingNormals = true;
+                        //OBJ puts v = 0 at the bottom of the image, textures are uploaded top row first
+                        if (key.texture != UINT32_MAX)
+                        {
+                            data[6] = textures[static_cast<size_t>(key.texture) * 2];
+                            data[7] = 1.0f - textures[static_cast<size_t>(key.texture) * 2 + 1];
+                        }
+
+                        chunk.vertices.insert(chunk.vertices.end(), data, data + MeshSourceVertexFloats);
+                        chunk.vertexPositions.push_back(key.position);
+                    }
+                    polygon.push_back(found->second);
+                    cursor = SkipObjSpaces(cursor, lineEnd);
+                }
+
+                for (size_t corner = 2; corner < polygon.size(); corner++)
+                {
+                    chunk.indices.push_back(polygon[0]);
+                    chunk.indices.push_back(polygon[corner - 1]);
+                    chunk.indices.push_back(polygon[corner]);
+                }
+            });
+        }
+    });
+
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    bool missingNormals = false;
+    for (ObjChunk& chunk : chunks)
+    {
+        if (chunk.invalid)
+        {
+            std::cout << "Invalid face in mesh: " << path << std::endl;
+            UnmapFile(file);
+            return false;
+        }
+
+        chunk.vertexBase = static_cast<uint32_t>(vertexCount);
+        chunk.indexBase = indexCount;
+        vertexCount += chunk.vertexPositions.size();
+        indexCount += chunk.indices.size();
+        missingNormals = missingNormals || chunk.missingNormals;
+    }
+    UnmapFile(file);
+
+    if (vertexCount > UINT32_MAX)
+    {
+        std::cout << "Too many vertices in mesh: " << path << std::endl;
+        return false;
+    }
+
+    mesh.vertices.resize(vertexCount * MeshSourceVertexFloats);
+    mesh.indices.resize(indexCount);
+    std::vector<uint32_t> vertexPositions(missingNormals ? vertexCount : 0);
+    ParallelFor(jobSystem, chunks.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            ObjChunk& chunk = chunks[i];
+            std::copy(chunk.vertices.begin(), chunk.vertices.end(), mesh.vertices.begin() + static_cast<size_t>(chunk.vertexBase) * MeshSourceVertexFloats);
+            for (size_t index = 0; index < chunk.indices.size(); index++)
+                mesh.indices[chunk.indexBase + index] = chunk.indices[index] + chunk.vertexBase;
+            if (missingNormals)
+                std::copy(chunk.vertexPositions.begin(), chunk.vertexPositions.end(), vertexPositions.begin() + chunk.vertexBase);
+        }
+    });
+
+    if (missingNormals)
+        GenerateMissingNormals(mesh.vertices, mesh.indices, vertexPositions, positionCount);
+
+    return true;
+}
+
+//JSON, only as much as glTF needs
+
+struct JsonValue
+{
+    enum Type
+    {
+        Null,
+        Boolean,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    Type type = Null;
+    double number = 0.0;
+    std::string string;
+    //Array elements, or object member values with their names in keys
+    std::vector<JsonValue> items;
+    std::vector<std::string> keys;
+};
+
+struct JsonParser
+{
+    const char* cursor;
+    const char* end;
+};
+
+void SkipJsonWhitespace(JsonParser& parser)
+{
+    while (parser.cursor < parser.end && (*parser.cursor == ' ' || *parser.cursor == '\t' || *parser.cursor == '\n' || *parser.cursor == '\r'))
+        parser.cursor++;
+}
+
+void AppendUtf8(std::string& string, uint32_t codePoint)
+{
+    if (codePoint < 0x80)
+        string += static_cast<char>(codePoint);
+    else if (codePoint < 0x800)
+    {
+        string += static_cast<char>(0xC0 | (codePoint >> 6));
+        string += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    else if (codePoint < 0x10000)
+    {
+        string += static_cast<char>(0xE0 | (codePoint >> 12));
+        string += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        string += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    else
+    {
+        string += static_cast<char>(0xF0 | (codePoint >> 18));
+        string += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        string += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        string += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+}
+
+bool ParseJsonString(JsonParser& parser, std::string& string)
+{
+    //Past the opening quote
+    parser.cursor++;
+    while (parser.cursor < parser.end && *parser.cursor != '"')
+    {
+        char character = *parser.cursor++;
+        if (character != '\\')
+        {
+            string += character;
+            continue;
+        }
+
+        if (parser.cursor >= parser.end)
+            return false;
+
+        char escape = *parser.cursor++;
+        switch (escape)
+        {
+        case 'b': string += '\b'; break;
+        case 'f': string += '\f'; break;
+        case 'n': string += '\n'; break;
+        case 'r': string += '\r'; break;
+        case 't': string += '\t'; break;
+        case 'u':
+        {
+            uint32_t codePoint = 0;
+            if (parser.end - parser.cursor < 4 || std::from_chars(parser.cursor, parser.cursor + 4, codePoint, 16).ptr != parser.cursor + 4)
+                return false;
+            parser.cursor += 4;
+
+            //Surrogate pair
+            uint32_t low = 0;
+            if (codePoint >= 0xD800 && codePoint < 0xDC00 && parser.end - parser.cursor >= 6 && parser.cursor[0] == '\\' && parser.cursor[1] == 'u'
+                && std::from_chars(parser.cursor + 2, parser.cursor + 6, low, 16).ptr == parser.cursor + 6 && low >= 0xDC00 && low < 0xE000)
+            {
+                codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                parser.cursor += 6;
+            }
+            AppendUtf8(string, codePoint);
+            break;
+        }
+        default: string += escape; break;
+        }
+    }
+
+    if (parser.cursor >= parser.end)
+        return false;
+    parser.cursor++;
+    return true;
+}
+
+bool ParseJsonValue(JsonParser& parser, JsonValue& value, int depth)
+{
+    SkipJsonWhitespace(parser);
+    if (parser.cursor >= parser.end || depth > MeshImportMaxDepth)
+        return false;
+
+    auto literal = [&](const char* text)
+    {
+        size_t length = strlen(text);
+        if (static_cast<size_t>(parser.end - parser.cursor) < length || memcmp(parser.cursor, text, length) != 0)
+            return false;
+        parser.cursor += length;
+        return true;
+    };
+
+    char character = *parser.cursor;
+    if (character == '{' || character == '[')
+    {
+        bool object = character == '{';
+        char close = object ? '}' : ']';
+        value.type = object ? JsonValue::Object : JsonValue::Array;
+        parser.cursor++;
+
+        SkipJsonWhitespace(parser);
+        if (parser.cursor < parser.end && *parser.cursor == close)
+        {
+            parser.cursor++;
+            return true;
+        }
+
+        while (true)
+        {
+            if (object)
+            {
+                SkipJsonWhitespace(parser);
+                value.keys.emplace_back();
+                if (parser.cursor >= parser.end || *parser.cursor != '"' || !ParseJsonString(parser, value.keys.back()))
+                    return false;
+
+                SkipJsonWhitespace(parser);
+                if (parser.cursor >= parser.end || *parser.cursor != ':')
+                    return false;
+                parser.cursor++;
+            }
+
+            value.items.emplace_back();
+            if (!ParseJsonValue(parser, value.items.back(), depth + 1))
+                return false;
+
+            SkipJsonWhitespace(parser);
+            if (parser.cursor >= parser.end)
+                return false;
+            if (*parser.cursor == close)
+            {
+                parser.cursor++;
+                return true;
+            }
+            if (*parser.cursor != ',')
+                return false;
+            parser.cursor++;
+        }
+    }
+
+    if (character == '"')
+    {
+        value.type = JsonValue::String;
+        return ParseJsonString(parser, value.string);
+    }
+
+    if (literal("true"))
+    {
+        value.type = JsonValue::Boolean;
+        value.number = 1.0;
+        return true;
+    }
+
+    if (literal("false"))
+    {
+        value.type = JsonValue::Boolean;
+        return true;
+    }
+
+    if (literal("null"))
+        return true;
+
+    value.type = JsonValue::Number;
+    std::from_chars_result result = std::from_chars(parser.cursor, parser.end, value.number);
+    parser.cursor = result.ptr;
+    return result.ec == std::errc();
+}
+
+const JsonValue* FindJsonMember(const JsonValue* object, const char* key)
+{
+    if (object == nullptr || object->type != JsonValue::Object)
+        return nullptr;
+
+    for (size_t i = 0; i < object->keys.size(); i++)
+    {
+        if (object->keys[i] == key)
+            return &object->items[i];
+    }
+    return nullptr;
+}
+
+const JsonValue* GetJsonItem(const JsonValue* array, double index)
+{
+    if (array == nullptr || array->type != JsonValue::Array || index < 0.0 || index >= static_cast<double>(array->items.size()))
+        return nullptr;
+    return &array->items[static_cast<size_t>(index)];
+}
+
+double GetJsonNumber(const JsonValue* value, double fallback)
+{
+    return value != nullptr && value->type == JsonValue::Number ? value->number : fallback;
+}
+
+//glTF 2.0
+
+const uint32_t GlbMagic = 0x46546C67;
+const uint32_t GlbJsonChunk = 0x4E4F534A;
+const uint32_t GlbBinaryChunk = 0x004E4942;
+
+const int GltfByte = 5120;
+const int GltfUnsignedByte = 5121;
+const int GltfShort = 5122;
+const int GltfUnsignedShort = 5123;
+const int GltfUnsignedInt = 5125;
+const int GltfFloat = 5126;
+const int GltfTriangles = 4;
+
+struct GltfBuffer
+{
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+struct GltfFile
+{
+    MappedFile file;
+    std::vector<MappedFile> externalFiles;
+    JsonValue root;
+    std::vector<GltfBuffer> buffers;
+};
+
+//A validated view of one accessor's elements
+struct GltfAccessor
+{
+    const char* data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int componentType = 0;
+    int components = 0;
+    bool normalized = false;
+};
+
+struct GltfPrimitive
+{
+    glm::mat4 transform;
+    bool flipWinding = false;
+    GltfAccessor positions;
+    GltfAccessor normals;
+    GltfAccessor textures;
+    GltfAccessor indices;
+    uint32_t vertexBase = 0;
+    size_t indexBase = 0;
+    size_t indexCount = 0;
+};
+
+void CloseGltfFile(GltfFile& gltf)
+{
+    UnmapFile(gltf.file);
+    for (MappedFile& file : gltf.externalFiles)
+        UnmapFile(file);
+    gltf.externalFiles.clear();
+}
+
+//Buffers come from the GLB binary chunk or from files next to the .gltf, embedded data
+//URIs are not supported
+bool OpenGltfFile(const char* path, GltfFile& gltf)
+{
+    if (!MapFile(path, gltf.file))
+    {
+        std::cout << "Failed to open mesh: " << path << std::endl;
+        return false;
+    }
+
+    const char* json = gltf.file.data;
+    size_t jsonSize = gltf.file.size;
+    GltfBuffer binaryChunk;
+
+    uint32_t header[3] = {};
+    if (gltf.file.size >= sizeof(header))
+        memcpy(header, gltf.file.data, sizeof(header));
+    if (header[0] == GlbMagic)
+    {
+        json = nullptr;
+        for (size_t offset = sizeof(header); offset + 8 <= gltf.file.size; )
+        {
+            uint32_t chunk[2];
+            memcpy(chunk, gltf.file.data + offset, sizeof(chunk));
+            offset += sizeof(chunk);
+            if (chunk[0] > gltf.file.size - offset)
+                break;
+
+            if (chunk[1] == GlbJsonChunk && json == nullptr)
+            {
+                json = gltf.file.data + offset;
+                jsonSize = chunk[0];
+            }
+            else if (chunk[1] == GlbBinaryChunk && binaryChunk.data == nullptr)
+                binaryChunk = { gltf.file.data + offset, chunk[0] };
+
+            //Chunks are 4 byte aligned
+            offset += (static_cast<size_t>(chunk[0]) + 3) & ~static_cast<size_t>(3);
+        }
+
+        if (header[1] != 2 || json == nullptr)
+        {
+            std::cout << "Unsupported glTF binary: " << path << std::endl;
+            return false;
+        }
+    }
+
+    JsonParser parser = { json, json + jsonSize };
+    if (!ParseJsonValue(parser, gltf.root, 0) || gltf.root.type != JsonValue::Object)
+    {
+        std::cout << "Invalid glTF JSON: " << path << std::endl;
+        return false;
+    }
+
+    const JsonValue* buffers = FindJsonMember(&gltf.root, "buffers");
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    for (size_t i = 0; buffers != nullptr && buffers->type == JsonValue::Array && i < buffers->items.size(); i++)
+    {
+        const JsonValue* uri = FindJsonMember(&buffers->items[i], "uri");
+        GltfBuffer buffer;
+        if (uri == nullptr && i == 0)
+            buffer = binaryChunk;
+        else if (uri != nullptr && uri->type == JsonValue::String && uri->string.compare(0, 5, "data:") != 0)
+        {
+            //Relative to the .gltf, spaces and other characters may be percent encoded
+            std::string decoded;
+            for (size_t c = 0; c < uri->string.size(); c++)
+            {
+                unsigned int code = 0;
+                if (uri->string[c] == '%' && c + 2 < uri->string.size()
+                    && std::from_chars(uri->string.data() + c + 1, uri->string.data() + c + 3, code, 16).ptr == uri->string.data() + c + 3)
+                {
+                    decoded += static_cast<char>(code);
+                    c += 2;
+                }
+                else
+                    decoded += uri->string[c];
+            }
+
+            gltf.externalFiles.emplace_back();
+            if (MapFile((directory / decoded).string().c_str(), gltf.externalFiles.back()))
+                buffer = { gltf.externalFiles.back().data, gltf.externalFiles.back().size };
+        }
+
+        if (buffer.data == nullptr)
+        {
+            std::cout << "Unsupported or missing glTF buffer " << i << ": " << path << std::endl;
+            return false;
+        }
+
+        size_t byteLength = static_cast<size_t>(GetJsonNumber(FindJsonMember(&buffers->items[i], "byteLength"), 0.0));
+        buffer.size = std::min(buffer.size, byteLength);
+        gltf.buffers.push_back(buffer);
+    }
+
+    return true;
+}
+
+bool GetGltfAccessor(const GltfFile& gltf, const JsonValue* index, GltfAccessor& accessor)
+{
+    const JsonValue* json = GetJsonItem(FindJsonMember(&gltf.root, "accessors"), GetJsonNumber(index, -1.0));
+    if (json == nullptr || FindJsonMember(json, "sparse") != nullptr)
+        return false;
+
+    const JsonValue* view = GetJsonItem(FindJsonMember(&gltf.root, "bufferViews"), GetJsonNumber(FindJsonMember(json, "bufferView"), -1.0));
+    if (view == nullptr)
+        return false;
+
+    double buffer = GetJsonNumber(FindJsonMember(view, "buffer"), -1.0);
+    if (buffer < 0.0 || buffer >= static_cast<double>(gltf.buffers.size()))
+        return false;
+
+    const JsonValue* type = FindJsonMember(json, "type");
+    if (type == nullptr || type->type != JsonValue::String)
+        return false;
+    accessor.components = type->string == "SCALAR" ? 1 : type->string == "VEC2" ? 2 : type->string == "VEC3" ? 3 : type->string == "VEC4" ? 4 : 0;
+
+    accessor.componentType = static_cast<int>(GetJsonNumber(FindJsonMember(json, "componentType"), 0.0));
+    size_t componentSize = 0;
+    switch (accessor.componentType)
+    {
+    case GltfByte: case GltfUnsignedByte: componentSize = 1; break;
+    case GltfShort: case GltfUnsignedShort: componentSize = 2; break;
+    case GltfUnsignedInt: case GltfFloat: componentSize = 4; break;
+    }
+    if (accessor.components == 0 || componentSize == 0)
+        return false;
+
+    const JsonValue* normalized = FindJsonMember(json, "normalized");
+    accessor.normalized = normalized != nullptr && normalized->number != 0.0;
+    accessor.count = static_cast<size_t>(GetJsonNumber(FindJsonMember(json, "count"), 0.0));
+
+    size_t elementSize = componentSize * accessor.components;
+    accessor.stride = static_cast<size_t>(GetJsonNumber(FindJsonMember(view, "byteStride"), 0.0));
+    accessor.stride = accessor.stride != 0 ? accessor.stride : elementSize;
+
+    //Everything read must lie inside the view, and the view inside the buffer
+    const GltfBuffer& data = gltf.buffers[static_cast<size_t>(buffer)];
+    size_t viewOffset = static_cast<size_t>(GetJsonNumber(FindJsonMember(view, "byteOffset"), 0.0));
+    size_t viewLength = static_cast<size_t>(GetJsonNumber(FindJsonMember(view, "byteLength"), 0.0));
+    size_t offset = static_cast<size_t>(GetJsonNumber(FindJsonMember(json, "byteOffset"), 0.0));
+    if (viewOffset > data.size || viewLength > data.size - viewOffset)
+        return false;
+    if (accessor.count > 0 && (offset > viewLength || accessor.count - 1 > (viewLength - offset) / accessor.stride
+        || (accessor.count - 1) * accessor.stride + elementSize > viewLength - offset))
+        return false;
+
+    accessor.data = data.data + viewOffset + offset;
+    return true;
+}
+
+float ReadGltfComponent(const GltfAccessor& accessor, size_t element, int component)
+{
+    const char* data = accessor.data + element * accessor.stride;
+    switch (accessor.componentType)
+    {
+    case GltfFloat:
+    {
+        float value;
+        memcpy(&value, data + component * sizeof(float), sizeof(value));
+        return value;
+    }
+    case GltfUnsignedByte:
+    {
+        uint8_t value = static_cast<uint8_t>(data[component]);
+        return accessor.normalized ? value / 255.0f : value;
+    }
+    case GltfByte:
+    {
+        int8_t value = static_cast<int8_t>(data[component]);
+        return accessor.normalized ? std::max(value / 127.0f, -1.0f) : value;
+    }
+    case GltfUnsignedShort:
+    {
+        uint16_t value;
+        memcpy(&value, data + component * sizeof(value), sizeof(value));
+        return accessor.normalized ? value / 65535.0f : value;
+    }
+    case GltfShort:
+    {
+        int16_t value;
+        memcpy(&value, data + component * sizeof(value), sizeof(value));
+        return accessor.normalized ? std::max(value / 32767.0f, -1.0f) : value;
+    }
+    }
+    return 0.0f;
+}
+
+uint32_t ReadGltfIndex(const GltfAccessor& accessor, size_t element)
+{
+    const char* data = accessor.data + element * accessor.stride;
+    if (accessor.componentType == GltfUnsignedByte)
+        return static_cast<uint8_t>(data[0]);
+
+    if (accessor.componentType == GltfUnsignedShort)
+    {
+        uint16_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+glm::mat4 GetGltfNodeTransform(const JsonValue* node)
+{
+    const JsonValue* matrix = FindJsonMember(node, "matrix");
+    if (matrix != nullptr && matrix->type == JsonValue::Array && matrix->items.size() == 16)
+    {
+        //Column major, like glm
+        float values[16];
+        for (int i = 0; i < 16; i++)
+            values[i] = static_cast<float>(GetJsonNumber(&matrix->items[i], 0.0));
+        return glm::make_mat4(values);
+    }
+
+    auto vector = [&](const char* key, int size, glm::vec4 fallback)
+    {
+        const JsonValue* array = FindJsonMember(node, key);
+        for (int i = 0; array != nullptr && array->type == JsonValue::Array && i < size && i < static_cast<int>(array->items.size()); i++)
+            fallback[i] = static_cast<float>(GetJsonNumber(&array->items[i], fallback[i]));
+        return fallback;
+    };
+
+    glm::vec4 translation = vector("translation", 3, glm::vec4(0.0f));
+    glm::vec4 rotation = vector("rotation", 4, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    glm::vec4 scale = vector("scale", 3, glm::vec4(1.0f));
+
+    glm::mat4 transform = glm::mat4_cast(glm::quat(rotation.w, rotation.x, rotation.y, rotation.z));
+    transform[0] *= scale.x;
+    transform[1] *= scale.y;
+    transform[2] *= scale.z;
+    transform[3] = glm::vec4(glm::vec3(translation), 1.0f);
+    return transform;
+}
+
+//Collects the triangle primitives of the node and its children, flattened to mesh space
+void CollectGltfPrimitives(const GltfFile& gltf, const JsonValue* node, const glm::mat4& parent, int depth, std::vector<GltfPrimitive>& primitives, uint32_t& skipped)
+{
+    if (node == nullptr || depth > MeshImportMaxDepth)
+        return;
+
+    glm::mat4 transform = parent * GetGltfNodeTransform(node);
+    const JsonValue* mesh = GetJsonItem(FindJsonMember(&gltf.root, "meshes"), GetJsonNumber(FindJsonMember(node, "mesh"), -1.0));
+    const JsonValue* meshPrimitives = FindJsonMember(mesh, "primitives");
+    for (size_t i = 0; meshPrimitives != nullptr && meshPrimitives->type == JsonValue::Array && i < meshPrimitives->items.size(); i++)
+    {
+        const JsonValue* json = &meshPrimitives->items[i];
+        const JsonValue* attributes = FindJsonMember(json, "attributes");
+
+        GltfPrimitive primitive;
+        primitive.transform = transform;
+        primitive.flipWinding = glm::determinant(glm::mat3(transform)) < 0.0f;
+        bool valid = GetJsonNumber(FindJsonMember(json, "mode"), GltfTriangles) == GltfTriangles
+            && GetGltfAccessor(gltf, FindJsonMember(attributes, "POSITION"), primitive.positions) && primitive.positions.components == 3;
+
+        //Optional attributes are dropped when unusable, a missing mesh part is worse
+        if (FindJsonMember(attributes, "NORMAL") != nullptr && (!GetGltfAccessor(gltf, FindJsonMember(attributes, "NORMAL"), primitive.normals)
+            || primitive.normals.components != 3 || primitive.normals.count != primitive.positions.count))
+            primitive.normals = GltfAccessor();
+        if (FindJsonMember(attributes, "TEXCOORD_0") != nullptr && (!GetGltfAccessor(gltf, FindJsonMember(attributes, "TEXCOORD_0"), primitive.textures)
+            || primitive.textures.components != 2 || primitive.textures.count != primitive.positions.count))
+            primitive.textures = GltfAccessor();
+
+        if (FindJsonMember(json, "indices") != nullptr)
+        {
+            valid = valid && GetGltfAccessor(gltf, FindJsonMember(json, "indices"), primitive.indices) && primitive.indices.components == 1
+                && primitive.indices.componentType != GltfFloat && primitive.indices.componentType != GltfByte && primitive.indices.componentType != GltfShort;
+        }
+        primitive.indexCount = (primitive.indices.data != nullptr ? primitive.indices.count : primitive.positions.count) / 3 * 3;
+
+        if (valid)
+            primitives.push_back(primitive);
+        else
+            skipped++;
+    }
+
+    const JsonValue* children = FindJsonMember(node, "children");
+    for (size_t i = 0; children != nullptr && children->type == JsonValue::Array && i < children->items.size(); i++)
+        CollectGltfPrimitives(gltf, GetJsonItem(FindJsonMember(&gltf.root, "nodes"), GetJsonNumber(&children->items[i], -1.0)), transform, depth + 1, primitives, skipped);
+}
+
+//Flattens the default scene, or every mesh when the file has no scenes, into one mesh with
+//the node transforms applied. Primitives are decoded in parallel.
+bool ImportGltfMesh(const char* path, JobSystem* jobSystem, ImportedMesh& mesh)
+{
+    GltfFile gltf;
+    if (!OpenGltfFile(path, gltf))
+    {
+        CloseGltfFile(gltf);
+        return false;
+    }
+
+    std::vector<GltfPrimitive> primitives;
+    uint32_t skipped = 0;
+    const JsonValue* scenes = FindJsonMember(&gltf.root, "scenes");
+    const JsonValue* scene = GetJsonItem(scenes, GetJsonNumber(FindJsonMember(&gltf.root, "scene"), 0.0));
+    const JsonValue* roots = FindJsonMember(scene, "nodes");
+    if (scene != nullptr)
+    {
+        for (size_t i = 0; roots != nullptr && roots->type == JsonValue::Array && i < roots->items.size(); i++)
+            CollectGltfPrimitives(gltf, GetJsonItem(FindJsonMember(&gltf.root, "nodes"), GetJsonNumber(&roots->items[i], -1.0)), glm::mat4(1.0f), 0, primitives, skipped);
+    }
+    else
+    {
+        const JsonValue* meshes = FindJsonMember(&gltf.root, "meshes");
+        for (size_t i = 0; meshes != nullptr && meshes->type == JsonValue::Array && i < meshes->items.size(); i++)
+        {
+            JsonValue node;
+            node.type = JsonValue::Object;
+            node.keys.push_back("mesh");
+            node.items.emplace_back();
+            node.items.back().type = JsonValue::Number;
+            node.items.back().number = static_cast<double>(i);
+            CollectGltfPrimitives(gltf, &node, glm::mat4(1.0f), 0, primitives, skipped);
+        }
+    }
+
+    if (skipped > 0)
+        std::cout << "Skipped " << skipped << " glTF primitives that are not indexed or plain triangle lists: " << path << std::endl;
+
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    bool missingNormals = false;
+    for (GltfPrimitive& primitive : primitives)
+    {
+        primitive.vertexBase = static_cast<uint32_t>(std::min(vertexCount, static_cast<size_t>(UINT32_MAX)));
+        primitive.indexBase = indexCount;
+        vertexCount += primitive.positions.count;
+        indexCount += primitive.indexCount;
+        missingNormals = missingNormals || primitive.normals.data == nullptr;
+    }
+
+    if (vertexCount > UINT32_MAX)
+    {
+        std::cout << "Too many vertices in mesh: " << path << std::endl;
+        CloseGltfFile(gltf);
+        return false;
+    }
+
+    mesh.vertices.assign(vertexCount * MeshSourceVertexFloats, 0.0f);
+    mesh.indices.resize(indexCount);
+    std::vector<uint8_t> invalid(primitives.size(), 0);
+    ParallelFor(jobSystem, primitives.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const GltfPrimitive& primitive = primitives[i];
+            glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(primitive.transform)));
+
+            for (size_t vertex = 0; vertex < primitive.positions.count; vertex++)
+            {
+                float* out = &mesh.vertices[(primitive.vertexBase + vertex) * MeshSourceVertexFloats];
+                glm::vec3 position;
+                for (int axis = 0; axis < 3; axis++)
+                    position[axis] = ReadGltfComponent(primitive.positions, vertex, axis);
+                position = glm::vec3(primitive.transform * glm::vec4(position, 1.0f));
+                memcpy(out, &position[0], sizeof(position));
+
+                if (primitive.normals.data != nullptr)
+                {
+                    glm::vec3 normal;
+                    for (int axis = 0; axis < 3; axis++)
+                        normal[axis] = ReadGltfComponent(primitive.normals, vertex, axis);
+                    normal = normalTransform * normal;
+                    float length = glm::length(normal);
+                    normal = length > 0.0f ? normal / length : normal;
+                    memcpy(out + 3, &normal[0], sizeof(normal));
+                }
+
+                if (primitive.textures.data != nullptr)
+                {
+                    out[6] = ReadGltfComponent(primitive.textures, vertex, 0);
+                    out[7] = ReadGltfComponent(primitive.textures, vertex, 1);
+                }
+            }
+
+            for (size_t index = 0; index < primitive.indexCount; index++)
+            {
+                uint32_t vertex = primitive.indices.data != nullptr ? ReadGltfIndex(primitive.indices, index) : static_cast<uint32_t>(index);
+                if (vertex >= primitive.positions.count)
+                {
+                    invalid[i] = 1;
+                    vertex = 0;
+                }
+
+                //Mirroring transforms turn the triangles inside out
+                size_t corner = index;
+                if (primitive.flipWinding && index % 3 != 0)
+                    corner = index % 3 == 1 ? index + 1 : index - 1;
+                mesh.indices[primitive.indexBase + corner] = primitive.vertexBase + vertex;
+            }
+        }
+    });
+    CloseGltfFile(gltf);
+
+    if (std::find(invalid.begin(), invalid.end(), 1) != invalid.end())
+    {
+        std::cout << "Invalid glTF indices: " << path << std::endl;
+        return false;
+    }
+
+    if (missingNormals)
+        GenerateMissingNormals(mesh.vertices, mesh.indices, std::vector<uint32_t>(), 0);
+
+    return true;
+}
+
+//Binary mesh
+
+bool WriteBinaryMesh(const char* path, const ImportedMesh& mesh)
+{
+    BinaryMeshHeader header = {};
+    memcpy(header.magic, BinaryMeshMagic, sizeof(header.magic));
+    header.version = BinaryMeshVersion;
+    header.vertexFloats = MeshSourceVertexFloats;
+    header.vertexCount = static_cast<uint32_t>(mesh.vertices.size() / MeshSourceVertexFloats);
+    header.indexCount = static_cast<uint32_t>(mesh.indices.size());
+    header.vertexOffset = sizeof(BinaryMeshHeader);
+    header.indexOffset = header.vertexOffset + mesh.vertices.size() * sizeof(float);
+
+    glm::vec3 minimum;
+    glm::vec3 maximum;
+    ComputeMeshBounds(mesh.vertices.data(), header.vertexCount, minimum, maximum);
+    memcpy(header.minimum, &minimum[0], sizeof(header.minimum));
+    memcpy(header.maximum, &maximum[0], sizeof(header.maximum));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(float));
+    file.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(uint32_t));
+    file.close();
+
+    if (!file)
+    {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+        return false;
+    }
+    return true;
+}
+
+//Nothing is parsed or copied, the mesh points into the mapping until UnloadMesh
+bool MapBinaryMesh(const char* path, LoadedMesh& mesh)
+{
+    if (!MapFile(path, mesh.file))
+        return false;
+
+    BinaryMeshHeader header;
+    bool valid = mesh.file.size >= sizeof(header);
+    if (valid)
+    {
+        memcpy(&header, mesh.file.data, sizeof(header));
+        uint64_t vertexBytes = static_cast<uint64_t>(header.vertexCount) * MeshSourceVertexFloats * sizeof(float);
+        uint64_t indexBytes = static_cast<uint64_t>(header.indexCount) * sizeof(uint32_t);
+        valid = memcmp(header.magic, BinaryMeshMagic, sizeof(header.magic)) == 0 && header.version == BinaryMeshVersion
+            && header.vertexFloats == MeshSourceVertexFloats && header.vertexOffset % 4 == 0 && header.indexOffset % 4 == 0
+            && header.vertexOffset <= mesh.file.size && vertexBytes <= mesh.file.size - header.vertexOffset
+            && header.indexOffset <= mesh.file.size && indexBytes <= mesh.file.size - header.indexOffset
+            && header.vertexCount > 0 && header.indexCount > 0 && header.indexCount % 3 == 0;
+    }
+
+    //Every index has to name a vertex, checked once here so nothing later reads past them
+    if (valid)
+    {
+        const uint32_t* indices = reinterpret_cast<const uint32_t*>(mesh.file.data + header.indexOffset);
+        for (uint32_t i = 0; i < header.indexCount && valid; i++)
+            valid = indices[i] < header.vertexCount;
+    }
+
+    if (!valid)
+    {
+        std::cout << "Invalid binary mesh: " << path << std::endl;
+        UnmapFile(mesh.file);
+        return false;
+    }
+
+    mesh.vertices = reinterpret_cast<const float*>(mesh.file.data + header.vertexOffset);
+    mesh.indices = reinterpret_cast<const uint32_t*>(mesh.file.data + header.indexOffset);
+    mesh.vertexCount = header.vertexCount;
+    mesh.indexCount = header.indexCount;
+    mesh.minimum = glm::make_vec3(header.minimum);
+    mesh.maximum = glm::make_vec3(header.maximum);
+    return true;
+}
+
+void UnloadMesh(LoadedMesh& mesh)
+{
+    UnmapFile(mesh.file);
+    mesh.imported = ImportedMesh();
+    mesh.vertices = nullptr;
+    mesh.indices = nullptr;
+    mesh.vertexCount = 0;
+    mesh.indexCount = 0;
+}
+
+//Maps the binary mesh next to the source when it is newer than the source. Otherwise the
+//source is imported and optimized, and the binary mesh written for the next run.
+bool LoadMeshFile(const MeshImportSettings& settings, JobSystem* jobSystem, LoadedMesh& mesh)
+{
+    const std::string& path = settings.path;
+    if (HasExtension(path, BinaryMeshExtension))
+        return MapBinaryMesh(path.c_str(), mesh);
+
+    std::string cachePath = path + BinaryMeshExtension;
+    std::error_code error;
+    auto sourceTime = std::filesystem::last_write_time(path, error);
+    if (error)
+    {
+        std::cout << "Failed to open mesh: " << path << std::endl;
+        return false;
+    }
+
+    auto cacheTime = std::filesystem::last_write_time(cachePath, error);
+    if (!settings.rebuildCache && !error && cacheTime >= sourceTime && MapBinaryMesh(cachePath.c_str(), mesh))
+    {
+        std::cout << "Mesh " << path << ": " << mesh.indexCount / 3 << " triangles from " << cachePath << std::endl;
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool imported = false;
+    if (HasExtension(path, ".obj"))
+        imported = ImportObjMesh(path.c_str(), jobSystem, mesh.imported);
+    else if (HasExtension(path, ".gltf") || HasExtension(path, ".glb"))
+        imported = ImportGltfMesh(path.c_str(), jobSystem, mesh.imported);
+    else
+        std::cout << "Unknown mesh type, expected .obj, .gltf, .glb or " << BinaryMeshExtension << ": " << path << std::endl;
+
+    if (!imported || mesh.imported.indices.empty())
+    {
+        if (imported)
+            std::cout << "No triangles in mesh: " << path << std::endl;
+        return false;
+    }
+
+    auto parsed = std::chrono::steady_clock::now();
+    PrintMeshOptimizeReport(path.c_str(), OptimizeMesh(mesh.imported.vertices, MeshSourceVertexFloats, mesh.imported.indices));
+    auto optimized = std::chrono::steady_clock::now();
+    std::cout << "Imported in " << std::chrono::duration<double, std::milli>(parsed - start).count() << " ms, optimized in "
+        << std::chrono::duration<double, std::milli>(optimized - parsed).count() << " ms" << std::endl;
+
+    //The imported arrays are only kept when the binary mesh can not be written or read back
+    if (WriteBinaryMesh(cachePath.c_str(), mesh.imported) && MapBinaryMesh(cachePath.c_str(), mesh))
+    {
+        mesh.imported = ImportedMesh();
+        return true;
+    }
+
+    std::cout << "Failed to write binary mesh: " << cachePath << std::endl;
+    mesh.vertices = mesh.imported.vertices.data();
+    mesh.indices = mesh.imported.indices.data();
+    mesh.vertexCount = static_cast<uint32_t>(mesh.imported.vertices.size() / MeshSourceVertexFloats);
+    mesh.indexCount = static_cast<uint32_t>(mesh.imported.indices.size());
+    ComputeMeshBounds(mesh.vertices, mesh.vertexCount, mesh.minimum, mesh.maximum);
+    return true;
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+//Post transform cache modelled as a FIFO of this many vertices, small enough that the
+//orderings hold up on older hardware too
+const int VertexCacheSize = 16;
+
+struct MeshOptimizeReport
+{
+    uint32_t vertexCountBefore = 0;
+    uint32_t vertexCountAfter = 0;
+    uint32_t triangleCount = 0;
+    uint32_t clusterCount = 0;
+    //Average cache miss ratio: transformed vertices per triangle, 0.5 at best and 3 at worst
+    float acmrBefore = 0.0f;
+    float acmrAfter = 0.0f;
+};
+
+float ComputeAcmr(const std::vector<uint32_t>& indices, uint32_t vertexCount, int cacheSize)
+{
+    if (indices.empty())
+        return 0.0f;
+
+    //Time each vertex entered the cache, it is evicted once cacheSize misses have followed
+    std::vector<int64_t> entered(vertexCount, INT64_MIN / 2);
+    int64_t misses = 0;
+    for (uint32_t index : indices)
+    {
+        if (misses - entered[index] >= cacheSize)
+        {
+            entered[index] = misses;
+            misses++;
+        }
+    }
+
+    return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
+
+//Merges bitwise identical vertices and rewrites the indices to match. Unreferenced
+//vertices are dropped.
+void DeduplicateVertices(std::vector<float>& vertices, int vertexFloats, std::vector<uint32_t>& indices)
+{
+    size_t vertexBytes = vertexFloats * sizeof(float);
+    std::vector<float> unique;
+    std::vector<uint32_t> remap(vertices.size() / vertexFloats, UINT32_MAX);
+    std::unordered_multimap<uint64_t, uint32_t> lookup;
+
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] != UINT32_MAX)
+        {
+            index = remap[index];
+            continue;
+        }
+
+        //FNV-1a over the vertex bytes
+        const float* vertex = &vertices[static_cast<size_t>(index) * vertexFloats];
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(vertex);
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < vertexBytes; i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+        uint32_t found = UINT32_MAX;
+        auto range = lookup.equal_range(hash);
+        for (auto candidate = range.first; candidate != range.second && found == UINT32_MAX; ++candidate)
+        {
+            if (memcmp(&unique[static_cast<size_t>(candidate->second) * vertexFloats], vertex, vertexBytes) == 0)
+                found = candidate->second;
+        }
+
+        if (found == UINT32_MAX)
+        {
+            found = static_cast<uint32_t>(unique.size() / vertexFloats);
+            unique.insert(unique.end(), vertex, vertex + vertexFloats);
+            lookup.emplace(hash, found);
+        }
+
+        remap[index] = found;
+        index = found;
+    }
+
+    vertices.swap(unique);
+}
+
+//Tipsify (Sander, Nehab and Barczak 2007): emits all remaining triangles around a fanning
+//vertex, then picks the next fanning vertex among the ones just emitted that will still be
+//in the cache. Linear time. Cluster starts are recorded wherever the order breaks, so the
+//clusters can be reordered afterwards without costing cache hits.
+void TipsifyIndices(std::vector<uint32_t>& indices, uint32_t vertexCount, int cacheSize, std::vector<uint32_t>& clusterStarts)
+{
+    const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+    //Triangles around each vertex
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (uint32_t index : indices)
+        adjacencyOffsets[index + 1]++;
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (uint32_t triangle = 0; triangle < triangleCount; triangle++)
+    {
+        for (int corner = 0; corner < 3; corner++)
+            adjacency[fill[indices[triangle * 3 + corner]]++] = triangle;
+    }
+
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    for (uint32_t vertex = 0; vertex < vertexCount; vertex++)
+        liveTriangles[vertex] = adjacencyOffsets[vertex + 1] - adjacencyOffsets[vertex];
+
+    std::vector<int64_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    clusterStarts.clear();
+
+    int64_t time = cacheSize + 1;
+    uint32_t cursor = 0;
+    bool broken = true;
+
+    //Any vertex with live triangles, most recently emitted first
+    auto skipDeadEnd = [&]() -> uint32_t
+    {
+        while (!deadEnds.empty())
+        {
+            uint32_t vertex = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[vertex] > 0)
+                return vertex;
+        }
+        while (cursor < vertexCount)
+        {
+            if (liveTriangles[cursor] > 0)
+                return cursor;
+            cursor++;
+        }
+        return UINT32_MAX;
+    };
+
+    uint32_t fanning = skipDeadEnd();
+    while (fanning != UINT32_MAX)
+    {
+        if (broken)
+            clusterStarts.push_back(static_cast<uint32_t>(output.size() / 3));
+
+        candidates.clear();
+        for (uint32_t i = adjacencyOffsets[fanning]; i < adjacencyOffsets[fanning + 1]; i++)
+        {
+            uint32_t triangle = adjacency[i];
+            if (emitted[triangle])
+                continue;
+
+            for (int corner = 0; corner < 3; corner++)
+            {
+                uint32_t vertex = indices[triangle * 3 + corner];
+                output.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                liveTriangles[vertex]--;
+                if (time - cacheTime[vertex] > cacheSize)
+                    cacheTime[vertex] = time++;
+            }
+            emitted[triangle] = true;
+        }
+
+        //Prefer the candidate that stays cached longest while its fan is emitted
+        uint32_t next = UINT32_MAX;
+        int64_t best = -1;
+        for (uint32_t vertex : candidates)
+        {
+            if (liveTriangles[vertex] == 0)
+                continue;
+
+            int64_t priority = 0;
+            if (time - cacheTime[vertex] + 2 * static_cast<int64_t>(liveTriangles[vertex]) <= cacheSize)
+                priority = time - cacheTime[vertex];
+            if (priority > best)
+            {
+                best = priority;
+                next = vertex;
+            }
+        }
+
+        broken = next == UINT32_MAX;
+        fanning = broken ? skipDeadEnd() : next;
+    }
+
+    indices.swap(output);
+}
+
+//Sorts the clusters so the ones facing outwards from the mesh center draw first. Those are
+//the most likely to occlude the rest, so later fragments fail the depth test early.
+void OrderClustersForOverdraw(const std::vector<float>& vertices, int vertexFloats, std::vector<uint32_t>& indices, const std::vector<uint32_t>& clusterStarts)
+{
+    const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+    if (clusterStarts.size() < 2)
+        return;
+
+    auto position = [&](uint32_t index)
+    {
+        const float* vertex = &vertices[static_cast<size_t>(index) * vertexFloats];
+        return glm::vec3(vertex[0], vertex[1], vertex[2]);
+    };
+
+    glm::vec3 meshCenter(0.0f);
+    for (uint32_t index : indices)
+        meshCenter += position(index);
+    meshCenter /= static_cast<float>(indices.size());
+
+    std::vector<float> sortKeys(clusterStarts.size());
+    for (size_t cluster = 0; cluster < clusterStarts.size(); cluster++)
+    {
+        uint32_t begin = clusterStarts[cluster];
+        uint32_t end = cluster + 1 < clusterStarts.size() ? clusterStarts[cluster + 1] : triangleCount;
+
+        //Area weighted, the cross product length is twice the triangle area
+        glm::vec3 center(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (uint32_t triangle = begin; triangle < end; triangle++)
+        {
+            glm::vec3 a = position(indices[triangle * 3 + 0]);
+            glm::vec3 b = position(indices[triangle * 3 + 1]);
+            glm::vec3 c = position(indices[triangle * 3 + 2]);
+            glm::vec3 cross = glm::cross(b - a, c - a);
+            float weight = glm::length(cross);
+            center += (a + b + c) * (weight / 3.0f);
+            normal += cross;
+            area += weight;
+        }
+
+        center = area > 0.0f ? center / area : center;
+        float normalLength = glm::length(normal);
+        sortKeys[cluster] = normalLength > 0.0f ? glm::dot(center - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<uint32_t> order(clusterStarts.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indices.size());
+    for (uint32_t cluster : order)
+    {
+        uint32_t begin = clusterStarts[cluster];
+        uint32_t end = cluster + 1 < clusterStarts.size() ? clusterStarts[cluster + 1] : triangleCount;
+        sorted.insert(sorted.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+    }
+    indices.swap(sorted);
+}
+
+//Renumbers the vertices in the order the indices first use them, so vertex fetches walk
+//forward through memory
+void ReorderVertexFetch(std::vector<float>& vertices, int vertexFloats, std::vector<uint32_t>& indices)
+{
+    std::vector<uint32_t> remap(vertices.size() / vertexFloats, UINT32_MAX);
+    std::vector<float> reordered;
+    reordered.reserve(vertices.size());
+
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] == UINT32_MAX)
+        {
+            remap[index] = static_cast<uint32_t>(reordered.size() / vertexFloats);
+            const float* vertex = &vertices[static_cast<size_t>(index) * vertexFloats];
+            reordered.insert(reordered.end(), vertex, vertex + vertexFloats);
+        }
+        index = remap[index];
+    }
+
+    vertices.swap(reordered);
+}
+
+//Import time pipeline for triangle lists: index, vertex cache order, overdraw order, fetch
+//order. The position is expected in the first three floats of each vertex.
+MeshOptimizeReport OptimizeMesh(std::vector<float>& vertices, int vertexFloats, std::vector<uint32_t>& indices)
+{
+    MeshOptimizeReport report;
+    report.vertexCountBefore = static_cast<uint32_t>(vertices.size() / vertexFloats);
+    report.triangleCount = static_cast<uint32_t>(indices.size() / 3);
+    report.acmrBefore = ComputeAcmr(indices, report.vertexCountBefore, VertexCacheSize);
+
+    DeduplicateVertices(vertices, vertexFloats, indices);
+    uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / vertexFloats);
+
+    std::vector<uint32_t> clusterStarts;
+    TipsifyIndices(indices, vertexCount, VertexCacheSize, clusterStarts);
+    OrderClustersForOverdraw(vertices, vertexFloats, indices, clusterStarts);
+    ReorderVertexFetch(vertices, vertexFloats, indices);
+
+    report.vertexCountAfter = static_cast<uint32_t>(vertices.size() / vertexFloats);
+    report.clusterCount = static_cast<uint32_t>(clusterStarts.size());
+    report.acmrAfter = ComputeAcmr(indices, report.vertexCountAfter, VertexCacheSize);
+    return report;
+}
+
+void PrintMeshOptimizeReport(const char* name, const MeshOptimizeReport& report)
+{
+    std::cout << std::fixed << std::setprecision(3) << name << ": " << report.triangleCount << " triangles, "
+        << report.vertexCountBefore << " -> " << report.vertexCountAfter << " vertices, ACMR "
+        << report.acmrBefore << " -> " << report.acmrAfter << ", " << report.clusterCount << " clusters" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
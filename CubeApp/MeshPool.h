@@ -0,0 +1,538 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "VertexFormat.h"
+
+const uint32_t MeshNull = UINT32_MAX;
+
+//TLSF size classes: the first level is the power of two, the second level splits each
+//power of two into 16 linear ranges. Sizes below 16 units all live in the first level.
+const int TlsfSecondLevelBits = 4;
+const int TlsfSecondLevelCount = 1 << TlsfSecondLevelBits;
+const int TlsfFirstLevelCount = 32 - TlsfSecondLevelBits + 1;
+
+//The index heap counts 16 bit units. Allocations are rounded to an even number of units,
+//so every offset stays aligned for 32 bit indices too.
+const size_t MeshIndexUnitBytes = sizeof(uint16_t);
+
+struct TlsfBlock
+{
+    uint32_t offset;
+    uint32_t size;
+    //Neighbours in offset order
+    uint32_t previous;
+    uint32_t next;
+    //Neighbours in the free list of the size class, only while free
+    uint32_t previousFree;
+    uint32_t nextFree;
+    bool free;
+    //Mesh owning the block, only while allocated
+    uint32_t mesh;
+};
+
+//Two level segregated fit allocator over a range of units. Allocation and free are O(1),
+//free blocks are merged with their neighbours right away.
+struct TlsfAllocator
+{
+    std::vector<TlsfBlock> blocks;
+    std::vector<uint32_t> unusedBlocks;
+
+    uint32_t firstLevelMap = 0;
+    uint32_t secondLevelMaps[TlsfFirstLevelCount] = {};
+    uint32_t freeLists[TlsfFirstLevelCount][TlsfSecondLevelCount];
+
+    uint32_t first = MeshNull;
+    uint32_t last = MeshNull;
+
+    uint32_t capacity = 0;
+    uint32_t used = 0;
+    uint32_t freeBlockCount = 0;
+};
+
+struct MeshRange
+{
+    //MeshNull while the slot is unused
+    uint32_t vertexBlock = MeshNull;
+    uint32_t indexBlock = MeshNull;
+    uint32_t indexCount = 0;
+    //16 bit whenever the mesh has few enough vertices. Indices are relative to the first
+    //vertex of the mesh.
+    GLenum indexType = GL_UNSIGNED_INT;
+    MeshDecode decode;
+};
+
+//Many meshes of one vertex format in a single vertex and index buffer behind one vertex
+//array, drawn with glDrawElementsBaseVertex. Meshes are referred to by handle, so the
+//allocations can move when the pool grows or is defragmented.
+struct MeshPool
+{
+    MeshVertexFormat format = MeshVertexFloat;
+    uint32_t vertexStride = 0;
+
+    GLuint vertexArray = 0;
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+
+    //Staging for moves whose source and destination overlap
+    GLuint scratchBuffer = 0;
+    size_t scratchBytes = 0;
+
+    TlsfAllocator vertices;
+    TlsfAllocator indices;
+
+    std::vector<MeshRange> meshes;
+    std::vector<uint32_t> freeMeshes;
+
+    //Upload scratch, kept between meshes
+    std::vector<uint8_t> encodedVertices;
+    std::vector<uint16_t> shortIndices;
+
+    //Statistics
+    size_t defragmentedBytes = 0;
+};
+
+void MapTlsfSize(uint32_t size, int& firstLevel, int& secondLevel)
+{
+    if (size < TlsfSecondLevelCount)
+    {
+        firstLevel = 0;
+        secondLevel = static_cast<int>(size);
+        return;
+    }
+
+    int log = std::bit_width(size) - 1;
+    firstLevel = log - TlsfSecondLevelBits + 1;
+    secondLevel = static_cast<int>((size >> (log - TlsfSecondLevelBits)) - TlsfSecondLevelCount);
+}
+
+void InsertTlsfFreeBlock(TlsfAllocator& allocator, uint32_t index)
+{
+    TlsfBlock& block = allocator.blocks[index];
+    int firstLevel;
+    int secondLevel;
+    MapTlsfSize(block.size, firstLevel, secondLevel);
+
+    uint32_t& head = allocator.freeLists[firstLevel][secondLevel];
+    block.previousFree = MeshNull;
+    block.nextFree = (allocator.secondLevelMaps[firstLevel] & (1u << secondLevel)) != 0 ? head : MeshNull;
+    if (block.nextFree != MeshNull)
+        allocator.blocks[block.nextFree].previousFree = index;
+    head = index;
+
+    allocator.firstLevelMap |= 1u << firstLevel;
+    allocator.secondLevelMaps[firstLevel] |= 1u << secondLevel;
+    allocator.freeBlockCount++;
+}
+
+void RemoveTlsfFreeBlock(TlsfAllocator& allocator, uint32_t index)
+{
+    TlsfBlock& block = allocator.blocks[index];
+    int firstLevel;
+    int secondLevel;
+    MapTlsfSize(block.size, firstLevel, secondLevel);
+
+    if (block.previousFree != MeshNull)
+        allocator.blocks[block.previousFree].nextFree = block.nextFree;
+    else
+        allocator.freeLists[firstLevel][secondLevel] = block.nextFree;
+    if (block.nextFree != MeshNull)
+        allocator.blocks[block.nextFree].previousFree = block.previousFree;
+
+    if (block.previousFree == MeshNull && block.nextFree == MeshNull)
+    {
+        allocator.secondLevelMaps[firstLevel] &= ~(1u << secondLevel);
+        if (allocator.secondLevelMaps[firstLevel] == 0)
+            allocator.firstLevelMap &= ~(1u << firstLevel);
+    }
+    allocator.freeBlockCount--;
+}
+
+uint32_t NewTlsfBlock(TlsfAllocator& allocator)
+{
+    if (!allocator.unusedBlocks.empty())
+    {
+        uint32_t index = allocator.unusedBlocks.back();
+        allocator.unusedBlocks.pop_back();
+        return index;
+    }
+
+    allocator.blocks.emplace_back();
+    return static_cast<uint32_t>(allocator.blocks.size() - 1);
+}
+
+//Links block b in right after block a in offset order
+void LinkTlsfBlockAfter(TlsfAllocator& allocator, uint32_t a, uint32_t b)
+{
+    uint32_t next = allocator.blocks[a].next;
+    allocator.blocks[b].previous = a;
+    allocator.blocks[b].next = next;
+    allocator.blocks[a].next = b;
+    if (next != MeshNull)
+        allocator.blocks[next].previous = b;
+    else
+        allocator.last = b;
+}
+
+void UnlinkTlsfBlock(TlsfAllocator& allocator, uint32_t index)
+{
+    const TlsfBlock& block = allocator.blocks[index];
+    if (block.previous != MeshNull)
+        allocator.blocks[block.previous].next = block.next;
+    else
+        allocator.first = block.next;
+    if (block.next != MeshNull)
+        allocator.blocks[block.next].previous = block.previous;
+    else
+        allocator.last = block.previous;
+    allocator.unusedBlocks.push_back(index);
+}
+
+void InitializeTlsf(TlsfAllocator& allocator, uint32_t capacity)
+{
+    allocator = TlsfAllocator();
+    allocator.capacity = capacity;
+
+    uint32_t index = NewTlsfBlock(allocator);
+    allocator.blocks[index] = { 0, capacity, MeshNull, MeshNull, MeshNull, MeshNull, true, MeshNull };
+    allocator.first = index;
+    allocator.last = index;
+    InsertTlsfFreeBlock(allocator, index);
+}
+
+//Good fit: rounds the request up to the next size class, so any block in the first
+//non-empty class at or above it is large enough
+uint32_t TlsfAllocate(TlsfAllocator& allocator, uint32_t size)
+{
+    uint32_t rounded = size;
+    if (size >= TlsfSecondLevelCount)
+        rounded += (1u << (std::bit_width(size) - 1 - TlsfSecondLevelBits)) - 1;
+
+    int firstLevel;
+    int secondLevel;
+    MapTlsfSize(rounded, firstLevel, secondLevel);
+    if (firstLevel >= TlsfFirstLevelCount)
+        return MeshNull;
+
+    uint32_t secondLevelMap = allocator.secondLevelMaps[firstLevel] & (~0u << secondLevel);
+    if (secondLevelMap == 0)
+    {
+        uint32_t firstLevelMap = allocator.firstLevelMap & (~0u << (firstLevel + 1));
+        if (firstLevelMap == 0)
+            return MeshNull;
+        firstLevel = std::countr_zero(firstLevelMap);
+        secondLevelMap = allocator.secondLevelMaps[firstLevel];
+    }
+    secondLevel = std::countr_zero(secondLevelMap);
+
+    uint32_t index = allocator.freeLists[firstLevel][secondLevel];
+    RemoveTlsfFreeBlock(allocator, index);
+
+    //Split off the tail
+    if (allocator.blocks[index].size > size)
+    {
+        uint32_t remainder = NewTlsfBlock(allocator);
+        TlsfBlock& block = allocator.blocks[index];
+        allocator.blocks[remainder] = { block.offset + size, block.size - size, MeshNull, MeshNull, MeshNull, MeshNull, true, MeshNull };
+        block.size = size;
+        LinkTlsfBlockAfter(allocator, index, remainder);
+        InsertTlsfFreeBlock(allocator, remainder);
+    }
+
+    allocator.blocks[index].free = false;
+    allocator.used += size;
+    return index;
+}
+
+void TlsfFree(TlsfAllocator& allocator, uint32_t index)
+{
+    allocator.used -= allocator.blocks[index].size;
+    allocator.blocks[index].free = true;
+    allocator.blocks[index].mesh = MeshNull;
+
+    uint32_t next = allocator.blocks[index].next;
+    if (next != MeshNull && allocator.blocks[next].free)
+    {
+        RemoveTlsfFreeBlock(allocator, next);
+        allocator.blocks[index].size += allocator.blocks[next].size;
+        UnlinkTlsfBlock(allocator, next);
+    }
+
+    uint32_t previous = allocator.blocks[index].previous;
+    if (previous != MeshNull && allocator.blocks[previous].free)
+    {
+        RemoveTlsfFreeBlock(allocator, previous);
+        allocator.blocks[previous].size += allocator.blocks[index].size;
+        UnlinkTlsfBlock(allocator, index);
+        index = previous;
+    }
+
+    InsertTlsfFreeBlock(allocator, index);
+}
+
+void GrowTlsf(TlsfAllocator& allocator, uint32_t capacity)
+{
+    uint32_t added = capacity - allocator.capacity;
+    allocator.capacity = capacity;
+
+    uint32_t last = allocator.last;
+    if (allocator.blocks[last].free)
+    {
+        RemoveTlsfFreeBlock(allocator, last);
+        allocator.blocks[last].size += added;
+        InsertTlsfFreeBlock(allocator, last);
+        return;
+    }
+
+    uint32_t index = NewTlsfBlock(allocator);
+    allocator.blocks[index] = { capacity - added, added, MeshNull, MeshNull, MeshNull, MeshNull, true, MeshNull };
+    LinkTlsfBlockAfter(allocator, last, index);
+    InsertTlsfFreeBlock(allocator, index);
+}
+
+//Swaps an allocated block with the free block in front of it, so the free space moves up.
+//The caller moves the data; the block's offset before the swap is returned.
+uint32_t SlideTlsfBlock(TlsfAllocator& allocator, uint32_t index)
+{
+    uint32_t hole = allocator.blocks[index].previous;
+    uint32_t source = allocator.blocks[index].offset;
+
+    //The hole keeps its size, so it stays in the same free list
+    allocator.blocks[index].offset = allocator.blocks[hole].offset;
+    allocator.blocks[hole].offset = allocator.blocks[index].offset + allocator.blocks[index].size;
+
+    uint32_t before = allocator.blocks[hole].previous;
+    uint32_t after = allocator.blocks[index].next;
+    allocator.blocks[index].previous = before;
+    allocator.blocks[index].next = hole;
+    allocator.blocks[hole].previous = index;
+    allocator.blocks[hole].next = after;
+    if (before != MeshNull)
+        allocator.blocks[before].next = index;
+    else
+        allocator.first = index;
+    if (after != MeshNull)
+        allocator.blocks[after].previous = hole;
+    else
+        allocator.last = hole;
+
+    if (after != MeshNull && allocator.blocks[after].free)
+    {
+        RemoveTlsfFreeBlock(allocator, hole);
+        RemoveTlsfFreeBlock(allocator, after);
+        allocator.blocks[hole].size += allocator.blocks[after].size;
+        UnlinkTlsfBlock(allocator, after);
+        InsertTlsfFreeBlock(allocator, hole);
+    }
+
+    return source;
+}
+
+void BindMeshPoolVertexArray(MeshPool& pool)
+{
+    glBindVertexArray(pool.vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+
+    for (const MeshVertexAttribute& attribute : GetVertexAttributes(pool.format))
+    {
+        glVertexAttribPointer(attribute.index, attribute.size, attribute.type, attribute.normalized, pool.vertexStride, (void*)static_cast<size_t>(attribute.offset));
+        glEnableVertexAttribArray(attribute.index);
+    }
+
+    glBindVertexArray(0);
+}
+
+//Capacities are in vertices and 16 bit indices
+void CreateMeshPool(MeshPool& pool, MeshVertexFormat format, uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+    pool.format = format;
+    pool.vertexStride = GetVertexStride(format);
+    indexCapacity += indexCapacity & 1;
+
+    glGenVertexArrays(1, &pool.vertexArray);
+    glGenBuffers(1, &pool.vertexBuffer);
+    glGenBuffers(1, &pool.indexBuffer);
+    glGenBuffers(1, &pool.scratchBuffer);
+
+    //Uploads go through the copy targets, so the bound vertex array is never touched
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<size_t>(vertexCapacity) * pool.vertexStride, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<size_t>(indexCapacity) * MeshIndexUnitBytes, nullptr, GL_STATIC_DRAW);
+
+    InitializeTlsf(pool.vertices, vertexCapacity);
+    InitializeTlsf(pool.indices, indexCapacity);
+
+    BindMeshPoolVertexArray(pool);
+}
+
+//Reallocates a buffer and copies the old contents over on the GPU
+void ResizeMeshPoolBuffer(GLuint& buffer, size_t oldBytes, size_t newBytes)
+{
+    GLuint resized;
+    glGenBuffers(1, &resized);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+    glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+
+    glDeleteBuffers(1, &buffer);
+    buffer = resized;
+}
+
+//Allocates from the heap, doubling it and the buffer behind it until the request fits
+uint32_t AllocateMeshPoolBlock(MeshPool& pool, TlsfAllocator& allocator, GLuint& buffer, size_t unitBytes, uint32_t size)
+{
+    uint32_t block = TlsfAllocate(allocator, size);
+    if (block != MeshNull)
+        return block;
+
+    uint32_t capacity = std::max(allocator.capacity, 1u);
+    while (capacity < allocator.capacity + size)
+        capacity *= 2;
+
+    ResizeMeshPoolBuffer(buffer, allocator.capacity * unitBytes, capacity * unitBytes);
+    GrowTlsf(allocator, capacity);
+    BindMeshPoolVertexArray(pool);
+
+    return TlsfAllocate(allocator, size);
+}
+
+//Converts the mesh from the source layout (MeshSourceVertexFloats per vertex) to the pool
+//format, copies it in and returns its handle. Meshes must not be empty. Render thread only.
+uint32_t AddMesh(MeshPool& pool, const float* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount)
+{
+    uint32_t mesh;
+    if (!pool.freeMeshes.empty())
+    {
+        mesh = pool.freeMeshes.back();
+        pool.freeMeshes.pop_back();
+    }
+    else
+    {
+        mesh = static_cast<uint32_t>(pool.meshes.size());
+        pool.meshes.emplace_back();
+    }
+
+    MeshRange& range = pool.meshes[mesh];
+    range.indexCount = indexCount;
+    range.indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    EncodeVertices(pool.format, vertices, vertexCount, pool.encodedVertices, range.decode);
+
+    const void* indexData = indices;
+    size_t indexBytes = static_cast<size_t>(indexCount) * sizeof(uint32_t);
+    if (range.indexType == GL_UNSIGNED_SHORT)
+    {
+        pool.shortIndices.assign(indices, indices + indexCount);
+        indexData = pool.shortIndices.data();
+        indexBytes = static_cast<size_t>(indexCount) * sizeof(uint16_t);
+    }
+    uint32_t indexUnits = static_cast<uint32_t>(indexBytes / MeshIndexUnitBytes);
+
+    range.vertexBlock = AllocateMeshPoolBlock(pool, pool.vertices, pool.vertexBuffer, pool.vertexStride, vertexCount);
+    range.indexBlock = AllocateMeshPoolBlock(pool, pool.indices, pool.indexBuffer, MeshIndexUnitBytes, indexUnits + (indexUnits & 1));
+    pool.vertices.blocks[range.vertexBlock].mesh = mesh;
+    pool.indices.blocks[range.indexBlock].mesh = mesh;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<size_t>(pool.vertices.blocks[range.vertexBlock].offset) * pool.vertexStride,
+        pool.encodedVertices.size(), pool.encodedVertices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<size_t>(pool.indices.blocks[range.indexBlock].offset) * MeshIndexUnitBytes,
+        indexBytes, indexData);
+
+    return mesh;
+}
+
+void RemoveMesh(MeshPool& pool, uint32_t mesh)
+{
+    MeshRange& range = pool.meshes[mesh];
+    TlsfFree(pool.vertices, range.vertexBlock);
+    TlsfFree(pool.indices, range.indexBlock);
+    range = MeshRange();
+    pool.freeMeshes.push_back(mesh);
+}
+
+GLint GetMeshBaseVertex(const MeshPool& pool, uint32_t mesh)
+{
+    return static_cast<GLint>(pool.vertices.blocks[pool.meshes[mesh].vertexBlock].offset);
+}
+
+const void* GetMeshIndexOffset(const MeshPool& pool, uint32_t mesh)
+{
+    return (const void*)(static_cast<size_t>(pool.indices.blocks[pool.meshes[mesh].indexBlock].offset) * MeshIndexUnitBytes);
+}
+
+//GPU copy between ranges of the same buffer. Overlapping ranges are not allowed by
+//glCopyBufferSubData, so those are staged through the scratch buffer.
+void MoveMeshPoolBytes(MeshPool& pool, GLuint buffer, size_t source, size_t destination, size_t bytes)
+{
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (destination + bytes <= source)
+    {
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source, destination, bytes);
+        return;
+    }
+
+    if (pool.scratchBytes < bytes)
+    {
+        pool.scratchBytes = std::max(bytes, pool.scratchBytes * 2);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.scratchBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, pool.scratchBytes, nullptr, GL_STREAM_COPY);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.scratchBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source, 0, bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, pool.scratchBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, destination, bytes);
+}
+
+//Slides allocations down into the holes in front of them, lowest first, until maxBytes
+//have been moved. Every move pushes its hole up into the next one, so repeated calls end
+//with all free space in one block at the top.
+size_t DefragmentMeshPoolHeap(MeshPool& pool, TlsfAllocator& allocator, GLuint buffer, size_t unitBytes, size_t maxBytes)
+{
+    //Nothing to do when the only free block is the last one
+    if (allocator.freeBlockCount == 0 || (allocator.freeBlockCount == 1 && allocator.blocks[allocator.last].free))
+        return 0;
+
+    size_t moved = 0;
+    uint32_t index = allocator.first;
+    while (index != MeshNull && moved < maxBytes)
+    {
+        uint32_t next = allocator.blocks[index].next;
+        if (!allocator.blocks[index].free || next == MeshNull || allocator.blocks[next].free)
+        {
+            index = next;
+            continue;
+        }
+
+        size_t bytes = allocator.blocks[next].size * unitBytes;
+        uint32_t source = SlideTlsfBlock(allocator, next);
+        MoveMeshPoolBytes(pool, buffer, source * unitBytes, allocator.blocks[next].offset * unitBytes, bytes);
+        moved += bytes;
+    }
+
+    return moved;
+}
+
+//Incremental compaction with a per call byte budget. Handles stay valid, draws pick up the
+//new offsets when they are executed.
+size_t DefragmentMeshPool(MeshPool& pool, size_t maxBytes)
+{
+    size_t moved = DefragmentMeshPoolHeap(pool, pool.vertices, pool.vertexBuffer, pool.vertexStride, maxBytes);
+    if (moved < maxBytes)
+        moved += DefragmentMeshPoolHeap(pool, pool.indices, pool.indexBuffer, MeshIndexUnitBytes, maxBytes - moved);
+
+    pool.defragmentedBytes += moved;
+    return moved;
+}
@@ -0,0 +1,672 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "MeshPool.h"
+#include "StreamBuffer.h"
+
+//Sort key layout, most significant bits first
+//Opaque:      pass(4) | program(8) | material(12) | mesh(12) | depth(24) | unused(4)
+//Transparent: pass(4) | inverted depth(24) | program(8) | material(12) | mesh(12) | unused(4)
+const int RenderKeyPassShift = 60;
+const int RenderKeyDepthBits = 24;
+
+const uint64_t RenderKeyProgramMask = 0xFF;
+const uint64_t RenderKeyMaterialMask = 0xFFF;
+const uint64_t RenderKeyMeshMask = 0xFFF;
+const uint64_t RenderKeyDepthMask = (1ull << RenderKeyDepthBits) - 1;
+
+//Uniform block binding of RenderPassBlock, and the first of the four model matrix columns
+const GLuint RenderPassUniformBinding = 0;
+const GLuint InstanceModelAttribute = 3;
+
+//Passes execute in this order
+enum RenderPass
+{
+    RenderPassCameraOccluders = 0,
+    RenderPassLightOccluders = 1,
+    RenderPassShadow = 2,
+    RenderPassDepthPrepass = 3,
+    RenderPassOpaque = 4,
+    RenderPassTransparent = 5,
+    RenderPassCount
+};
+
+struct RenderPassState
+{
+    GLuint framebuffer = 0;
+    glm::ivec4 viewport = glm::ivec4(0);
+    GLbitfield clearMask = 0;
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    float farPlane = 100.0f;
+
+    GLenum depthFunc = GL_LESS;
+    GLboolean depthWrite = GL_TRUE;
+    GLboolean colorWrite = GL_TRUE;
+
+    //GL_SAMPLES_PASSED query wrapped around the pass when not 0
+    GLuint samplesQuery = 0;
+};
+
+//std140 layout of the Pass uniform block
+struct RenderPassBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+
+struct DrawCall
+{
+    GLuint vertexArrayObject = 0;
+    GLsizei count = 0;
+    //GL_NONE draws with glDrawArrays
+    GLenum indexType = GL_NONE;
+    //Handle in the queue's mesh pool, its offsets are looked up when the draw executes
+    uint32_t mesh = MeshNull;
+};
+
+struct RenderCommand
+{
+    GLuint program;
+    GLuint texture;
+    DrawCall draw;
+    glm::mat4 model;
+};
+
+//Run of sorted commands drawn with one instanced call
+struct RenderBatch
+{
+    uint32_t first;
+    uint32_t count;
+    //Model matrices in the stream buffer, unless they did not fit this frame
+    GLintptr instances;
+    bool streamed;
+    //Set on the first of a run of batches submitted with one multi draw: the run length and
+    //where its indirect commands are
+    uint32_t multiDrawCount;
+    GLintptr indirect;
+};
+
+//Draw whose model matrices a GPU pass wrote to instanceBuffer. With an indirect buffer the
+//GPU reads the whole command, instance count included, otherwise instanceCount is drawn.
+struct InstancedDraw
+{
+    RenderPass pass;
+    GLuint program;
+    GLuint texture;
+    DrawCall draw;
+    GLuint instanceBuffer;
+    GLuint indirectBuffer;
+    GLintptr indirectOffset;
+    GLsizei instanceCount;
+};
+
+//Layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct RenderQueue
+{
+    RenderPassState passes[RenderPassCount];
+
+    std::vector<RenderCommand> commands;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+
+    //Radix sort scratch, kept between frames to avoid reallocating
+    std::vector<uint64_t> sortedKeys;
+    std::vector<uint64_t> scratchKeys;
+    std::vector<uint32_t> scratchOrder;
+
+    std::vector<RenderBatch> batches;
+    std::vector<InstancedDraw> instancedDraws;
+    GLintptr passBlocks[RenderPassCount] = {};
+
+    //Work run between a pass and the next one, such as reading the depth a pass wrote.
+    //Reset by ClearRenderQueue, GL state is assumed unknown afterwards.
+    std::function<void()> afterPass[RenderPassCount];
+
+    //Programs whose Pass block is bound to RenderPassUniformBinding
+    std::vector<GLuint> preparedPrograms;
+
+    //Pool that pooled draw calls refer to
+    const MeshPool* meshPool = nullptr;
+
+    //Pooled batches sharing their state are submitted with one glMultiDrawElementsIndirect
+    //when the context has it (GL 4.3), otherwise every batch is its own instanced call
+    bool multiDrawIndirect = true;
+    //Stream buffer offset of the model matrices of all commands, in sorted order
+    GLintptr instanceModels = 0;
+
+    //Statistics from the last execute
+    uint32_t drawCount = 0;
+    uint32_t instanceCount = 0;
+    uint32_t stateChangeCount = 0;
+};
+
+//--multi-draw on|off
+bool ParseRenderQueueArguments(int argc, char** argv, RenderQueue& queue)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--multi-draw") != 0)
+            continue;
+
+        const char* value = argv[++i];
+        if (strcmp(value, "on") == 0)
+            queue.multiDrawIndirect = true;
+        else if (strcmp(value, "off") == 0)
+            queue.multiDrawIndirect = false;
+        else
+        {
+            std::cout << "Invalid value for --multi-draw, expected on or off" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+DrawCall MakeMeshDrawCall(const MeshPool& pool, uint32_t mesh)
+{
+    DrawCall draw;
+    draw.vertexArrayObject = pool.vertexArray;
+    draw.count = static_cast<GLsizei>(pool.meshes[mesh].indexCount);
+    draw.indexType = pool.meshes[mesh].indexType;
+    draw.mesh = mesh;
+    return draw;
+}
+
+void ClearRenderQueue(RenderQueue& queue)
+{
+    queue.commands.clear();
+    queue.keys.clear();
+    queue.instancedDraws.clear();
+    for (int pass = 0; pass < RenderPassCount; pass++)
+        queue.afterPass[pass] = nullptr;
+}
+
+uint64_t QuantizeDepth(float viewDepth, float farPlane)
+{
+    float normalized = std::clamp(viewDepth / farPlane, 0.0f, 1.0f);
+    return static_cast<uint64_t>(normalized * static_cast<float>(RenderKeyDepthMask)) & RenderKeyDepthMask;
+}
+
+uint64_t MakeRenderKey(RenderPass pass, GLuint program, GLuint material, GLuint mesh, float viewDepth, float farPlane)
+{
+    uint64_t state = ((program & RenderKeyProgramMask) << 24) | ((material & RenderKeyMaterialMask) << 12) | (mesh & RenderKeyMeshMask);
+    uint64_t depth = QuantizeDepth(viewDepth, farPlane);
+    uint64_t key = static_cast<uint64_t>(pass) << RenderKeyPassShift;
+
+    if (pass == RenderPassTransparent)
+    {
+        //Back to front
+        key |= (RenderKeyDepthMask - depth) << 36;
+        key |= state << 4;
+    }
+    else
+    {
+        //State first, then front to back for early-Z
+        key |= state << 28;
+        key |= depth << 4;
+    }
+
+    return key;
+}
+
+void SubmitRenderCommand(RenderQueue& queue, RenderPass pass, GLuint program, GLuint texture, const DrawCall& draw, const glm::mat4& model)
+{
+    const RenderPassState& passState = queue.passes[pass];
+
+    //View space depth of the object origin
+    glm::vec4 viewPosition = passState.view * model[3];
+    float viewDepth = -viewPosition.z;
+
+    //Pooled meshes share a vertex array, sorting on the mesh keeps copies together for instancing
+    GLuint mesh = draw.mesh != MeshNull ? draw.mesh : draw.vertexArrayObject;
+    queue.keys.push_back(MakeRenderKey(pass, program, texture, mesh, viewDepth, passState.farPlane));
+    queue.commands.push_back({ program, texture, draw, model });
+}
+
+//Drawn after the pass's sorted commands, they need no sorting or batching
+void SubmitInstancedDraw(RenderQueue& queue, const InstancedDraw& draw)
+{
+    queue.instancedDraws.push_back(draw);
+}
+
+//LSD radix sort on 8 bit digits, stable. Digits where every key is equal are skipped,
+//which is the common case for the pass and program bytes.
+void SortRenderQueue(RenderQueue& queue)
+{
+    const size_t count = queue.keys.size();
+
+    queue.order.resize(count);
+    queue.sortedKeys.assign(queue.keys.begin(), queue.keys.end());
+    for (uint32_t i = 0; i < count; i++)
+        queue.order[i] = i;
+
+    if (count < 2)
+        return;
+
+    queue.scratchKeys.resize(count);
+    queue.scratchOrder.resize(count);
+
+    //All histograms in a single read of the keys
+    uint32_t histograms[8][256] = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t key = queue.sortedKeys[i];
+        for (int digit = 0; digit < 8; digit++)
+            histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+    }
+
+    uint64_t* keysIn = queue.sortedKeys.data();
+    uint64_t* keysOut = queue.scratchKeys.data();
+    uint32_t* orderIn = queue.order.data();
+    uint32_t* orderOut = queue.scratchOrder.data();
+
+    for (int digit = 0; digit < 8; digit++)
+    {
+        uint32_t* histogram = histograms[digit];
+        int shift = digit * 8;
+
+        if (histogram[(keysIn[0] >> shift) & 0xFF] == count)
+            continue;
+
+        //Exclusive prefix sum
+        uint32_t offsets[256];
+        uint32_t sum = 0;
+        for (int bucket = 0; bucket < 256; bucket++)
+        {
+            offsets[bucket] = sum;
+            sum += histogram[bucket];
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t destination = offsets[(keysIn[i] >> shift) & 0xFF]++;
+            keysOut[destination] = keysIn[i];
+            orderOut[destination] = orderIn[i];
+        }
+
+        std::swap(keysIn, keysOut);
+        std::swap(orderIn, orderOut);
+    }
+
+    //Odd number of scatter passes leaves the result in the scratch buffers
+    if (orderIn != queue.order.data())
+    {
+        std::copy(orderIn, orderIn + count, queue.order.data());
+        std::copy(keysIn, keysIn + count, queue.sortedKeys.data());
+    }
+}
+
+void PrepareRenderProgram(RenderQueue& queue, GLuint program)
+{
+    if (std::find(queue.preparedPrograms.begin(), queue.preparedPrograms.end(), program) != queue.preparedPrograms.end())
+        return;
+
+    GLuint block = glGetUniformBlockIndex(program, "Pass");
+    if (block != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, block, RenderPassUniformBinding);
+    queue.preparedPrograms.push_back(program);
+}
+
+void BeginRenderPass(const RenderPassState& passState)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, passState.framebuffer);
+    glViewport(passState.viewport.x, passState.viewport.y, passState.viewport.z, passState.viewport.w);
+
+    //Clears are masked too, so they run with every write enabled
+    if (passState.clearMask != 0)
+    {
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glClear(passState.clearMask);
+    }
+
+    glDepthFunc(passState.depthFunc);
+    glDepthMask(passState.depthWrite);
+    glColorMask(passState.colorWrite, passState.colorWrite, passState.colorWrite, passState.colorWrite);
+}
+
+//Leaves the default depth and color state for whatever renders after the queue
+void EndRenderPasses()
+{
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+//Compact vertex formats store positions relative to the mesh bounds
+MeshDecode GetDrawDecode(const RenderQueue& queue, const DrawCall& draw)
+{
+    return draw.mesh != MeshNull ? queue.meshPool->meshes[draw.mesh].decode : MeshDecode();
+}
+
+bool CanBatchRenderCommands(const RenderCommand& a, const RenderCommand& b)
+{
+    return a.program == b.program && a.texture == b.texture && a.draw.vertexArrayObject == b.draw.vertexArrayObject
+        && a.draw.mesh == b.draw.mesh && a.draw.count == b.draw.count && a.draw.indexType == b.draw.indexType;
+}
+
+bool UseMultiDrawIndirect(const RenderQueue& queue)
+{
+    return queue.multiDrawIndirect && GLAD_GL_VERSION_4_3 != 0;
+}
+
+//Batches that can share one multi draw: same pass and state, drawn from the mesh pool with
+//the same index type. Each keeps its own mesh, count and instances in its command.
+bool CanMultiDrawRenderBatches(const RenderQueue& queue, const RenderBatch& a, const RenderBatch& b)
+{
+    const RenderCommand& first = queue.commands[queue.order[a.first]];
+    const RenderCommand& second = queue.commands[queue.order[b.first]];
+    return b.streamed && second.draw.mesh != MeshNull && queue.sortedKeys[a.first] >> RenderKeyPassShift == queue.sortedKeys[b.first] >> RenderKeyPassShift
+        && first.program == second.program && first.texture == second.texture && first.draw.vertexArrayObject == second.draw.vertexArrayObject
+        && first.draw.indexType == second.draw.indexType;
+}
+
+//Fills one indirect command per batch and marks the runs that share state. Base instance
+//selects the batch's model matrices within the frame's instance data.
+void BuildMultiDrawCommands(RenderQueue& queue, StreamBuffer& stream)
+{
+    GLintptr indirect = 0;
+    DrawElementsIndirectCommand* commands = static_cast<DrawElementsIndirectCommand*>(
+        AllocateStream(stream, queue.batches.size() * sizeof(DrawElementsIndirectCommand), sizeof(GLuint), indirect));
+    if (commands == nullptr)
+        return;
+
+    size_t first = 0;
+    while (first < queue.batches.size())
+    {
+        RenderBatch& batch = queue.batches[first];
+        if (!batch.streamed || queue.commands[queue.order[batch.first]].draw.mesh == MeshNull)
+        {
+            first++;
+            continue;
+        }
+
+        size_t end = first + 1;
+        while (end < queue.batches.size() && CanMultiDrawRenderBatches(queue, batch, queue.batches[end]))
+            end++;
+
+        batch.multiDrawCount = static_cast<uint32_t>(end - first);
+        batch.indirect = indirect + static_cast<GLintptr>(first * sizeof(DrawElementsIndirectCommand));
+        for (size_t i = first; i < end; i++)
+        {
+            const DrawCall& draw = queue.commands[queue.order[queue.batches[i].first]].draw;
+            GLuint indexBytes = draw.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+
+            DrawElementsIndirectCommand& command = commands[i];
+            command.count = static_cast<GLuint>(draw.count);
+            command.instanceCount = queue.batches[i].count;
+            command.firstIndex = static_cast<GLuint>(reinterpret_cast<size_t>(GetMeshIndexOffset(*queue.meshPool, draw.mesh)) / indexBytes);
+            command.baseVertex = GetMeshBaseVertex(*queue.meshPool, draw.mesh);
+            command.baseInstance = queue.batches[i].first;
+        }
+        first = end;
+    }
+}
+
+//Splits the sorted commands into runs of the same draw in the same pass and streams
+//their model matrices
+void BuildRenderBatches(RenderQueue& queue, StreamBuffer& stream)
+{
+    queue.batches.clear();
+
+    //One block for the whole frame, so a batch's matrices are found by its first command
+    const size_t count = queue.order.size();
+    glm::mat4* models = static_cast<glm::mat4*>(AllocateStream(stream, count * sizeof(glm::mat4), sizeof(glm::vec4), queue.instanceModels));
+
+    size_t first = 0;
+    while (first < count)
+    {
+        const RenderCommand& command = queue.commands[queue.order[first]];
+        uint64_t pass = queue.sortedKeys[first] >> RenderKeyPassShift;
+
+        size_t end = first + 1;
+        while (end < count && queue.sortedKeys[end] >> RenderKeyPassShift == pass && CanBatchRenderCommands(command, queue.commands[queue.order[end]]))
+            end++;
+
+        RenderBatch batch;
+        batch.first = static_cast<uint32_t>(first);
+        batch.count = static_cast<uint32_t>(end - first);
+        batch.instances = queue.instanceModels + static_cast<GLintptr>(first * sizeof(glm::mat4));
+        batch.streamed = models != nullptr;
+        batch.multiDrawCount = 0;
+        batch.indirect = 0;
+        if (batch.streamed)
+        {
+            const MeshDecode decode = GetDrawDecode(queue, command.draw);
+            for (uint32_t i = 0; i < batch.count; i++)
+                models[first + i] = ApplyMeshDecode(queue.commands[queue.order[first + i]].model, decode);
+        }
+
+        queue.batches.push_back(batch);
+        first = end;
+    }
+
+    if (models != nullptr && UseMultiDrawIndirect(queue))
+        BuildMultiDrawCommands(queue, stream);
+}
+
+//Model matrix columns as per instance attributes, read from the stream buffer or a buffer
+//written on the GPU
+void BindInstanceModels(GLuint buffer, GLintptr offset)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        GLuint attribute = InstanceModelAttribute + column;
+        glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(offset + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(attribute, 1);
+        glEnableVertexAttribArray(attribute);
+    }
+}
+
+//Without the arrays enabled the attributes keep one constant value for the whole draw
+void SetConstantModel(const glm::mat4& model)
+{
+    for (GLuint column = 0; column < 4; column++)
+    {
+        glDisableVertexAttribArray(InstanceModelAttribute + column);
+        glVertexAttrib4fv(InstanceModelAttribute + column, glm::value_ptr(model[column]));
+    }
+}
+
+void DrawRenderCall(const RenderQueue& queue, const DrawCall& draw, GLsizei instances)
+{
+    if (draw.mesh != MeshNull)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, draw.count, draw.indexType, GetMeshIndexOffset(*queue.meshPool, draw.mesh), instances,
+            GetMeshBaseVertex(*queue.meshPool, draw.mesh));
+    else if (draw.indexType == GL_NONE)
+        glDrawArraysInstanced(GL_TRIANGLES, 0, draw.count, instances);
+    else
+        glDrawElementsInstanced(GL_TRIANGLES, draw.count, draw.indexType, 0, instances);
+}
+
+//Returns true when GL state was changed
+bool ExecuteInstancedDraws(RenderQueue& queue, int pass)
+{
+    bool drawn = false;
+    for (const InstancedDraw& instanced : queue.instancedDraws)
+    {
+        if (instanced.pass != pass)
+            continue;
+
+        PrepareRenderProgram(queue, instanced.program);
+        glUseProgram(instanced.program);
+        if (instanced.texture != 0)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, instanced.texture);
+        }
+        glBindVertexArray(instanced.draw.vertexArrayObject);
+        BindInstanceModels(instanced.instanceBuffer, 0);
+
+        if (instanced.indirectBuffer != 0)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, instanced.indirectBuffer);
+            glDrawElementsIndirect(GL_TRIANGLES, instanced.draw.indexType, (const void*)instanced.indirectOffset);
+        }
+        else if (instanced.instanceCount > 0)
+            DrawRenderCall(queue, instanced.draw, instanced.instanceCount);
+
+        queue.drawCount++;
+        drawn = true;
+    }
+    return drawn;
+}
+
+//Streams the pass blocks and instance data, then walks the batches and only touches GL
+//state where it changes. Runs of the same draw become one instanced call, and with multi
+//draw indirect every run of pooled batches sharing state becomes a single call, however
+//many meshes it holds.
+void ExecuteRenderQueue(RenderQueue& queue, StreamBuffer& stream)
+{
+    const GLuint invalid = ~0u;
+
+    for (int pass = 0; pass < RenderPassCount; pass++)
+    {
+        RenderPassBlock* block = static_cast<RenderPassBlock*>(AllocateStreamUniforms(stream, sizeof(RenderPassBlock), queue.passBlocks[pass]));
+        if (block != nullptr)
+        {
+            block->view = queue.passes[pass].view;
+            block->projection = queue.passes[pass].projection;
+        }
+    }
+
+    BuildRenderBatches(queue, stream);
+    FlushStreamBuffer(stream);
+
+    int currentPass = -1;
+    GLuint currentProgram = invalid;
+    GLuint currentTexture = invalid;
+    GLuint currentVertexArray = invalid;
+
+    queue.drawCount = 0;
+    queue.instanceCount = 0;
+    queue.stateChangeCount = 0;
+
+    //Passes are executed even when empty, so targets still get cleared. Instanced draws go
+    //last in their pass and leave the state unknown.
+    auto enterPass = [&](int pass)
+    {
+        while (currentPass < pass)
+        {
+            if (currentPass >= 0 && ExecuteInstancedDraws(queue, currentPass))
+            {
+                currentProgram = invalid;
+                currentTexture = invalid;
+                currentVertexArray = invalid;
+            }
+            if (currentPass >= 0 && queue.passes[currentPass].samplesQuery != 0)
+                glEndQuery(GL_SAMPLES_PASSED);
+            if (currentPass >= 0 && queue.afterPass[currentPass])
+            {
+                queue.afterPass[currentPass]();
+                currentProgram = invalid;
+                currentTexture = invalid;
+                currentVertexArray = invalid;
+            }
+
+            currentPass++;
+            if (currentPass < RenderPassCount)
+            {
+                BeginRenderPass(queue.passes[currentPass]);
+                glBindBufferRange(GL_UNIFORM_BUFFER, RenderPassUniformBinding, stream.buffer, queue.passBlocks[currentPass], sizeof(RenderPassBlock));
+                if (queue.passes[currentPass].samplesQuery != 0)
+                    glBeginQuery(GL_SAMPLES_PASSED, queue.passes[currentPass].samplesQuery);
+            }
+        }
+    };
+
+    for (size_t index = 0; index < queue.batches.size(); index++)
+    {
+        const RenderBatch& batch = queue.batches[index];
+        const RenderCommand& command = queue.commands[queue.order[batch.first]];
+        int pass = static_cast<int>(queue.sortedKeys[batch.first] >> RenderKeyPassShift);
+
+        enterPass(pass);
+
+        if (command.program != currentProgram)
+        {
+            currentProgram = command.program;
+            PrepareRenderProgram(queue, currentProgram);
+            glUseProgram(currentProgram);
+            queue.stateChangeCount++;
+        }
+
+        if (command.texture != 0 && command.texture != currentTexture)
+        {
+            currentTexture = command.texture;
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, currentTexture);
+            queue.stateChangeCount++;
+        }
+
+        if (command.draw.vertexArrayObject != currentVertexArray)
+        {
+            currentVertexArray = command.draw.vertexArrayObject;
+            glBindVertexArray(currentVertexArray);
+            queue.stateChangeCount++;
+        }
+
+        if (batch.multiDrawCount > 0)
+        {
+            //Base instance offsets the instanced attributes, so the whole frame's block is bound
+            BindInstanceModels(stream.buffer, queue.instanceModels);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, stream.buffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, command.draw.indexType, (const void*)batch.indirect, static_cast<GLsizei>(batch.multiDrawCount), 0);
+            queue.drawCount++;
+
+            for (uint32_t i = 0; i < batch.multiDrawCount; i++)
+                queue.instanceCount += queue.batches[index + i].count;
+            index += batch.multiDrawCount - 1;
+            continue;
+        }
+
+        if (batch.streamed)
+        {
+            BindInstanceModels(stream.buffer, batch.instances);
+            DrawRenderCall(queue, command.draw, static_cast<GLsizei>(batch.count));
+            queue.drawCount++;
+        }
+        else
+        {
+            //Did not fit into the stream buffer this frame, it grows for the next one
+            const MeshDecode decode = GetDrawDecode(queue, command.draw);
+            for (uint32_t i = 0; i < batch.count; i++)
+            {
+                SetConstantModel(ApplyMeshDecode(queue.commands[queue.order[batch.first + i]].model, decode));
+                DrawRenderCall(queue, command.draw, 1);
+                queue.drawCount++;
+            }
+        }
+        queue.instanceCount += batch.count;
+    }
+
+    enterPass(RenderPassCount);
+    EndRenderPasses();
+
+    glBindVertexArray(0);
+    if (GLAD_GL_VERSION_4_0)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+#include "Culling.h"
+#include "RenderQueue.h"
+
+struct SceneObject
+{
+    DrawCall draw;
+    GLuint texture;
+    glm::mat4 model;
+
+    //Mesh space box
+    glm::vec3 localCenter;
+    glm::vec3 localExtent;
+
+    //Static and large, rendered into the occlusion depth passes
+    bool occluder;
+};
+
+struct SceneLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    float radius;
+};
+
+struct Scene
+{
+    std::vector<SceneObject> objects;
+    std::vector<SceneLight> lights;
+
+    //World space boxes, indexed like objects
+    BoundsSoA worldBounds;
+
+    //Slots of removed objects, reused by the next add
+    std::vector<uint32_t> freeObjects;
+
+    //Objects added after the first build are inserted incrementally
+    Bvh bvh;
+    bool bvhBuilt = false;
+};
+
+void UpdateObjectBounds(Scene& scene, uint32_t index)
+{
+    const SceneObject& object = scene.objects[index];
+
+    glm::vec3 center;
+    glm::vec3 extent;
+    TransformBounds(object.model, object.localCenter, object.localExtent, center, extent);
+    SetBounds(scene.worldBounds, index, center, extent);
+
+    if (scene.bvhBuilt)
+        UpdateBvhObject(scene.bvh, index, center, extent);
+}
+
+uint32_t AddSceneObject(Scene& scene, const DrawCall& draw, GLuint texture, const glm::mat4& model, glm::vec3 localCenter, glm::vec3 localExtent, bool occluder = false)
+{
+    uint32_t index;
+    if (!scene.freeObjects.empty())
+    {
+        index = scene.freeObjects.back();
+        scene.freeObjects.pop_back();
+        scene.objects[index] = { draw, texture, model, localCenter, localExtent, occluder };
+    }
+    else
+    {
+        index = static_cast<uint32_t>(scene.objects.size());
+        scene.objects.push_back({ draw, texture, model, localCenter, localExtent, occluder });
+        ResizeBounds(scene.worldBounds, scene.objects.size());
+    }
+
+    glm::vec3 center;
+    glm::vec3 extent;
+    TransformBounds(model, localCenter, localExtent, center, extent);
+    SetBounds(scene.worldBounds, index, center, extent);
+
+    if (scene.bvhBuilt)
+        InsertBvhObject(scene.bvh, index, center, extent);
+
+    return index;
+}
+
+//The slot stays with an empty draw until it is reused
+void RemoveSceneObject(Scene& scene, uint32_t index)
+{
+    if (scene.bvhBuilt)
+        RemoveBvhObject(scene.bvh, index);
+
+    scene.objects[index].draw = DrawCall();
+    SetBounds(scene.worldBounds, index, glm::vec3(0.0f), glm::vec3(0.0f));
+    scene.freeObjects.push_back(index);
+}
+
+void BuildSceneBvh(Scene& scene, JobSystem* jobSystem)
+{
+    BuildBvh(scene.bvh, scene.worldBounds, jobSystem);
+    scene.bvhBuilt = true;
+}
+
+//For objects whose mesh is rebuilt in place, like voxel chunks
+void SetObjectMesh(Scene& scene, uint32_t index, const DrawCall& draw, glm::vec3 localCenter, glm::vec3 localExtent)
+{
+    SceneObject& object = scene.objects[index];
+    object.draw = draw;
+    object.localCenter = localCenter;
+    object.localExtent = localExtent;
+    UpdateObjectBounds(scene, index);
+}
+
+void SetObjectTransform(Scene& scene, uint32_t index, const glm::mat4& model)
+{
+    scene.objects[index].model = model;
+    UpdateObjectBounds(scene, index);
+}
@@ -38,6 +38,29 @@ void AddShader(GLuint ShaderProgram, const char* pShaderText, GLenum ShaderType)
     glAttachShader(ShaderProgram, ShaderObj);
 }
 
+void LinkShaderProgram(GLuint shaderProgram)
+{
+    GLint Success = 0;
+    GLchar ErrorLog[1024] = { 0 };
+
+    glLinkProgram(shaderProgram);
+
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &Success);
+    if (Success == 0) {
+        glGetProgramInfoLog(shaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
+        exit(1);
+    }
+
+    glValidateProgram(shaderProgram);
+    glGetProgramiv(shaderProgram, GL_VALIDATE_STATUS, &Success);
+    if (!Success) {
+        glGetProgramInfoLog(shaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
+        exit(1);
+    }
+}
+
 GLuint CompileShaders(const char* vertexShaderFileName, const char* fragmentShaderFileName)
 {
     GLuint shaderProgram = glCreateProgram();
@@ -62,25 +85,40 @@ GLuint CompileShaders(const char* vertexShaderFileName, const char* fragmentShad
 
     AddShader(shaderProgram, fragmentShader.c_str(), GL_FRAGMENT_SHADER);
 
-    GLint Success = 0;
-    GLchar ErrorLog[1024] = { 0 };
+    LinkShaderProgram(shaderProgram);
 
-    glLinkProgram(shaderProgram);
+    return shaderProgram;
+}
 
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &Success);
-    if (Success == 0) {
-        glGetProgramInfoLog(shaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
-        fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
+//Vertex and geometry shader without a fragment stage, the varyings are captured interleaved
+//into transform feedback buffer 0
+GLuint CompileFeedbackShaders(const char* vertexShaderFileName, const char* geometryShaderFileName, const char* const* varyings, GLsizei varyingCount)
+{
+    GLuint shaderProgram = glCreateProgram();
+
+    if (shaderProgram == 0) {
+        fprintf(stderr, "Error creating shader program\n");
         exit(1);
     }
 
-    glValidateProgram(shaderProgram);
-    glGetProgramiv(shaderProgram, GL_VALIDATE_STATUS, &Success);
-    if (!Success) {
-        glGetProgramInfoLog(shaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
-        fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
+    std::string vertexShader;
+    std::string geometryShader;
+
+    if (!ReadFileToString(vertexShaderFileName, vertexShader)) {
         exit(1);
-    }
+    };
+
+    AddShader(shaderProgram, vertexShader.c_str(), GL_VERTEX_SHADER);
+
+    if (!ReadFileToString(geometryShaderFileName, geometryShader)) {
+        exit(1);
+    };
+
+    AddShader(shaderProgram, geometryShader.c_str(), GL_GEOMETRY_SHADER);
+
+    glTransformFeedbackVaryings(shaderProgram, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+
+    LinkShaderProgram(shaderProgram);
 
     return shaderProgram;
 }
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+const int StreamMaxFramesInFlight = 8;
+
+struct StreamBufferSettings
+{
+    //Frames the CPU may run ahead of the GPU, each with its own region of the ring
+    int framesInFlight = 3;
+    size_t frameBytes = 4ull * 1024 * 1024;
+};
+
+//Ring of per frame regions for data written every frame. With buffer storage (GL 4.4 or
+//ARB_buffer_storage) the whole ring is persistently mapped and a fence per region keeps the
+//CPU from writing a region the GPU may still read. On older contexts the frame is staged in memory and
+//uploaded once into an orphaned buffer, which the driver keeps apart from the one in use.
+struct StreamBuffer
+{
+    StreamBufferSettings settings;
+
+    GLuint buffer = 0;
+    bool persistent = false;
+    char* mapped = nullptr;
+    std::vector<char> staging;
+    GLsync fences[StreamMaxFramesInFlight] = {};
+
+    int region = 0;
+    size_t offset = 0;
+    GLint uniformAlignment = 256;
+
+    //Set when an allocation did not fit, the ring is doubled at the start of the next frame
+    bool overflowed = false;
+
+    //Statistics
+    uint32_t waitCount = 0;
+};
+
+//--frames-in-flight <count>
+bool ParseStreamBufferArguments(int argc, char** argv, StreamBufferSettings& settings)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames-in-flight") == 0)
+        {
+            settings.framesInFlight = atoi(argv[++i]);
+            if (settings.framesInFlight < 1 || settings.framesInFlight > StreamMaxFramesInFlight)
+            {
+                std::cout << "Invalid value for --frames-in-flight, expected 1 to " << StreamMaxFramesInFlight << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//glad only loads glBufferStorage for GL 4.4 contexts. Older ones may still offer it through
+//ARB_buffer_storage, under the same name.
+void LoadBufferStorage(GLADloadproc load)
+{
+    if (glBufferStorage != NULL)
+        return;
+
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        if (strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_buffer_storage") == 0)
+        {
+            glad_glBufferStorage = reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(load("glBufferStorage"));
+            return;
+        }
+    }
+}
+
+void AllocateStreamStorage(StreamBuffer& stream)
+{
+    glGenBuffers(1, &stream.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+
+    if (stream.persistent)
+    {
+        GLsizeiptr bytes = static_cast<GLsizeiptr>(stream.settings.frameBytes * stream.settings.framesInFlight);
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, nullptr, flags);
+        stream.mapped = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags));
+    }
+    else
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, stream.settings.frameBytes, nullptr, GL_STREAM_DRAW);
+        stream.staging.resize(stream.settings.frameBytes);
+    }
+}
+
+void CreateStreamBuffer(StreamBuffer& stream, const StreamBufferSettings& settings)
+{
+    stream.settings = settings;
+    stream.persistent = glBufferStorage != NULL;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &stream.uniformAlignment);
+
+    AllocateStreamStorage(stream);
+}
+
+void WaitStreamFence(StreamBuffer& stream, int region)
+{
+    GLsync& fence = stream.fences[region];
+    if (fence == nullptr)
+        return;
+
+    //Only counts as a stall if the GPU was not done yet
+    if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        stream.waitCount++;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            ;
+    }
+
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+//Moves to the next region, waiting until the GPU has finished the frame that last used it
+void BeginStreamFrame(StreamBuffer& stream)
+{
+    if (stream.overflowed)
+    {
+        for (int region = 0; region < stream.settings.framesInFlight; region++)
+            WaitStreamFence(stream, region);
+
+        if (stream.mapped != nullptr)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            stream.mapped = nullptr;
+        }
+        glDeleteBuffers(1, &stream.buffer);
+
+        stream.settings.frameBytes *= 2;
+        AllocateStreamStorage(stream);
+        stream.overflowed = false;
+    }
+
+    if (stream.persistent)
+    {
+        stream.region = (stream.region + 1) % stream.settings.framesInFlight;
+        WaitStreamFence(stream, stream.region);
+    }
+    stream.offset = 0;
+}
+
+//Space for this frame, or nullptr when the frame is full. gpuOffset is where the data
+//will be in the buffer once the frame is flushed.
+void* AllocateStream(StreamBuffer& stream, size_t bytes, size_t alignment, GLintptr& gpuOffset)
+{
+    size_t offset = (stream.offset + alignment - 1) / alignment * alignment;
+    if (offset + bytes > stream.settings.frameBytes)
+    {
+        stream.overflowed = true;
+        return nullptr;
+    }
+    stream.offset = offset + bytes;
+
+    if (stream.persistent)
+    {
+        size_t base = static_cast<size_t>(stream.region) * stream.settings.frameBytes;
+        gpuOffset = static_cast<GLintptr>(base + offset);
+        return stream.mapped + base + offset;
+    }
+
+    gpuOffset = static_cast<GLintptr>(offset);
+    return stream.staging.data() + offset;
+}
+
+void* AllocateStreamUniforms(StreamBuffer& stream, size_t bytes, GLintptr& gpuOffset)
+{
+    return AllocateStream(stream, bytes, static_cast<size_t>(stream.uniformAlignment), gpuOffset);
+}
+
+//Makes everything allocated so far visible to the GPU. Draws reading the buffer must come
+//after this, anything allocated after it is not uploaded on the fallback path.
+void FlushStreamBuffer(StreamBuffer& stream)
+{
+    //Coherent mapping, the writes are already visible
+    if (stream.persistent || stream.offset == 0)
+        return;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, stream.settings.frameBytes, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, stream.offset, stream.staging.data());
+}
+
+//Fences the region after the last command reading it has been issued
+void EndStreamFrame(StreamBuffer& stream)
+{
+    if (stream.persistent)
+        stream.fences[stream.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "JobSystem.h"
+#include "Scene.h"
+
+//Spacing per cube, so the density stays the same when the count changes
+const float StressCubeSpacing = 3.0f;
+const int StressClusterCount = 16;
+const size_t StressUpdateGrainSize = 4096;
+
+enum StressDistribution
+{
+    StressDistributionUniform,
+    StressDistributionClustered,
+    StressDistributionGrid
+};
+
+struct StressSceneSettings
+{
+    bool enabled = false;
+    uint32_t cubeCount = 10000;
+    //Fraction of the cubes that are animated every frame
+    float motionRatio = 0.1f;
+    int textureCount = 1;
+    StressDistribution distribution = StressDistributionUniform;
+    int lightCount = 1;
+    uint32_t seed = 1;
+};
+
+struct StressMover
+{
+    uint32_t object;
+    glm::vec3 position;
+    glm::vec3 axis;
+    float scale;
+    float speed;
+    float phase;
+};
+
+//Point lights drift around where they were spawned
+struct StressLightMover
+{
+    glm::vec3 origin;
+    float speed;
+    float phase;
+};
+
+struct StressScene
+{
+    StressSceneSettings settings;
+    std::vector<StressMover> movers;
+    std::vector<StressLightMover> lightMovers;
+
+    //Half size of the populated volume
+    float extent = 0.0f;
+};
+
+bool ParseStressDistribution(const char* name, StressDistribution& distribution)
+{
+    if (strcmp(name, "uniform") == 0)
+        distribution = StressDistributionUniform;
+    else if (strcmp(name, "clustered") == 0)
+        distribution = StressDistributionClustered;
+    else if (strcmp(name, "grid") == 0)
+        distribution = StressDistributionGrid;
+    else
+        return false;
+    return true;
+}
+
+//--stress <cubes> [--motion <ratio>] [--textures <count>] [--distribution uniform|clustered|grid] [--lights <count>] [--seed <seed>]
+bool ParseStressSceneArguments(int argc, char** argv, StressSceneSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* option = argv[i];
+        if (strncmp(option, "--", 2) != 0)
+            continue;
+
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool known = true;
+        bool valid = value != nullptr;
+
+        if (strcmp(option, "--stress") == 0)
+        {
+            settings.enabled = true;
+            if (valid)
+            {
+                long count = strtol(value, nullptr, 10);
+                valid = count > 0;
+                settings.cubeCount = static_cast<uint32_t>(count);
+            }
+        }
+        else if (strcmp(option, "--motion") == 0)
+        {
+            if (valid)
+            {
+                settings.motionRatio = static_cast<float>(atof(value));
+                valid = settings.motionRatio >= 0.0f && settings.motionRatio <= 1.0f;
+            }
+        }
+        else if (strcmp(option, "--textures") == 0)
+        {
+            if (valid)
+            {
+                settings.textureCount = atoi(value);
+                valid = settings.textureCount > 0;
+            }
+        }
+        else if (strcmp(option, "--distribution") == 0)
+        {
+            valid = valid && ParseStressDistribution(value, settings.distribution);
+        }
+        else if (strcmp(option, "--lights") == 0)
+        {
+            if (valid)
+            {
+                settings.lightCount = atoi(value);
+                valid = settings.lightCount >= 0;
+            }
+        }
+        else if (strcmp(option, "--seed") == 0)
+        {
+            if (valid)
+                settings.seed = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        }
+        else
+        {
+            //Other modules own the remaining options
+            known = false;
+        }
+
+        if (!known)
+            continue;
+
+        if (!valid)
+        {
+            std::cout << "Invalid value for " << option << std::endl;
+            return false;
+        }
+        i++;
+    }
+
+    return true;
+}
+
+glm::vec3 GenerateStressPosition(const StressScene& stressScene, uint32_t index, const std::vector<glm::vec3>& clusters, std::mt19937& random)
+{
+    float extent = stressScene.extent;
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    switch (stressScene.settings.distribution)
+    {
+    case StressDistributionClustered:
+    {
+        std::normal_distribution<float> spread(0.0f, extent * 0.15f);
+        glm::vec3 center = clusters[index % clusters.size()];
+        return center + glm::vec3(spread(random), spread(random) * 0.5f, spread(random));
+    }
+    case StressDistributionGrid:
+    {
+        uint32_t side = static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(stressScene.settings.cubeCount))));
+        glm::vec3 cell(static_cast<float>(index % side), static_cast<float>((index / side) % side), static_cast<float>(index / (side * side)));
+        return (cell - glm::vec3(static_cast<float>(side - 1) * 0.5f)) * StressCubeSpacing;
+    }
+    default:
+        return glm::vec3(unit(random), unit(random), unit(random)) * extent;
+    }
+}
+
+glm::mat4 MakeStressModel(const StressMover& mover, float time)
+{
+    glm::vec3 bob(0.0f, std::sin(time * mover.speed + mover.phase) * 0.5f, 0.0f);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), mover.position + bob);
+    model = glm::rotate(model, time * mover.speed + mover.phase, mover.axis);
+    return glm::scale(model, glm::vec3(mover.scale));
+}
+
+//Spawns the cubes and lights. Textures are picked round robin to spread the material keys.
+void GenerateStressScene(StressScene& stressScene, Scene& scene, const DrawCall& cube, const std::vector<GLuint>& textures)
+{
+    const StressSceneSettings& settings = stressScene.settings;
+    std::mt19937 random(settings.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    stressScene.extent = std::cbrt(static_cast<float>(settings.cubeCount)) * StressCubeSpacing * 0.5f;
+    stressScene.movers.clear();
+
+    std::vector<glm::vec3> clusters;
+    for (int i = 0; i < StressClusterCount; i++)
+        clusters.push_back((glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f) * stressScene.extent * 0.7f);
+
+    scene.objects.reserve(scene.objects.size() + settings.cubeCount);
+
+    for (uint32_t i = 0; i < settings.cubeCount; i++)
+    {
+        StressMover mover;
+        mover.position = GenerateStressPosition(stressScene, i, clusters, random);
+        mover.axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.01f));
+        mover.scale = 0.5f + unit(random);
+        mover.speed = 0.2f + unit(random) * 2.0f;
+        mover.phase = unit(random) * glm::two_pi<float>();
+
+        GLuint texture = textures[i % textures.size()];
+        mover.object = AddSceneObject(scene, cube, texture, MakeStressModel(mover, 0.0f), glm::vec3(0.0f), glm::vec3(0.5f));
+
+        if (unit(random) < settings.motionRatio)
+            stressScene.movers.push_back(mover);
+    }
+
+    scene.lights.clear();
+    stressScene.lightMovers.clear();
+    for (int i = 0; i < settings.lightCount; i++)
+    {
+        SceneLight light;
+        light.position = (glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f) * stressScene.extent;
+        light.color = glm::vec3(0.5f) + glm::vec3(unit(random), unit(random), unit(random)) * 0.5f;
+        light.radius = StressCubeSpacing * (4.0f + unit(random) * 8.0f);
+        scene.lights.push_back(light);
+
+        StressLightMover mover;
+        mover.origin = light.position;
+        mover.speed = 0.2f + unit(random);
+        mover.phase = unit(random) * glm::two_pi<float>();
+        stressScene.lightMovers.push_back(mover);
+    }
+}
+
+glm::vec3 GetStressLightPosition(const StressLightMover& mover, float time)
+{
+    float angle = mover.phase + time * mover.speed;
+    return mover.origin + glm::vec3(std::cos(angle), std::sin(angle * 0.7f), std::sin(angle)) * StressCubeSpacing * 2.0f;
+}
+
+//Transforms and world boxes are written in parallel, the BVH is updated afterwards on this thread
+void UpdateStressScene(StressScene& stressScene, Scene& scene, float time, JobSystem* jobSystem)
+{
+    ParallelFor(jobSystem, stressScene.movers.size(), StressUpdateGrainSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const StressMover& mover = stressScene.movers[i];
+            SceneObject& object = scene.objects[mover.object];
+            object.model = MakeStressModel(mover, time);
+
+            glm::vec3 center;
+            glm::vec3 extent;
+            TransformBounds(object.model, object.localCenter, object.localExtent, center, extent);
+            SetBounds(scene.worldBounds, mover.object, center, extent);
+        }
+    });
+
+    for (size_t i = 0; i < stressScene.lightMovers.size(); i++)
+        scene.lights[i].position = GetStressLightPosition(stressScene.lightMovers[i], time);
+
+    if (!scene.bvhBuilt)
+        return;
+
+    const BoundsSoA& bounds = scene.worldBounds;
+    for (const StressMover& mover : stressScene.movers)
+    {
+        uint32_t index = mover.object;
+        glm::vec3 center(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]);
+        glm::vec3 extent(bounds.extentX[index], bounds.extentY[index], bounds.extentZ[index]);
+        UpdateBvhObject(scene.bvh, index, center, extent);
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Bloom.h"
+#include "SceneTarget.h"
+
+const float ToneMappingExposure = 1.0f;
+
+//Last pass of the frame: stretches the rendered part of the HDR scene target over the back
+//buffer, adds the bloom and maps the result into display range
+struct ToneMapping
+{
+    GLuint program = 0;
+    GLint sourceScaleLocation = -1;
+    GLint sharpnessLocation = -1;
+    GLint bloomScaleLocation = -1;
+    GLint bloomStrengthLocation = -1;
+
+    GLuint emptyVertexArray = 0;
+};
+
+void CreateToneMapping(ToneMapping& toneMapping, const char* vertexShaderFileName, const char* fragmentShaderFileName)
+{
+    toneMapping.program = CompileShaders(vertexShaderFileName, fragmentShaderFileName);
+    glUseProgram(toneMapping.program);
+    glUniform1i(glGetUniformLocation(toneMapping.program, "source"), 0);
+    glUniform1i(glGetUniformLocation(toneMapping.program, "bloom"), 1);
+    glUniform1f(glGetUniformLocation(toneMapping.program, "exposure"), ToneMappingExposure);
+    toneMapping.sourceScaleLocation = glGetUniformLocation(toneMapping.program, "sourceScale");
+    toneMapping.sharpnessLocation = glGetUniformLocation(toneMapping.program, "sharpness");
+    toneMapping.bloomScaleLocation = glGetUniformLocation(toneMapping.program, "bloomScale");
+    toneMapping.bloomStrengthLocation = glGetUniformLocation(toneMapping.program, "bloomStrength");
+
+    glGenVertexArrays(1, &toneMapping.emptyVertexArray);
+}
+
+//sceneViewport is the part of the target the camera rendered, sharpness only applies when
+//that is smaller than viewport
+void RenderToneMapping(const ToneMapping& toneMapping, const SceneTarget& target, glm::ivec4 sceneViewport, float sharpness, const Bloom& bloom,
+    GLuint framebuffer, glm::ivec4 viewport)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+
+    glUseProgram(toneMapping.program);
+    glUniform2f(toneMapping.sourceScaleLocation, static_cast<float>(sceneViewport.z) / target.width, static_cast<float>(sceneViewport.w) / target.height);
+    //Nothing to recover at full resolution
+    glUniform1f(toneMapping.sharpnessLocation, sceneViewport.z < viewport.z ? sharpness : 0.0f);
+
+    glActiveTexture(GL_TEXTURE1);
+    if (!bloom.textures.empty())
+    {
+        glBindTexture(GL_TEXTURE_2D, bloom.textures[0]);
+        glUniform2f(toneMapping.bloomScaleLocation, static_cast<float>(bloom.region.x) / bloom.sizes[0].x, static_cast<float>(bloom.region.y) / bloom.sizes[0].y);
+    }
+    glUniform1f(toneMapping.bloomStrengthLocation, GetBloomStrength(bloom));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, target.colorTexture);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(toneMapping.emptyVertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+//Meshes are built as position, normal and texture coordinate floats and converted to the
+//pool's format on upload
+const int MeshSourceVertexFloats = 8;
+
+enum MeshVertexFormat
+{
+    //32 bytes: the source layout as is
+    MeshVertexFloat,
+    //16 bytes: 16 bit integer positions on a grid over the mesh bounds, 2_10_10_10 normals
+    //and half float texture coordinates
+    MeshVertexCompact
+};
+
+struct MeshVertexAttribute
+{
+    GLuint index;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    uint32_t offset;
+};
+
+//Maps the stored position back to mesh space: position * scale + offset. The scale is the
+//same on every axis, so normals need no correction.
+struct MeshDecode
+{
+    glm::vec3 offset = glm::vec3(0.0f);
+    float scale = 1.0f;
+};
+
+//--vertex-format float|compact
+bool ParseVertexFormatArguments(int argc, char** argv, MeshVertexFormat& format)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--vertex-format") != 0)
+            continue;
+
+        const char* name = argv[++i];
+        if (strcmp(name, "float") == 0)
+            format = MeshVertexFloat;
+        else if (strcmp(name, "compact") == 0)
+            format = MeshVertexCompact;
+        else
+        {
+            std::cout << "Invalid value for --vertex-format, expected float or compact" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t GetVertexStride(MeshVertexFormat format)
+{
+    return format == MeshVertexCompact ? 16 : MeshSourceVertexFloats * sizeof(float);
+}
+
+std::vector<MeshVertexAttribute> GetVertexAttributes(MeshVertexFormat format)
+{
+    if (format == MeshVertexCompact)
+    {
+        //Positions are not normalized, the integers convert to float exactly
+        return
+        {
+            { 0, 3, GL_UNSIGNED_SHORT, GL_FALSE, 0 },
+            { 1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 8 },
+            { 2, 2, GL_HALF_FLOAT, GL_FALSE, 12 }
+        };
+    }
+
+    return
+    {
+        { 0, 3, GL_FLOAT, GL_FALSE, 0 },
+        { 1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float) },
+        { 2, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float) }
+    };
+}
+
+//Power of two step that fits the largest side of the bounds into 16 bits, so positions on
+//the same power of two grid, like voxel corners, come out exact
+float GetPositionStep(glm::vec3 size)
+{
+    float largest = std::max(std::max(size.x, size.y), size.z);
+    if (largest <= 0.0f)
+        return 1.0f;
+
+    float step = std::exp2(std::ceil(std::log2(largest / 65535.0f)));
+    if (largest / step > 65535.0f)
+        step *= 2.0f;
+    return step;
+}
+
+//Writes vertexCount source vertices in the given format
+void EncodeVertices(MeshVertexFormat format, const float* vertices, uint32_t vertexCount, std::vector<uint8_t>& encoded, MeshDecode& decode)
+{
+    uint32_t stride = GetVertexStride(format);
+    encoded.resize(static_cast<size_t>(vertexCount) * stride);
+    decode = MeshDecode();
+
+    if (format == MeshVertexFloat)
+    {
+        memcpy(encoded.data(), vertices, encoded.size());
+        return;
+    }
+
+    glm::vec3 minimum(vertices[0], vertices[1], vertices[2]);
+    glm::vec3 maximum = minimum;
+    for (uint32_t i = 1; i < vertexCount; i++)
+    {
+        const float* vertex = vertices + static_cast<size_t>(i) * MeshSourceVertexFloats;
+        minimum = glm::min(minimum, glm::vec3(vertex[0], vertex[1], vertex[2]));
+        maximum = glm::max(maximum, glm::vec3(vertex[0], vertex[1], vertex[2]));
+    }
+
+    decode.offset = minimum;
+    decode.scale = GetPositionStep(maximum - minimum);
+
+    for (uint32_t i = 0; i < vertexCount; i++)
+    {
+        const float* vertex = vertices + static_cast<size_t>(i) * MeshSourceVertexFloats;
+        uint8_t* out = encoded.data() + static_cast<size_t>(i) * stride;
+
+        uint16_t position[4] = {};
+        for (int axis = 0; axis < 3; axis++)
+            position[axis] = static_cast<uint16_t>(std::clamp(std::round((vertex[axis] - minimum[axis]) / decode.scale), 0.0f, 65535.0f));
+
+        glm::vec3 normal(vertex[3], vertex[4], vertex[5]);
+        float length = glm::length(normal);
+        uint32_t packedNormal = glm::packSnorm3x10_1x2(glm::vec4(length > 0.0f ? normal / length : normal, 0.0f));
+        uint32_t packedTexture = glm::packHalf2x16(glm::vec2(vertex[6], vertex[7]));
+
+        memcpy(out, position, sizeof(position));
+        memcpy(out + 8, &packedNormal, sizeof(packedNormal));
+        memcpy(out + 12, &packedTexture, sizeof(packedTexture));
+    }
+}
+
+//Applied to the model matrix when instances are streamed, so shaders see mesh space positions
+glm::mat4 ApplyMeshDecode(const glm::mat4& model, const MeshDecode& decode)
+{
+    glm::mat4 decoded;
+    decoded[0] = model[0] * decode.scale;
+    decoded[1] = model[1] * decode.scale;
+    decoded[2] = model[2] * decode.scale;
+    decoded[3] = model * glm::vec4(decode.offset, 1.0f);
+    return decoded;
+}
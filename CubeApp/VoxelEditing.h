@@ -0,0 +1,171 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#include "JobSystem.h"
+#include "Scene.h"
+#include "VoxelWorld.h"
+
+struct VoxelHit
+{
+    glm::ivec3 block;
+    //Face the ray entered through, block + normal is the empty cell in front of it
+    glm::ivec3 normal;
+    float distance;
+};
+
+//Meshes of one frame's edits, applied together so chunks sharing an edited border never
+//show a crack between an old and a new mesh
+struct VoxelRemeshBatch
+{
+    std::vector<glm::ivec3> coordinates;
+    std::vector<VoxelMesh> meshes;
+};
+
+struct VoxelRemesher
+{
+    std::mutex mutex;
+    std::vector<VoxelRemeshBatch> finished;
+    std::atomic<int> jobsInFlight{ 0 };
+};
+
+//3D DDA (Amanatides and Woo): steps cell by cell along the ray, always crossing the
+//nearest cell boundary next, so every block the ray touches is visited exactly once
+bool RaycastVoxels(const VoxelWorld& world, glm::vec3 origin, glm::vec3 direction, float maxDistance, VoxelHit& hit)
+{
+    direction = glm::normalize(direction);
+
+    glm::ivec3 cell(glm::floor(origin));
+    glm::ivec3 step(0);
+    //Ray distance to the next boundary and across a whole cell, per axis
+    glm::vec3 next(FLT_MAX);
+    glm::vec3 delta(FLT_MAX);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (direction[axis] > 0.0f)
+        {
+            step[axis] = 1;
+            delta[axis] = 1.0f / direction[axis];
+            next[axis] = (static_cast<float>(cell[axis] + 1) - origin[axis]) * delta[axis];
+        }
+        else if (direction[axis] < 0.0f)
+        {
+            step[axis] = -1;
+            delta[axis] = -1.0f / direction[axis];
+            next[axis] = (origin[axis] - static_cast<float>(cell[axis])) * delta[axis];
+        }
+    }
+
+    //Only look the chunk up again when the ray leaves it
+    glm::ivec3 chunkCoordinate(INT_MAX);
+    const VoxelChunk* chunk = nullptr;
+
+    glm::ivec3 normal(0);
+    float distance = 0.0f;
+    while (distance <= maxDistance)
+    {
+        glm::ivec3 coordinate = VoxelToChunk(cell);
+        if (coordinate != chunkCoordinate)
+        {
+            chunkCoordinate = coordinate;
+            chunk = FindVoxelChunk(world, coordinate);
+        }
+
+        if (chunk != nullptr)
+        {
+            glm::ivec3 local = cell - coordinate * ChunkSize;
+            if (GetStorageVoxel(chunk->blocks, VoxelIndex(local.x, local.y, local.z)) != VoxelAir)
+            {
+                hit.block = cell;
+                hit.normal = normal;
+                hit.distance = distance;
+                return true;
+            }
+        }
+
+        int axis = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+        distance = next[axis];
+        next[axis] += delta[axis];
+        cell[axis] += step[axis];
+        normal = glm::ivec3(0);
+        normal[axis] = -step[axis];
+    }
+
+    return false;
+}
+
+//Only edits loaded chunks. The blocks change at once, the meshes follow through the remesher.
+bool EditVoxel(VoxelWorld& world, glm::ivec3 position, VoxelBlock block)
+{
+    if (FindVoxelChunk(world, VoxelToChunk(position)) == nullptr || GetVoxel(world, position) == block)
+        return false;
+
+    SetVoxel(world, position, block);
+    return true;
+}
+
+//Swaps in finished remeshes, then hands everything dirtied since the last call to a worker.
+//Only the edited chunks and their border neighbours are remeshed, and the old meshes are
+//drawn until the new ones are uploaded.
+void UpdateVoxelRemesher(VoxelRemesher& remesher, VoxelWorld& world, Scene& scene, JobSystem& jobSystem)
+{
+    std::vector<VoxelRemeshBatch> finished;
+    {
+        std::lock_guard<std::mutex> lock(remesher.mutex);
+        finished.swap(remesher.finished);
+    }
+
+    for (const VoxelRemeshBatch& batch : finished)
+    {
+        for (size_t i = 0; i < batch.coordinates.size(); i++)
+        {
+            //Evicted meanwhile, or already replaced by a mesh of newer blocks
+            VoxelChunk* chunk = FindVoxelChunk(world, batch.coordinates[i]);
+            if (chunk != nullptr && batch.meshes[i].version >= chunk->meshVersion)
+                ApplyVoxelChunkMesh(world, scene, *chunk, batch.meshes[i]);
+        }
+    }
+
+    if (world.dirtyChunks.empty())
+        return;
+
+    std::vector<VoxelMeshSnapshot> snapshots;
+    for (glm::ivec3 coordinate : world.dirtyChunks)
+    {
+        VoxelChunk* chunk = FindVoxelChunk(world, coordinate);
+        if (chunk == nullptr || !chunk->dirty)
+            continue;
+
+        chunk->dirty = false;
+        snapshots.emplace_back();
+        TakeVoxelMeshSnapshot(world, *chunk, snapshots.back());
+    }
+    world.dirtyChunks.clear();
+
+    if (snapshots.empty())
+        return;
+
+    remesher.jobsInFlight++;
+    PushJob(jobSystem, [&remesher, snapshots = std::move(snapshots)]()
+    {
+        VoxelRemeshBatch batch;
+        batch.meshes.resize(snapshots.size());
+        for (size_t i = 0; i < snapshots.size(); i++)
+        {
+            batch.coordinates.push_back(snapshots[i].coordinate);
+            BuildVoxelChunkMesh(GetSnapshotNeighborhood(snapshots[i]), batch.meshes[i]);
+            batch.meshes[i].version = snapshots[i].version;
+        }
+
+        std::lock_guard<std::mutex> lock(remesher.mutex);
+        remesher.finished.push_back(std::move(batch));
+        remesher.jobsInFlight--;
+    });
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+const int ChunkSize = 32;
+const int ChunkArea = ChunkSize * ChunkSize;
+const int ChunkVolume = ChunkArea * ChunkSize;
+
+typedef uint16_t VoxelBlock;
+const VoxelBlock VoxelAir = 0;
+
+//Runs are only kept while a read stays a short binary search
+const size_t VoxelMaxRuns = 256;
+
+enum VoxelStorageMode
+{
+    //Every voxel is the same block, nothing is allocated
+    VoxelStorageUniform,
+    //Bit packed indices into a per-chunk palette
+    VoxelStoragePalette,
+    //Run length encoded, for chunks with few long runs
+    VoxelStorageRuns
+};
+
+//Chunk block storage. Reads are O(1) for uniform and palette chunks and a search over
+//at most VoxelMaxRuns runs otherwise. Writes expand to the palette form, where indices
+//widen only when the palette outgrows them. CompactVoxelStorage picks the smallest form.
+struct VoxelStorage
+{
+    VoxelStorageMode mode = VoxelStorageUniform;
+    VoxelBlock uniform = VoxelAir;
+
+    //Indices are 1 << bitShift bits wide, so they never straddle a word
+    std::vector<VoxelBlock> palette;
+    std::vector<uint16_t> paletteCounts;
+    int bitShift = 0;
+    std::vector<uint64_t> words;
+
+    //Run starts in voxel index order, each run ends where the next begins
+    std::vector<uint16_t> runStarts;
+    std::vector<VoxelBlock> runBlocks;
+};
+
+int PaletteBitShift(size_t paletteSize)
+{
+    int bitShift = 0;
+    while ((1ull << (1 << bitShift)) < paletteSize)
+        bitShift++;
+    return bitShift;
+}
+
+uint32_t GetPaletteIndex(const VoxelStorage& storage, int index)
+{
+    int bits = 1 << storage.bitShift;
+    int wordShift = 6 - storage.bitShift;
+    int slot = index & ((1 << wordShift) - 1);
+    uint64_t mask = (1ull << bits) - 1;
+    return static_cast<uint32_t>((storage.words[index >> wordShift] >> (slot << storage.bitShift)) & mask);
+}
+
+void SetPaletteIndex(VoxelStorage& storage, int index, uint32_t paletteIndex)
+{
+    int bits = 1 << storage.bitShift;
+    int wordShift = 6 - storage.bitShift;
+    int shift = (index & ((1 << wordShift) - 1)) << storage.bitShift;
+    uint64_t mask = ((1ull << bits) - 1) << shift;
+    uint64_t& word = storage.words[index >> wordShift];
+    word = (word & ~mask) | ((static_cast<uint64_t>(paletteIndex) << shift) & mask);
+}
+
+VoxelBlock GetStorageVoxel(const VoxelStorage& storage, int index)
+{
+    switch (storage.mode)
+    {
+    case VoxelStoragePalette:
+        return storage.palette[GetPaletteIndex(storage, index)];
+    case VoxelStorageRuns:
+    {
+        auto run = std::upper_bound(storage.runStarts.begin(), storage.runStarts.end(), static_cast<uint16_t>(index)) - 1;
+        return storage.runBlocks[run - storage.runStarts.begin()];
+    }
+    default:
+        return storage.uniform;
+    }
+}
+
+void FillVoxelStorage(VoxelStorage& storage, VoxelBlock block)
+{
+    storage = VoxelStorage();
+    storage.uniform = block;
+}
+
+void RepackVoxelStorage(VoxelStorage& storage, int bitShift)
+{
+    VoxelStorage packed;
+    packed.bitShift = bitShift;
+    packed.words.assign(ChunkVolume >> (6 - bitShift), 0);
+    for (int i = 0; i < ChunkVolume; i++)
+        SetPaletteIndex(packed, i, GetPaletteIndex(storage, i));
+
+    storage.bitShift = bitShift;
+    storage.words.swap(packed.words);
+}
+
+//Converts uniform and run chunks to the palette form so they can be written
+void ExpandVoxelStorage(VoxelStorage& storage)
+{
+    if (storage.mode == VoxelStoragePalette)
+        return;
+
+    VoxelStorage expanded;
+    expanded.mode = VoxelStoragePalette;
+
+    if (storage.mode == VoxelStorageUniform)
+    {
+        expanded.palette.push_back(storage.uniform);
+        expanded.paletteCounts.push_back(static_cast<uint16_t>(ChunkVolume));
+    }
+    else
+    {
+        for (VoxelBlock block : storage.runBlocks)
+        {
+            if (std::find(expanded.palette.begin(), expanded.palette.end(), block) == expanded.palette.end())
+                expanded.palette.push_back(block);
+        }
+        expanded.paletteCounts.assign(expanded.palette.size(), 0);
+    }
+
+    expanded.bitShift = PaletteBitShift(expanded.palette.size());
+    expanded.words.assign(ChunkVolume >> (6 - expanded.bitShift), 0);
+
+    for (size_t run = 0; run < storage.runStarts.size(); run++)
+    {
+        int begin = storage.runStarts[run];
+        int end = run + 1 < storage.runStarts.size() ? storage.runStarts[run + 1] : ChunkVolume;
+        uint32_t paletteIndex = static_cast<uint32_t>(std::find(expanded.palette.begin(), expanded.palette.end(), storage.runBlocks[run]) - expanded.palette.begin());
+        expanded.paletteCounts[paletteIndex] += static_cast<uint16_t>(end - begin);
+        for (int i = begin; i < end; i++)
+            SetPaletteIndex(expanded, i, paletteIndex);
+    }
+
+    storage = std::move(expanded);
+}
+
+void SetStorageVoxel(VoxelStorage& storage, int index, VoxelBlock block)
+{
+    if (storage.mode != VoxelStoragePalette)
+    {
+        if (GetStorageVoxel(storage, index) == block)
+            return;
+        ExpandVoxelStorage(storage);
+    }
+
+    uint32_t previous = GetPaletteIndex(storage, index);
+    if (storage.palette[previous] == block)
+        return;
+
+    //Reuse the entry for this block, or one no voxel refers to anymore
+    uint32_t entry = static_cast<uint32_t>(std::find(storage.palette.begin(), storage.palette.end(), block) - storage.palette.begin());
+    if (entry == storage.palette.size())
+    {
+        entry = static_cast<uint32_t>(std::find(storage.paletteCounts.begin(), storage.paletteCounts.end(), 0) - storage.paletteCounts.begin());
+        if (entry == storage.palette.size())
+        {
+            storage.palette.push_back(block);
+            storage.paletteCounts.push_back(0);
+            if (storage.palette.size() > (1ull << (1 << storage.bitShift)))
+                RepackVoxelStorage(storage, storage.bitShift + 1);
+        }
+        storage.palette[entry] = block;
+    }
+
+    storage.paletteCounts[previous]--;
+    storage.paletteCounts[entry]++;
+    SetPaletteIndex(storage, index, entry);
+}
+
+//Picks the smallest form for the current contents, dropping unused palette entries
+void CompactVoxelStorage(VoxelStorage& storage)
+{
+    if (storage.mode != VoxelStoragePalette)
+        return;
+
+    //Runs, bailing out once there are too many to be worth it
+    std::vector<uint16_t> runStarts;
+    std::vector<VoxelBlock> runBlocks;
+    for (int i = 0; i < ChunkVolume && runStarts.size() <= VoxelMaxRuns; i++)
+    {
+        VoxelBlock block = storage.palette[GetPaletteIndex(storage, i)];
+        if (runBlocks.empty() || runBlocks.back() != block)
+        {
+            runStarts.push_back(static_cast<uint16_t>(i));
+            runBlocks.push_back(block);
+        }
+    }
+
+    if (runStarts.size() == 1)
+    {
+        FillVoxelStorage(storage, runBlocks[0]);
+        return;
+    }
+
+    std::vector<uint32_t> remap(storage.palette.size(), 0);
+    std::vector<VoxelBlock> palette;
+    std::vector<uint16_t> paletteCounts;
+    for (size_t entry = 0; entry < storage.palette.size(); entry++)
+    {
+        if (storage.paletteCounts[entry] == 0)
+            continue;
+        remap[entry] = static_cast<uint32_t>(palette.size());
+        palette.push_back(storage.palette[entry]);
+        paletteCounts.push_back(storage.paletteCounts[entry]);
+    }
+
+    int bitShift = PaletteBitShift(palette.size());
+    size_t paletteBytes = (ChunkVolume >> (6 - bitShift)) * sizeof(uint64_t) + palette.size() * (sizeof(VoxelBlock) + sizeof(uint16_t));
+    size_t runBytes = runStarts.size() * (sizeof(uint16_t) + sizeof(VoxelBlock));
+
+    if (runStarts.size() <= VoxelMaxRuns && runBytes < paletteBytes)
+    {
+        storage = VoxelStorage();
+        storage.mode = VoxelStorageRuns;
+        storage.runStarts.swap(runStarts);
+        storage.runBlocks.swap(runBlocks);
+        return;
+    }
+
+    VoxelStorage packed;
+    packed.mode = VoxelStoragePalette;
+    packed.palette.swap(palette);
+    packed.paletteCounts.swap(paletteCounts);
+    packed.bitShift = bitShift;
+    packed.words.assign(ChunkVolume >> (6 - bitShift), 0);
+    for (int i = 0; i < ChunkVolume; i++)
+        SetPaletteIndex(packed, i, remap[GetPaletteIndex(storage, i)]);
+
+    storage = std::move(packed);
+}
+
+size_t VoxelStorageBytes(const VoxelStorage& storage)
+{
+    return sizeof(VoxelStorage)
+        + storage.palette.capacity() * sizeof(VoxelBlock)
+        + storage.paletteCounts.capacity() * sizeof(uint16_t)
+        + storage.words.capacity() * sizeof(uint64_t)
+        + storage.runStarts.capacity() * sizeof(uint16_t)
+        + storage.runBlocks.capacity() * sizeof(VoxelBlock);
+}
@@ -0,0 +1,592 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "JobSystem.h"
+#include "Scene.h"
+#include "VoxelStorage.h"
+
+//Source layout of the mesh pool: position, normal, texture coordinate
+const int VoxelVertexFloats = MeshSourceVertexFloats;
+
+struct VoxelWorldSettings
+{
+    bool enabled = false;
+    //Terrain spans chunkRadius chunks from the origin along X and Z
+    int chunkRadius = 4;
+    int chunkHeight = 2;
+    uint32_t seed = 1;
+};
+
+struct VoxelChunk
+{
+    glm::ivec3 coordinate;
+    VoxelStorage blocks;
+    //Edited since it was generated, so it must not be regenerated
+    bool modified = false;
+
+    //Queued in dirtyChunks
+    bool dirty = false;
+    //Taken from the world's counter whenever anything the mesh depends on changes, meshes
+    //built from older blocks are dropped instead of replacing a newer one
+    uint32_t version = 0;
+    uint32_t meshVersion = 0;
+
+    //Handle in the world's mesh pool, MeshNull while the mesh is empty
+    uint32_t mesh = MeshNull;
+    uint32_t sceneObject = UINT32_MAX;
+};
+
+struct VoxelMesh
+{
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    glm::vec3 min = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f);
+    uint32_t version = 0;
+};
+
+struct VoxelWorld
+{
+    std::unordered_map<uint64_t, std::unique_ptr<VoxelChunk>> chunks;
+    GLuint texture = 0;
+    //Same vertex layout as the mesh vertices
+    MeshPool* meshPool = nullptr;
+
+    //Chunks whose mesh is out of date, each listed once
+    std::vector<glm::ivec3> dirtyChunks;
+
+    //Source of chunk versions. Never reset, so a chunk that is evicted and loaded again
+    //starts above any mesh of its old copy that is still being built.
+    uint32_t lastVersion = 0;
+
+    //Scratch for the meshing jobs, kept between updates
+    std::vector<VoxelChunk*> meshQueue;
+    std::vector<VoxelMesh> meshes;
+
+    //Statistics from the last update
+    size_t quadCount = 0;
+};
+
+//--voxels <chunk radius> [--voxel-height <chunks>] [--seed <seed>]
+bool ParseVoxelWorldArguments(int argc, char** argv, VoxelWorldSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* option = argv[i];
+        if (strcmp(option, "--voxels") != 0 && strcmp(option, "--voxel-height") != 0 && strcmp(option, "--seed") != 0)
+            continue;
+
+        if (i + 1 >= argc)
+        {
+            std::cout << "Missing value for " << option << std::endl;
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (strcmp(option, "--voxels") == 0)
+        {
+            settings.enabled = true;
+            settings.chunkRadius = atoi(value);
+            if (settings.chunkRadius <= 0)
+            {
+                std::cout << "Invalid value for --voxels" << std::endl;
+                return false;
+            }
+        }
+        else if (strcmp(option, "--voxel-height") == 0)
+        {
+            settings.chunkHeight = atoi(value);
+            if (settings.chunkHeight <= 0)
+            {
+                std::cout << "Invalid value for --voxel-height" << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            settings.seed = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        }
+    }
+
+    return true;
+}
+
+uint64_t VoxelChunkKey(glm::ivec3 coordinate)
+{
+    const uint64_t mask = (1ull << 21) - 1;
+    return ((static_cast<uint64_t>(coordinate.x) & mask) << 42) | ((static_cast<uint64_t>(coordinate.y) & mask) << 21) | (static_cast<uint64_t>(coordinate.z) & mask);
+}
+
+int VoxelIndex(int x, int y, int z)
+{
+    return x + y * ChunkSize + z * ChunkArea;
+}
+
+//Floor division, so negative positions land in the right chunk
+glm::ivec3 VoxelToChunk(glm::ivec3 position)
+{
+    return glm::ivec3(
+        position.x >= 0 ? position.x / ChunkSize : (position.x + 1) / ChunkSize - 1,
+        position.y >= 0 ? position.y / ChunkSize : (position.y + 1) / ChunkSize - 1,
+        position.z >= 0 ? position.z / ChunkSize : (position.z + 1) / ChunkSize - 1);
+}
+
+VoxelChunk* FindVoxelChunk(const VoxelWorld& world, glm::ivec3 coordinate)
+{
+    auto found = world.chunks.find(VoxelChunkKey(coordinate));
+    return found == world.chunks.end() ? nullptr : found->second.get();
+}
+
+VoxelChunk* GetOrCreateVoxelChunk(VoxelWorld& world, glm::ivec3 coordinate)
+{
+    std::unique_ptr<VoxelChunk>& chunk = world.chunks[VoxelChunkKey(coordinate)];
+    if (!chunk)
+    {
+        chunk = std::make_unique<VoxelChunk>();
+        chunk->coordinate = coordinate;
+        chunk->version = ++world.lastVersion;
+        chunk->meshVersion = chunk->version;
+    }
+    return chunk.get();
+}
+
+VoxelBlock GetVoxel(const VoxelWorld& world, glm::ivec3 position)
+{
+    glm::ivec3 coordinate = VoxelToChunk(position);
+    const VoxelChunk* chunk = FindVoxelChunk(world, coordinate);
+    if (chunk == nullptr)
+        return VoxelAir;
+
+    glm::ivec3 local = position - coordinate * ChunkSize;
+    return GetStorageVoxel(chunk->blocks, VoxelIndex(local.x, local.y, local.z));
+}
+
+void MarkVoxelChunkDirty(VoxelWorld& world, VoxelChunk* chunk)
+{
+    if (chunk == nullptr)
+        return;
+
+    chunk->version = ++world.lastVersion;
+    if (!chunk->dirty)
+    {
+        chunk->dirty = true;
+        world.dirtyChunks.push_back(chunk->coordinate);
+    }
+}
+
+void MarkVoxelChunkDirty(VoxelWorld& world, glm::ivec3 coordinate)
+{
+    MarkVoxelChunkDirty(world, FindVoxelChunk(world, coordinate));
+}
+
+void SetVoxel(VoxelWorld& world, glm::ivec3 position, VoxelBlock block)
+{
+    glm::ivec3 coordinate = VoxelToChunk(position);
+    VoxelChunk* chunk = GetOrCreateVoxelChunk(world, coordinate);
+
+    glm::ivec3 local = position - coordinate * ChunkSize;
+    SetStorageVoxel(chunk->blocks, VoxelIndex(local.x, local.y, local.z), block);
+    chunk->modified = true;
+    MarkVoxelChunkDirty(world, chunk);
+
+    //Faces on the border belong to the neighbour's mesh as well
+    for (int axis = 0; axis < 3; axis++)
+    {
+        glm::ivec3 step(0);
+        step[axis] = 1;
+        if (local[axis] == 0)
+            MarkVoxelChunkDirty(world, coordinate - step);
+        else if (local[axis] == ChunkSize - 1)
+            MarkVoxelChunkDirty(world, coordinate + step);
+    }
+}
+
+//Block lookup that reaches one block into the six face neighbours
+struct VoxelNeighborhood
+{
+    const VoxelStorage* center;
+    //-X, +X, -Y, +Y, -Z, +Z, null where nothing is loaded
+    const VoxelStorage* neighbors[6];
+};
+
+//Copies of the blocks a chunk mesh depends on, so it can be built while the world changes.
+//Compressed storage keeps these small.
+struct VoxelMeshSnapshot
+{
+    glm::ivec3 coordinate;
+    uint32_t version;
+    VoxelStorage center;
+    VoxelStorage neighbors[6];
+    bool present[6];
+};
+
+const VoxelChunk* GetVoxelNeighbor(const VoxelWorld& world, const VoxelChunk& chunk, int side)
+{
+    glm::ivec3 step(0);
+    step[side / 2] = side % 2 == 0 ? -1 : 1;
+    return FindVoxelChunk(world, chunk.coordinate + step);
+}
+
+VoxelNeighborhood GetVoxelNeighborhood(const VoxelWorld& world, const VoxelChunk& chunk)
+{
+    VoxelNeighborhood neighborhood;
+    neighborhood.center = &chunk.blocks;
+    for (int side = 0; side < 6; side++)
+    {
+        const VoxelChunk* neighbor = GetVoxelNeighbor(world, chunk, side);
+        neighborhood.neighbors[side] = neighbor != nullptr ? &neighbor->blocks : nullptr;
+    }
+    return neighborhood;
+}
+
+void TakeVoxelMeshSnapshot(const VoxelWorld& world, const VoxelChunk& chunk, VoxelMeshSnapshot& snapshot)
+{
+    snapshot.coordinate = chunk.coordinate;
+    snapshot.version = chunk.version;
+    snapshot.center = chunk.blocks;
+    for (int side = 0; side < 6; side++)
+    {
+        const VoxelChunk* neighbor = GetVoxelNeighbor(world, chunk, side);
+        snapshot.present[side] = neighbor != nullptr;
+        if (neighbor != nullptr)
+            snapshot.neighbors[side] = neighbor->blocks;
+    }
+}
+
+VoxelNeighborhood GetSnapshotNeighborhood(const VoxelMeshSnapshot& snapshot)
+{
+    VoxelNeighborhood neighborhood;
+    neighborhood.center = &snapshot.center;
+    for (int side = 0; side < 6; side++)
+        neighborhood.neighbors[side] = snapshot.present[side] ? &snapshot.neighbors[side] : nullptr;
+    return neighborhood;
+}
+
+VoxelBlock GetNeighborhoodVoxel(const VoxelNeighborhood& neighborhood, glm::ivec3 local)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (local[axis] < 0 || local[axis] >= ChunkSize)
+        {
+            const VoxelStorage* neighbor = neighborhood.neighbors[axis * 2 + (local[axis] < 0 ? 0 : 1)];
+            if (neighbor == nullptr)
+                return VoxelAir;
+            local[axis] = (local[axis] + ChunkSize) % ChunkSize;
+            return GetStorageVoxel(*neighbor, VoxelIndex(local.x, local.y, local.z));
+        }
+    }
+    return GetStorageVoxel(*neighborhood.center, VoxelIndex(local.x, local.y, local.z));
+}
+
+bool IsVoxelChunkEnclosed(const VoxelNeighborhood& neighborhood)
+{
+    for (const VoxelStorage* neighbor : neighborhood.neighbors)
+    {
+        if (neighbor == nullptr || neighbor->mode != VoxelStorageUniform || neighbor->uniform == VoxelAir)
+            return false;
+    }
+    return true;
+}
+
+void AddVoxelQuad(VoxelMesh& mesh, glm::vec3 origin, glm::vec3 du, glm::vec3 dv, glm::vec3 normal, float width, float height, bool flip)
+{
+    uint32_t base = static_cast<uint32_t>(mesh.vertices.size() / VoxelVertexFloats);
+
+    glm::vec3 corners[4] = { origin, origin + du, origin + du + dv, origin + dv };
+    glm::vec2 uvs[4] = { glm::vec2(0.0f, 0.0f), glm::vec2(width, 0.0f), glm::vec2(width, height), glm::vec2(0.0f, height) };
+    for (int i = 0; i < 4; i++)
+    {
+        mesh.vertices.insert(mesh.vertices.end(), {
+            corners[i].x, corners[i].y, corners[i].z,
+            normal.x, normal.y, normal.z,
+            uvs[i].x, uvs[i].y });
+    }
+
+    //Counter clockwise seen from the side the normal points to
+    if (flip)
+        mesh.indices.insert(mesh.indices.end(), { base, base + 2, base + 1, base, base + 3, base + 2 });
+    else
+        mesh.indices.insert(mesh.indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+
+    mesh.min = glm::min(mesh.min, glm::min(origin, origin + du + dv));
+    mesh.max = glm::max(mesh.max, glm::max(origin, origin + du + dv));
+}
+
+//Greedy meshing: per face direction and slice, a mask of visible faces is merged into
+//the largest rectangles of equal blocks. Faces against solid blocks are never emitted.
+void BuildVoxelChunkMesh(const VoxelNeighborhood& neighborhood, VoxelMesh& mesh)
+{
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.min = glm::vec3(static_cast<float>(ChunkSize));
+    mesh.max = glm::vec3(0.0f);
+
+    //Uniform air has no faces and uniform solid only has them against non solid neighbours
+    const VoxelStorage& blocks = *neighborhood.center;
+    if (blocks.mode == VoxelStorageUniform && (blocks.uniform == VoxelAir || IsVoxelChunkEnclosed(neighborhood)))
+    {
+        mesh.min = glm::vec3(0.0f);
+        return;
+    }
+
+    VoxelBlock mask[ChunkArea];
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+
+        for (int side = -1; side <= 1; side += 2)
+        {
+            glm::vec3 normal(0.0f);
+            normal[axis] = static_cast<float>(side);
+
+            for (int slice = 0; slice < ChunkSize; slice++)
+            {
+                //Visible faces of this slice
+                glm::ivec3 position(0);
+                position[axis] = slice;
+                for (int j = 0; j < ChunkSize; j++)
+                {
+                    position[v] = j;
+                    for (int i = 0; i < ChunkSize; i++)
+                    {
+                        position[u] = i;
+                        VoxelBlock block = GetStorageVoxel(blocks, VoxelIndex(position.x, position.y, position.z));
+                        VoxelBlock facing = VoxelAir;
+                        if (block != VoxelAir)
+                        {
+                            glm::ivec3 next = position;
+                            next[axis] += side;
+                            facing = GetNeighborhoodVoxel(neighborhood, next);
+                        }
+                        mask[i + j * ChunkSize] = facing == VoxelAir ? block : VoxelAir;
+                    }
+                }
+
+                //Merge into rectangles
+                for (int j = 0; j < ChunkSize; j++)
+                {
+                    for (int i = 0; i < ChunkSize;)
+                    {
+                        VoxelBlock block = mask[i + j * ChunkSize];
+                        if (block == VoxelAir)
+                        {
+                            i++;
+                            continue;
+                        }
+
+                        int width = 1;
+                        while (i + width < ChunkSize && mask[i + width + j * ChunkSize] == block)
+                            width++;
+
+                        int height = 1;
+                        bool grow = true;
+                        while (grow && j + height < ChunkSize)
+                        {
+                            for (int k = 0; k < width; k++)
+                            {
+                                if (mask[i + k + (j + height) * ChunkSize] != block)
+                                {
+                                    grow = false;
+                                    break;
+                                }
+                            }
+                            if (grow)
+                                height++;
+                        }
+
+                        glm::vec3 origin(0.0f);
+                        origin[axis] = static_cast<float>(slice + (side > 0 ? 1 : 0));
+                        origin[u] = static_cast<float>(i);
+                        origin[v] = static_cast<float>(j);
+                        glm::vec3 du(0.0f);
+                        du[u] = static_cast<float>(width);
+                        glm::vec3 dv(0.0f);
+                        dv[v] = static_cast<float>(height);
+                        AddVoxelQuad(mesh, origin, du, dv, normal, static_cast<float>(width), static_cast<float>(height), side < 0);
+
+                        for (int l = 0; l < height; l++)
+                            memset(&mask[i + (j + l) * ChunkSize], 0, width * sizeof(VoxelBlock));
+                        i += width;
+                    }
+                }
+            }
+        }
+    }
+
+    if (mesh.indices.empty())
+    {
+        mesh.min = glm::vec3(0.0f);
+        mesh.max = glm::vec3(0.0f);
+    }
+}
+
+//Replaces the chunk's allocation in the pool, empty meshes take no space
+void UploadVoxelChunkMesh(VoxelWorld& world, VoxelChunk& chunk, const VoxelMesh& mesh)
+{
+    if (chunk.mesh != MeshNull)
+        RemoveMesh(*world.meshPool, chunk.mesh);
+    chunk.mesh = MeshNull;
+
+    if (mesh.indices.empty())
+        return;
+
+    uint32_t vertexCount = static_cast<uint32_t>(mesh.vertices.size() / VoxelVertexFloats);
+    chunk.mesh = AddMesh(*world.meshPool, mesh.vertices.data(), vertexCount, mesh.indices.data(), static_cast<uint32_t>(mesh.indices.size()));
+}
+
+//Uploads a finished mesh and registers the chunk with the scene. Render thread only.
+void ApplyVoxelChunkMesh(VoxelWorld& world, Scene& scene, VoxelChunk& chunk, const VoxelMesh& mesh)
+{
+    UploadVoxelChunkMesh(world, chunk, mesh);
+    chunk.meshVersion = mesh.version;
+
+    DrawCall draw;
+    if (chunk.mesh != MeshNull)
+        draw = MakeMeshDrawCall(*world.meshPool, chunk.mesh);
+
+    glm::vec3 localCenter = (mesh.min + mesh.max) * 0.5f;
+    glm::vec3 localExtent = (mesh.max - mesh.min) * 0.5f;
+
+    if (chunk.sceneObject == UINT32_MAX)
+    {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(chunk.coordinate * ChunkSize));
+        chunk.sceneObject = AddSceneObject(scene, draw, world.texture, model, localCenter, localExtent);
+    }
+    else
+    {
+        world.quadCount -= scene.objects[chunk.sceneObject].draw.count / 6;
+        SetObjectMesh(scene, chunk.sceneObject, draw, localCenter, localExtent);
+    }
+    world.quadCount += draw.count / 6;
+}
+
+void RemoveVoxelChunk(VoxelWorld& world, Scene& scene, glm::ivec3 coordinate)
+{
+    auto found = world.chunks.find(VoxelChunkKey(coordinate));
+    if (found == world.chunks.end())
+        return;
+
+    VoxelChunk& chunk = *found->second;
+    if (chunk.sceneObject != UINT32_MAX)
+    {
+        world.quadCount -= scene.objects[chunk.sceneObject].draw.count / 6;
+        RemoveSceneObject(scene, chunk.sceneObject);
+    }
+    if (chunk.mesh != MeshNull)
+        RemoveMesh(*world.meshPool, chunk.mesh);
+
+    world.chunks.erase(found);
+}
+
+//Meshes every dirty chunk on the job system and waits, then uploads and registers them on
+//this thread. Meant for building a whole world up front, edits go through the remesher.
+void UpdateVoxelMeshes(VoxelWorld& world, Scene& scene, JobSystem* jobSystem)
+{
+    world.meshQueue.clear();
+    for (glm::ivec3 coordinate : world.dirtyChunks)
+    {
+        VoxelChunk* chunk = FindVoxelChunk(world, coordinate);
+        if (chunk != nullptr)
+            world.meshQueue.push_back(chunk);
+    }
+    world.dirtyChunks.clear();
+
+    if (world.meshQueue.empty())
+        return;
+
+    world.meshes.resize(std::max(world.meshes.size(), world.meshQueue.size()));
+    ParallelFor(jobSystem, world.meshQueue.size(), 1, [&world](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            BuildVoxelChunkMesh(GetVoxelNeighborhood(world, *world.meshQueue[i]), world.meshes[i]);
+            world.meshes[i].version = world.meshQueue[i]->version;
+        }
+    });
+
+    for (size_t i = 0; i < world.meshQueue.size(); i++)
+    {
+        world.meshQueue[i]->dirty = false;
+        ApplyVoxelChunkMesh(world, scene, *world.meshQueue[i], world.meshes[i]);
+    }
+}
+
+size_t VoxelWorldBytes(const VoxelWorld& world)
+{
+    size_t bytes = 0;
+    for (auto& entry : world.chunks)
+        bytes += sizeof(VoxelChunk) + VoxelStorageBytes(entry.second->blocks) - sizeof(VoxelStorage);
+    return bytes;
+}
+
+//Layered sine heightfield with stone below dirt below grass, for the chunkHeight chunks of one
+//column. Only touches the given storages, so it is safe to run on a worker.
+void GenerateVoxelColumn(VoxelStorage* column, glm::ivec2 coordinate, int chunkHeight, uint32_t seed)
+{
+    const VoxelBlock stone = 1;
+    const VoxelBlock dirt = 2;
+    const VoxelBlock grass = 3;
+
+    float offset = static_cast<float>(seed % 1024);
+    int maxHeight = chunkHeight * ChunkSize;
+
+    for (int chunkY = 0; chunkY < chunkHeight; chunkY++)
+        FillVoxelStorage(column[chunkY], VoxelAir);
+
+    for (int z = 0; z < ChunkSize; z++)
+    {
+        for (int x = 0; x < ChunkSize; x++)
+        {
+            float worldX = static_cast<float>(coordinate.x * ChunkSize + x) + offset;
+            float worldZ = static_cast<float>(coordinate.y * ChunkSize + z) + offset;
+            float noise = std::sin(worldX * 0.021f) * std::cos(worldZ * 0.017f) * 0.5f
+                + std::sin(worldX * 0.063f + worldZ * 0.041f) * 0.3f
+                + std::cos(worldZ * 0.11f - worldX * 0.07f) * 0.2f;
+            int height = std::clamp(static_cast<int>((noise * 0.35f + 0.5f) * maxHeight), 1, maxHeight);
+
+            for (int y = 0; y < height; y++)
+            {
+                VoxelBlock block = y == height - 1 ? grass : (y >= height - 4 ? dirt : stone);
+                SetStorageVoxel(column[y / ChunkSize], VoxelIndex(x, y % ChunkSize, z), block);
+            }
+        }
+    }
+
+    for (int chunkY = 0; chunkY < chunkHeight; chunkY++)
+        CompactVoxelStorage(column[chunkY]);
+}
+
+void GenerateVoxelTerrain(VoxelWorld& world, int chunkRadius, int chunkHeight, uint32_t seed)
+{
+    std::vector<VoxelStorage> column(chunkHeight);
+
+    for (int chunkZ = -chunkRadius; chunkZ < chunkRadius; chunkZ++)
+    {
+        for (int chunkX = -chunkRadius; chunkX < chunkRadius; chunkX++)
+        {
+            GenerateVoxelColumn(column.data(), glm::ivec2(chunkX, chunkZ), chunkHeight, seed);
+            for (int chunkY = 0; chunkY < chunkHeight; chunkY++)
+            {
+                VoxelChunk* chunk = GetOrCreateVoxelChunk(world, glm::ivec3(chunkX, chunkY, chunkZ));
+                chunk->blocks = std::move(column[chunkY]);
+                MarkVoxelChunkDirty(world, chunk);
+            }
+        }
+    }
+}
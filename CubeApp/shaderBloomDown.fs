@@ -0,0 +1,41 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+uniform vec2 texelSize;
+// used part of the source over its texture size
+uniform vec2 sourceScale;
+// luminance threshold and soft knee width, a threshold of 0 keeps everything
+uniform vec2 threshold;
+
+out vec4 FragColor;
+
+vec3 Fetch(vec2 uv)
+{
+    // stay half a texel inside the used part so nothing outside bleeds in
+    return texture(source, clamp(uv, 0.5 * texelSize, sourceScale - 0.5 * texelSize)).rgb;
+}
+
+// dual filter: the center and four diagonal bilinear taps, a 4x4 texel footprint
+void main()
+{
+    vec2 uv = TexCoords * sourceScale;
+    vec3 color = Fetch(uv) * 4.0;
+    color += Fetch(uv + vec2(-texelSize.x, -texelSize.y));
+    color += Fetch(uv + vec2(texelSize.x, -texelSize.y));
+    color += Fetch(uv + vec2(-texelSize.x, texelSize.y));
+    color += Fetch(uv + vec2(texelSize.x, texelSize.y));
+    color *= 0.125;
+
+    if (threshold.x > 0.0)
+    {
+        // quadratic knee so the cut has no visible edge
+        float brightness = max(color.r, max(color.g, color.b));
+        float soft = clamp(brightness - threshold.x + threshold.y, 0.0, 2.0 * threshold.y);
+        soft = soft * soft / (4.0 * threshold.y + 1e-5);
+        color *= max(soft, brightness - threshold.x) / max(brightness, 1e-5);
+    }
+
+    FragColor = vec4(color, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+uniform vec2 texelSize;
+// used part of the source over its texture size
+uniform vec2 sourceScale;
+
+out vec4 FragColor;
+
+vec3 Fetch(vec2 uv)
+{
+    return texture(source, clamp(uv, 0.5 * texelSize, sourceScale - 0.5 * texelSize)).rgb;
+}
+
+// dual filter: four taps on the axes and four diagonal taps weighted double, blended
+// additively onto the larger level
+void main()
+{
+    vec2 uv = TexCoords * sourceScale;
+    vec3 color = Fetch(uv + vec2(-texelSize.x, 0.0));
+    color += Fetch(uv + vec2(texelSize.x, 0.0));
+    color += Fetch(uv + vec2(0.0, -texelSize.y));
+    color += Fetch(uv + vec2(0.0, texelSize.y));
+    color += Fetch(uv + vec2(-0.5, -0.5) * texelSize) * 2.0;
+    color += Fetch(uv + vec2(0.5, -0.5) * texelSize) * 2.0;
+    color += Fetch(uv + vec2(-0.5, 0.5) * texelSize) * 2.0;
+    color += Fetch(uv + vec2(0.5, 0.5) * texelSize) * 2.0;
+
+    FragColor = vec4(color / 12.0, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 330 core
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+in Instance
+{
+    mat4 model;
+    flat int visible;
+} IN[];
+
+// captured by transform feedback, only for the instances that survived culling
+out mat4 outModel;
+
+void main()
+{
+    if (IN[0].visible == 0)
+        return;
+
+    outModel = IN[0].model;
+    EmitVertex();
+    EndPrimitive();
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#version 330 core
+layout (location = 0) in mat4 inModel;
+layout (location = 4) in vec4 inCenter;
+layout (location = 5) in vec4 inExtent;
+
+out Instance
+{
+    mat4 model;
+    flat int visible;
+} OUT;
+
+// xyz normal pointing inwards, w distance
+uniform vec4 frustumPlanes[6];
+
+// max depth pyramid of the previous frame's occluders
+uniform bool occlusionEnabled;
+uniform mat4 occlusionViewProjection;
+uniform sampler2D occlusion;
+uniform int occlusionLevels;
+uniform float depthBias;
+
+bool IsOutsideFrustum(vec3 center, vec3 extent)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        vec4 plane = frustumPlanes[i];
+        if (dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) < 0.0)
+            return true;
+    }
+    return false;
+}
+
+// same test as IsOccluded on the CPU
+bool IsOccluded(vec3 center, vec3 extent)
+{
+    vec3 rectMin = vec3(1e30);
+    vec3 rectMax = vec3(-1e30);
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        vec3 offset = vec3((corner & 1) != 0 ? extent.x : -extent.x, (corner & 2) != 0 ? extent.y : -extent.y, (corner & 4) != 0 ? extent.z : -extent.z);
+        vec4 clip = occlusionViewProjection * vec4(center + offset, 1.0);
+
+        // crossing the near plane, treat as visible
+        if (clip.w <= 1e-5)
+            return false;
+
+        vec3 window = clip.xyz / clip.w * 0.5 + 0.5;
+        rectMin = min(rectMin, window);
+        rectMax = max(rectMax, window);
+    }
+
+    // outside the pyramid, the frustum test decides
+    if (rectMax.x < 0.0 || rectMax.y < 0.0 || rectMin.x > 1.0 || rectMin.y > 1.0)
+        return false;
+
+    rectMin = clamp(rectMin, 0.0, 1.0);
+    rectMax = clamp(rectMax, 0.0, 1.0);
+
+    // level where the rectangle covers at most two texels in each direction
+    vec2 texels = (rectMax.xy - rectMin.xy) * vec2(textureSize(occlusion, 0));
+    int level = min(int(ceil(log2(max(1.0, max(texels.x, texels.y))))), occlusionLevels - 1);
+
+    ivec2 size = textureSize(occlusion, level);
+    ivec2 first = min(size - 1, ivec2(rectMin.xy * vec2(size)));
+    ivec2 last = min(size - 1, ivec2(rectMax.xy * vec2(size)));
+
+    float occluderDepth = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+    {
+        for (int x = first.x; x <= last.x; ++x)
+            occluderDepth = max(occluderDepth, texelFetch(occlusion, ivec2(x, y), level).r);
+    }
+
+    return rectMin.z > occluderDepth + depthBias;
+}
+
+void main()
+{
+    bool visible = !IsOutsideFrustum(inCenter.xyz, inExtent.xyz) && !(occlusionEnabled && IsOccluded(inCenter.xyz, inExtent.xyz));
+
+    OUT.model = inModel;
+    OUT.visible = visible ? 1 : 0;
+}
\ No newline at end of file
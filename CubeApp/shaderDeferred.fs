@@ -0,0 +1,171 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+layout (std140) uniform Lighting
+{
+    mat4 lightSpaceMatrix;
+    vec4 lightPos;
+    vec4 lightColor;
+    vec4 viewPos;
+    // tiles per pixel, log depth to slice scale and bias
+    vec4 clusterScale;
+    // froxel grid size, point light count
+    vec4 clusterSize;
+    // half resolution ambient occlusion size, enabled
+    vec4 occlusionSize;
+};
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+uniform sampler2D shadowMap;
+
+uniform samplerBuffer pointLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+
+uniform sampler2D occlusion;
+uniform sampler2D occlusionDepth;
+
+// the camera of the geometry pass
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+
+out vec4 FragColor;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// same filter as shaderPhong
+float ShadowCalculation(vec3 fragPos, vec3 normal)
+{
+    vec4 fragPosLightSpace = lightSpaceMatrix * vec4(fragPos, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    float currentDepth = projCoords.z;
+    vec3 lightDir = normalize(lightPos.xyz - fragPos);
+    float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+    // PCF
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    for(int x = -1; x <= 1; ++x)
+    {
+        for(int y = -1; y <= 1; ++y)
+        {
+            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
+        }
+    }
+    shadow /= 9.0;
+
+    // keep the shadow at 0.0 when outside the far_plane region of the light's frustum.
+    if(projCoords.z > 1.0)
+        shadow = 0.0;
+
+    return shadow;
+}
+
+// same lists as the forward path, one froxel per pixel
+vec3 PointLighting(vec3 fragPos, float viewDepth, vec3 norm, vec3 viewDir)
+{
+    if (clusterSize.w == 0.0)
+        return vec3(0.0);
+
+    ivec3 size = ivec3(clusterSize.xyz);
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, log(max(viewDepth, 1e-5)) * clusterScale.z + clusterScale.w);
+    cluster = clamp(cluster, ivec3(0), size - 1);
+    uvec2 range = texelFetch(clusterGrid, (cluster.z * size.y + cluster.y) * size.x + cluster.x).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(pointLights, light * 2);
+        vec3 color = texelFetch(pointLights, light * 2 + 1).rgb;
+
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distanceSquared = dot(toLight, toLight);
+        float falloff = clamp(1.0 - distanceSquared / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        if (falloff <= 0.0)
+            continue;
+
+        vec3 lightDir = toLight * inversesqrt(distanceSquared);
+        float diff = max(dot(norm, lightDir), 0.0);
+        float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), 32);
+        result += (diff + 0.5 * spec) * color * falloff * falloff;
+    }
+    return result;
+}
+
+// same upsample as shaderPhong
+float AmbientOcclusion(float viewDepth)
+{
+    if (occlusionSize.z == 0.0)
+        return 1.0;
+
+    ivec2 size = ivec2(occlusionSize.xy);
+    vec2 position = gl_FragCoord.xy * 0.5 - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = fract(position);
+
+    float total = 0.0;
+    float weight = 0.0;
+    for (int y = 0; y <= 1; ++y)
+    {
+        for (int x = 0; x <= 1; ++x)
+        {
+            ivec2 tap = clamp(base + ivec2(x, y), ivec2(0), size - 1);
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            float depth = texelFetch(occlusionDepth, tap, 0).r;
+            float w = bilinear / (1e-3 + abs(depth - viewDepth) / viewDepth);
+            total += texelFetch(occlusion, tap, 0).r * w;
+            weight += w;
+        }
+    }
+    return weight > 0.0 ? total / weight : 1.0;
+}
+
+void main()
+{
+    // the G-buffer may be larger than the viewport, pixels match one to one
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // background keeps the clear color
+    if (depth == 1.0)
+        discard;
+
+    // position from depth
+    vec4 viewPosition = inverseProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    viewPosition /= viewPosition.w;
+    vec3 fragPos = vec3(inverseView * viewPosition);
+
+    vec3 norm = DecodeOctahedral(texelFetch(gNormal, pixel, 0).xy);
+    vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+
+    float ambientStrength = 0.1;
+    vec3 ambient = ambientStrength * lightColor.xyz * AmbientOcclusion(-viewPosition.z);
+
+    vec3 lightDir = normalize(lightPos.xyz - fragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * lightColor.xyz;
+
+    float specularStrength = 0.5;
+    vec3 viewDir = normalize(viewPos.xyz - fragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = specularStrength * spec * lightColor.xyz;
+
+    float shadow = ShadowCalculation(fragPos, norm);
+
+    vec3 light = ambient + (diffuse + specular) * (1.0 - shadow) + PointLighting(fragPos, -viewPosition.z, norm, viewDir);
+    FragColor = vec4(light * albedo, 1.0);
+}
\ No newline at end of file
@@ -1,10 +1,17 @@
 #version 330 core
 layout (location = 0) in vec3 inPos;
+layout (location = 3) in mat4 inModel;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+layout (std140) uniform Pass
+{
+    mat4 view;
+    mat4 projection;
+};
+
+// the depth prepass and the shading pass must produce the same depth
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(inPos, 1.0);
+    gl_Position = projection * view * inModel * vec4(inPos, 1.0);
 }
\ No newline at end of file
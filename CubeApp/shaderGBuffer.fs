@@ -0,0 +1,28 @@
+#version 330 core
+
+in v2f
+{
+    vec3 Normal;
+    vec2 TexCoords;
+} IN;
+
+uniform sampler2D texture1;
+
+layout (location = 0) out vec4 Albedo;
+layout (location = 1) out vec2 Normal;
+
+// octahedral mapping of a unit vector to [0,1] squared
+vec2 EncodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+void main()
+{
+    Albedo = vec4(texture(texture1, IN.TexCoords).rgb, 1.0);
+    Normal = EncodeOctahedral(normalize(IN.Normal));
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 330 core
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inNormal;
+layout (location = 2) in vec2 inTexCoords;
+layout (location = 3) in mat4 inModel;
+
+out v2f
+{
+    vec3 Normal;
+    vec2 TexCoords;
+} OUT;
+
+layout (std140) uniform Pass
+{
+    mat4 view;
+    mat4 projection;
+};
+
+// the depth prepass and the shading pass must produce the same depth
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = projection * view * inModel * vec4(inPos, 1.0);
+
+    OUT.Normal = mat3(transpose(inverse(inModel))) * inNormal;
+    OUT.TexCoords = inTexCoords;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 330 core
+
+uniform sampler2D source;
+
+out float Depth;
+
+void main()
+{
+    ivec2 sourceSize = textureSize(source, 0);
+    ivec2 first = ivec2(gl_FragCoord.xy) * 2;
+
+    // odd sized sources fold their last row and column into the last texel
+    ivec2 last = first + 1;
+    if (first.x + 3 == sourceSize.x)
+        last.x++;
+    if (first.y + 3 == sourceSize.y)
+        last.y++;
+    last = min(last, sourceSize - 1);
+
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+    {
+        for (int x = first.x; x <= last.x; ++x)
+            depth = max(depth, texelFetch(source, ivec2(x, y), 0).r);
+    }
+
+    Depth = depth;
+}
\ No newline at end of file
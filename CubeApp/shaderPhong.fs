@@ -6,17 +6,38 @@ in v2f
     vec3 Normal;
     vec2 TexCoords;
     vec4 FragPosLightSpace;
+    float ViewDepth;
 } IN;
 
 
-uniform vec3 lightPos; 
-uniform vec3 viewPos; 
-uniform vec3 lightColor;
+layout (std140) uniform Lighting
+{
+    mat4 lightSpaceMatrix;
+    vec4 lightPos;
+    vec4 lightColor;
+    vec4 viewPos;
+    // tiles per pixel, log depth to slice scale and bias
+    vec4 clusterScale;
+    // froxel grid size, point light count
+    vec4 clusterSize;
+    // half resolution ambient occlusion size, enabled
+    vec4 occlusionSize;
+};
 
 uniform sampler2D shadowMap;
 
 uniform sampler2D texture1;
 
+// position and radius, then color, per point light
+uniform samplerBuffer pointLights;
+// offset and count into clusterIndices per froxel
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+
+// half resolution ambient occlusion and the view depth it was computed at
+uniform sampler2D occlusion;
+uniform sampler2D occlusionDepth;
+
 out vec4 FragColor;
 
 float ShadowCalculation()
@@ -31,7 +52,7 @@ float ShadowCalculation()
     float currentDepth = projCoords.z;
     // calculate bias (based on depth map resolution and slope)
     vec3 normal = normalize(IN.Normal);
-    vec3 lightDir = normalize(lightPos - IN.FragPos);
+    vec3 lightDir = normalize(lightPos.xyz - IN.FragPos);
     float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
     // check whether current frag pos is in shadow
     // float shadow = currentDepth - bias > closestDepth  ? 1.0 : 0.0;
@@ -55,25 +76,87 @@ float ShadowCalculation()
     return shadow;
 }
 
+// point lights of the froxel this fragment is in
+vec3 PointLighting(vec3 norm, vec3 viewDir)
+{
+    if (clusterSize.w == 0.0)
+        return vec3(0.0);
+
+    ivec3 size = ivec3(clusterSize.xyz);
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, log(max(IN.ViewDepth, 1e-5)) * clusterScale.z + clusterScale.w);
+    cluster = clamp(cluster, ivec3(0), size - 1);
+    uvec2 range = texelFetch(clusterGrid, (cluster.z * size.y + cluster.y) * size.x + cluster.x).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(pointLights, light * 2);
+        vec3 color = texelFetch(pointLights, light * 2 + 1).rgb;
+
+        vec3 toLight = positionRadius.xyz - IN.FragPos;
+        float distanceSquared = dot(toLight, toLight);
+        // smooth falloff reaching zero at the radius
+        float falloff = clamp(1.0 - distanceSquared / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        if (falloff <= 0.0)
+            continue;
+
+        vec3 lightDir = toLight * inversesqrt(distanceSquared);
+        float diff = max(dot(norm, lightDir), 0.0);
+        float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), 32);
+        result += (diff + 0.5 * spec) * color * falloff * falloff;
+    }
+    return result;
+}
+
+// bilateral upsample of the half resolution ambient occlusion: bilinear weights, lowered
+// for texels whose depth differs from this pixel
+float AmbientOcclusion(float viewDepth)
+{
+    if (occlusionSize.z == 0.0)
+        return 1.0;
+
+    ivec2 size = ivec2(occlusionSize.xy);
+    vec2 position = gl_FragCoord.xy * 0.5 - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = fract(position);
+
+    float total = 0.0;
+    float weight = 0.0;
+    for (int y = 0; y <= 1; ++y)
+    {
+        for (int x = 0; x <= 1; ++x)
+        {
+            ivec2 tap = clamp(base + ivec2(x, y), ivec2(0), size - 1);
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            float depth = texelFetch(occlusionDepth, tap, 0).r;
+            float w = bilinear / (1e-3 + abs(depth - viewDepth) / viewDepth);
+            total += texelFetch(occlusion, tap, 0).r * w;
+            weight += w;
+        }
+    }
+    return weight > 0.0 ? total / weight : 1.0;
+}
+
 void main()
 {
     float ambientStrength = 0.1;
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientStrength * lightColor.xyz * AmbientOcclusion(IN.ViewDepth);
   	
     vec3 norm = normalize(IN.Normal);
-    vec3 lightDir = normalize(lightPos - IN.FragPos);
+    vec3 lightDir = normalize(lightPos.xyz - IN.FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor;
+    vec3 diffuse = diff * lightColor.xyz;
     
     float specularStrength = 0.5;
-    vec3 viewDir = normalize(viewPos - IN.FragPos);
+    vec3 viewDir = normalize(viewPos.xyz - IN.FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-    vec3 specular = specularStrength * spec * lightColor;  
+    vec3 specular = specularStrength * spec * lightColor.xyz;  
 
     float shadow = ShadowCalculation();  
 	
-	vec4 light = vec4((ambient + (diffuse + specular) * (1.0 - shadow)), 0.0);
+	vec4 light = vec4((ambient + (diffuse + specular) * (1.0 - shadow) + PointLighting(norm, viewDir)), 0.0);
 	vec4 tex = texture(texture1, IN.TexCoords);
 
 	FragColor = light * tex;
@@ -2,6 +2,7 @@
 layout (location = 0) in vec3 inPos;
 layout (location = 1) in vec3 inNormal;
 layout (location = 2) in vec2 inTexCoords;
+layout (location = 3) in mat4 inModel;
 
 out v2f 
 {
@@ -9,20 +10,40 @@ out v2f
     vec3 Normal;
     vec2 TexCoords;
     vec4 FragPosLightSpace;
+    float ViewDepth;
 } OUT;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+layout (std140) uniform Pass
+{
+    mat4 view;
+    mat4 projection;
+};
+
+layout (std140) uniform Lighting
+{
+    mat4 lightSpaceMatrix;
+    vec4 lightPos;
+    vec4 lightColor;
+    vec4 viewPos;
+    // tiles per pixel, log depth to slice scale and bias
+    vec4 clusterScale;
+    // froxel grid size, point light count
+    vec4 clusterSize;
+    // half resolution ambient occlusion size, enabled
+    vec4 occlusionSize;
+};
+
 
+// the depth prepass and the shading pass must produce the same depth
+invariant gl_Position;
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(inPos, 1.0f);
+	gl_Position = projection * view * inModel * vec4(inPos, 1.0f);
 
-    OUT.FragPos = vec3(model * vec4(inPos, 1.0));
-    OUT.Normal = mat3(transpose(inverse(model))) * inNormal;  
+    OUT.FragPos = vec3(inModel * vec4(inPos, 1.0));
+    OUT.Normal = mat3(transpose(inverse(inModel))) * inNormal;  
     OUT.TexCoords = inTexCoords;
     OUT.FragPosLightSpace = lightSpaceMatrix * vec4(OUT.FragPos, 1.0);
+    OUT.ViewDepth = -(view * vec4(OUT.FragPos, 1.0)).z;
 }
\ No newline at end of file
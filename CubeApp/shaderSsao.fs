@@ -0,0 +1,74 @@
+#version 330 core
+
+uniform sampler2D viewDepth;
+// 1 / projection[0][0] and 1 / projection[1][1]
+uniform vec2 projectionScale;
+// half resolution viewport size
+uniform ivec2 size;
+uniform float radius;
+uniform int sampleCount;
+
+out float Occlusion;
+
+// hemisphere around +z, ordered so every prefix spreads over all lengths
+const vec3 Kernel[16] = vec3[](
+    vec3(-0.092, 0.008, 0.039),
+    vec3(0.054, 0.018, 0.320),
+    vec3(0.065, -0.060, 0.129),
+    vec3(-0.316, -0.167, 0.490),
+    vec3(-0.017, -0.112, 0.012),
+    vec3(0.179, 0.281, 0.305),
+    vec3(0.108, -0.059, 0.190),
+    vec3(-0.598, -0.407, 0.315),
+    vec3(-0.103, 0.002, 0.004),
+    vec3(-0.384, -0.012, 0.022),
+    vec3(0.136, -0.054, 0.118),
+    vec3(-0.682, -0.055, 0.120),
+    vec3(-0.029, 0.126, 0.024),
+    vec3(0.191, 0.162, 0.462),
+    vec3(0.213, 0.144, 0.088),
+    vec3(0.684, -0.416, 0.390)
+);
+
+vec3 ViewPosition(ivec2 pixel)
+{
+    pixel = clamp(pixel, ivec2(0), size - 1);
+    float depth = texelFetch(viewDepth, pixel, 0).r;
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(size) * 2.0 - 1.0;
+    return vec3(ndc * projectionScale * depth, -depth);
+}
+
+// of the two neighbours the one closer in depth, so edges do not bend the normal
+vec3 Difference(vec3 center, ivec2 pixel, ivec2 step)
+{
+    vec3 forward = ViewPosition(pixel + step) - center;
+    vec3 backward = center - ViewPosition(pixel - step);
+    return abs(forward.z) < abs(backward.z) ? forward : backward;
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec3 position = ViewPosition(pixel);
+    vec3 normal = normalize(cross(Difference(position, pixel, ivec2(1, 0)), Difference(position, pixel, ivec2(0, 1))));
+
+    // interleaved gradient noise rotates the kernel per pixel, the blur removes the pattern
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    vec3 random = vec3(cos(angle), sin(angle), 0.0);
+    vec3 tangent = normalize(random - normal * dot(random, normal));
+    mat3 tbn = mat3(tangent, cross(normal, tangent), normal);
+
+    float occlusion = 0.0;
+    for (int i = 0; i < sampleCount; ++i)
+    {
+        vec3 samplePosition = position + tbn * Kernel[i] * radius;
+        float sampleDepth = -samplePosition.z;
+        vec2 ndc = samplePosition.xy / (sampleDepth * projectionScale);
+        float sceneDepth = texelFetch(viewDepth, clamp(ivec2((ndc * 0.5 + 0.5) * vec2(size)), ivec2(0), size - 1), 0).r;
+
+        // surfaces far in front of the sample do not occlude it
+        float range = smoothstep(0.0, 1.0, radius / abs(-position.z - sceneDepth));
+        occlusion += (sceneDepth <= sampleDepth - 0.02 * radius ? 1.0 : 0.0) * range;
+    }
+    Occlusion = 1.0 - occlusion / float(sampleCount);
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#version 330 core
+
+uniform sampler2D occlusion;
+uniform sampler2D viewDepth;
+// one pixel along the blur axis
+uniform ivec2 direction;
+uniform ivec2 size;
+
+out float Occlusion;
+
+// gaussian with a sigma of 2 pixels
+const float Weights[5] = float[](0.2042, 0.1802, 0.1238, 0.0663, 0.0276);
+// falloff with the relative depth difference, keeps edges sharp
+const float DepthSharpness = 32.0;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float center = texelFetch(viewDepth, pixel, 0).r;
+
+    float total = texelFetch(occlusion, pixel, 0).r * Weights[0];
+    float weight = Weights[0];
+    for (int i = 1; i < 5; ++i)
+    {
+        for (int side = -1; side <= 1; side += 2)
+        {
+            ivec2 tap = clamp(pixel + direction * i * side, ivec2(0), size - 1);
+            float depth = texelFetch(viewDepth, tap, 0).r;
+            float w = Weights[i] * exp(-abs(depth - center) / center * DepthSharpness);
+            total += texelFetch(occlusion, tap, 0).r * w;
+            weight += w;
+        }
+    }
+    Occlusion = total / weight;
+}
\ No newline at end of file
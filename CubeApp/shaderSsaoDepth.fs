@@ -0,0 +1,22 @@
+#version 330 core
+
+uniform sampler2D depth;
+// projection[2][2] and projection[3][2], view depth is y / (ndc z + x)
+uniform vec2 depthParameters;
+// size of the full resolution viewport
+uniform ivec2 sourceSize;
+
+out float ViewDepth;
+
+// nearest of the 2x2 full resolution pixels, as a linear view depth
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy) * 2;
+    float nearest = 1.0;
+    for (int y = 0; y <= 1; ++y)
+    {
+        for (int x = 0; x <= 1; ++x)
+            nearest = min(nearest, texelFetch(depth, min(pixel + ivec2(x, y), sourceSize - 1), 0).r);
+    }
+    ViewDepth = depthParameters.y / (nearest * 2.0 - 1.0 + depthParameters.x);
+}
\ No newline at end of file
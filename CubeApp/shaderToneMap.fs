@@ -0,0 +1,58 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+// the HDR scene, rendered into the lower left part of the texture
+uniform sampler2D source;
+// rendered size over texture size
+uniform vec2 sourceScale;
+// 0 is plain bilinear, above 0 sharpens what dynamic resolution rendered smaller
+uniform float sharpness;
+
+// first level of the bloom chain
+uniform sampler2D bloom;
+uniform vec2 bloomScale;
+// 0 without bloom
+uniform float bloomStrength;
+
+uniform float exposure;
+
+out vec4 FragColor;
+
+// fitted ACES filmic curve
+vec3 ToneMap(vec3 color)
+{
+    color *= exposure;
+    return clamp((color * (2.51 * color + 0.03)) / (color * (2.43 * color + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(source, 0));
+    // stay half a texel inside the rendered part so nothing outside bleeds in
+    vec2 uv = clamp(TexCoords * sourceScale, 0.5 * texelSize, sourceScale - 0.5 * texelSize);
+
+    vec3 center = texture(source, uv).rgb;
+    if (sharpness > 0.0)
+    {
+        // unsharp mask against the four neighbours, limited to their range to avoid halos
+        vec3 left = texture(source, uv - vec2(texelSize.x, 0.0)).rgb;
+        vec3 right = texture(source, uv + vec2(texelSize.x, 0.0)).rgb;
+        vec3 down = texture(source, uv - vec2(0.0, texelSize.y)).rgb;
+        vec3 up = texture(source, uv + vec2(0.0, texelSize.y)).rgb;
+
+        vec3 minimum = min(center, min(min(left, right), min(down, up)));
+        vec3 maximum = max(center, max(max(left, right), max(down, up)));
+        vec3 sharpened = center + (4.0 * center - left - right - down - up) * 0.25 * sharpness;
+        center = clamp(sharpened, minimum, maximum);
+    }
+
+    if (bloomStrength > 0.0)
+    {
+        vec2 bloomTexelSize = 1.0 / vec2(textureSize(bloom, 0));
+        vec2 bloomUv = clamp(TexCoords * bloomScale, 0.5 * bloomTexelSize, bloomScale - 0.5 * bloomTexelSize);
+        center += texture(bloom, bloomUv).rgb * bloomStrength;
+    }
+
+    FragColor = vec4(ToneMap(center), 1.0);
+}
\ No newline at end of file